@@ -0,0 +1,662 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "sql_async.h"
+#include "log.h"
+
+// 死锁时服务器回滚整个事务, 而不只是出错的语句
+static const unsigned int DEADLOCK_ERRNO = 1213;  // ER_LOCK_DEADLOCK
+
+sql_async::sql_async() : m_port(0), m_close_log(0), m_epollfd(-1), m_eventfd(-1), m_conns(NULL), m_conn_num(0) {
+}
+
+sql_async::~sql_async() {
+    for (int i = 0; i < m_conn_num; ++i) {
+        if (m_conns[i].result)
+            mysql_free_result(m_conns[i].result);
+        m_conns[i].stmts.clear();
+        if (m_conns[i].mysql)
+            mysql_close(m_conns[i].mysql);
+    }
+    delete[] m_conns;
+    if (m_eventfd >= 0)
+        close(m_eventfd);
+}
+
+sql_async *sql_async::get_instance() {
+    static sql_async instance;
+    return &instance;
+}
+
+void sql_async::init(std::string url, std::string user, std::string passwd, std::string dbname,
+                     int port, int conn_num, int close_log) {
+    m_url = url;
+    m_user = user;
+    m_passwd = passwd;
+    m_dbname = dbname;
+    m_port = port;
+    m_close_log = close_log;
+
+    m_conns = new sql_conn[conn_num];
+    m_conn_num = conn_num;
+    for (int i = 0; i < conn_num; ++i) {
+        sql_conn *c = &m_conns[i];
+        c->mysql = NULL;
+        c->fd = -1;
+        c->state = CLOSED;
+        c->task = NULL;
+        c->result = NULL;
+        c->stmt_id = STMT_NONE;
+        c->stmt = NULL;
+        c->group_size = 0;
+        c->group_pos = 0;
+        c->deadline = 0;
+        c->expire = 0;
+        c->retry_at = 0;
+    }
+}
+
+bool sql_async::start(int epollfd) {
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventfd < 0)
+        return false;
+
+    epoll_event event;
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, m_eventfd, &event) < 0) {
+        close(m_eventfd);
+        m_eventfd = -1;
+        return false;
+    }
+    m_epollfd = epollfd;
+
+    for (int i = 0; i < m_conn_num; ++i)
+        connect(&m_conns[i]);
+    return true;
+}
+
+/* 非阻塞连接, 必须在连接前打开 MYSQL_OPT_NONBLOCK */
+void sql_async::connect(sql_conn *c) {
+    c->mysql = mysql_init(NULL);
+    if (!c->mysql) {
+        c->retry_at = time(NULL) + RETRY_INTERVAL;
+        return;
+    }
+    mysql_options(c->mysql, MYSQL_OPT_NONBLOCK, 0);
+
+    MYSQL *ret = NULL;
+    c->state = CONNECTING;
+    int status = mysql_real_connect_start(&ret, c->mysql, m_url.c_str(), m_user.c_str(), m_passwd.c_str(),
+                                          m_dbname.c_str(), m_port, NULL, 0);
+    c->fd = mysql_get_socket(c->mysql);
+    if (c->fd >= 0) {
+        epoll_event event;
+        event.data.fd = c->fd;
+        event.events = 0;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, c->fd, &event);
+    }
+
+    if (status) {
+        wait(c, status);
+        return;
+    }
+    if (!ret) {
+        LOG_ERROR("async mysql connect error:%s", mysql_error(c->mysql));
+        disconnect(c);
+        return;
+    }
+    c->state = IDLE;
+    wait(c, MYSQL_WAIT_READ);
+    dispatch();
+}
+
+/* 关闭连接, 等待 on_tick 重连 */
+void sql_async::disconnect(sql_conn *c) {
+    if (c->fd >= 0)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, c->fd, 0);
+    // 预处理语句属于连接, 重连后要重新 prepare
+    c->stmts.clear();
+    c->stmt = NULL;
+    if (c->mysql)
+        mysql_close(c->mysql);
+    c->mysql = NULL;
+    c->fd = -1;
+    c->state = CLOSED;
+    c->deadline = 0;
+    c->retry_at = time(NULL) + RETRY_INTERVAL;
+}
+
+void sql_async::submit(sql_task *task) {
+    task->err = 0;
+    task->result = NULL;
+    task->submitted = time(NULL);
+
+    m_lock.lock();
+    m_queue.push_back(task);
+    m_lock.unlock();
+
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+void sql_async::cancel(sql_task *task) {
+    m_lock.lock();
+    m_queue.remove(task);
+    m_lock.unlock();
+
+    for (int i = 0; i < m_conn_num; ++i) {
+        sql_conn *c = &m_conns[i];
+        if (c->task == task)
+            c->task = NULL;
+        for (int j = 0; j < c->group_size; ++j) {
+            if (c->group[j] == task)
+                c->group[j] = NULL;
+        }
+    }
+}
+
+bool sql_async::owns(int fd) const {
+    if (fd < 0)
+        return false;
+    if (fd == m_eventfd)
+        return true;
+    for (int i = 0; i < m_conn_num; ++i) {
+        if (m_conns[i].fd == fd)
+            return true;
+    }
+    return false;
+}
+
+sql_async::sql_conn *sql_async::find(int fd) {
+    for (int i = 0; i < m_conn_num; ++i) {
+        if (m_conns[i].fd == fd)
+            return &m_conns[i];
+    }
+    return NULL;
+}
+
+void sql_async::on_event(int fd, unsigned int events) {
+    if (fd == m_eventfd) {
+        uint64_t count;
+        ::read(m_eventfd, &count, sizeof(count));
+        dispatch();
+        return;
+    }
+
+    sql_conn *c = find(fd);
+    if (!c)
+        return;
+
+    // 空闲连接上有事件, 说明服务器关闭了连接
+    if (c->state == IDLE) {
+        LOG_WARN("%s", "async mysql connection closed by server");
+        disconnect(c);
+        connect(c);
+        return;
+    }
+
+    int status = 0;
+    if (events & EPOLLIN)
+        status |= MYSQL_WAIT_READ;
+    if (events & EPOLLOUT)
+        status |= MYSQL_WAIT_WRITE;
+    if (events & EPOLLPRI)
+        status |= MYSQL_WAIT_EXCEPT;
+    // 出错时交给驱动去读写, 由它报告具体错误
+    if (events & (EPOLLERR | EPOLLHUP))
+        status |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+    step(c, status);
+}
+
+void sql_async::on_tick() {
+    time_t now = time(NULL);
+
+    // 排队太久的任务: 连接全部断开, 或者都被卡住的查询占着; 先移出队列, 解锁后再回调
+    std::list<sql_task *> expired;
+    m_lock.lock();
+    std::list<sql_task *>::iterator it = m_queue.begin();
+    while (it != m_queue.end()) {
+        if (now - (*it)->submitted >= QUERY_TIMEOUT) {
+            expired.push_back(*it);
+            it = m_queue.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    m_lock.unlock();
+    if (!expired.empty())
+        LOG_ERROR("%d async mysql queries timed out in queue", (int)expired.size());
+    for (it = expired.begin(); it != expired.end(); ++it)
+        fail(*it, TIMEOUT);
+
+    for (int i = 0; i < m_conn_num; ++i) {
+        sql_conn *c = &m_conns[i];
+        if (c->expire && now >= c->expire)
+            abort_running(c);
+        else if (c->deadline && now >= c->deadline)
+            step(c, MYSQL_WAIT_TIMEOUT);
+        else if (c->state == CLOSED && now >= c->retry_at)
+            connect(c);
+    }
+}
+
+/* 按驱动返回的等待状态注册事件, status 为0表示操作已完成, 返回false */
+bool sql_async::wait(sql_conn *c, int status) {
+    if (!status)
+        return false;
+
+    epoll_event event;
+    event.data.fd = c->fd;
+    event.events = 0;
+    if (status & MYSQL_WAIT_READ)
+        event.events |= EPOLLIN;
+    if (status & MYSQL_WAIT_WRITE)
+        event.events |= EPOLLOUT;
+    if (status & MYSQL_WAIT_EXCEPT)
+        event.events |= EPOLLPRI;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, c->fd, &event);
+
+    c->deadline = 0;
+    if (status & MYSQL_WAIT_TIMEOUT)
+        c->deadline = time(NULL) + mysql_get_timeout_value(c->mysql);
+    return true;
+}
+
+void sql_async::execute(sql_conn *c, sql_task *task) {
+    c->task = task;
+    c->result = NULL;
+    c->stmt_id = task->stmt;
+    c->value.clear();
+    c->found = false;
+
+    if (c->stmt_id != STMT_NONE) {
+        for (int i = 0; i < stmt_cache::param_count(c->stmt_id); ++i)
+            c->params[i] = task->params[i];
+        run_stmt(c);
+        return;
+    }
+
+    c->sql = task->sql;
+    c->state = QUERY;
+
+    int err = 0;
+    int status = mysql_real_query_start(&err, c->mysql, c->sql.c_str(), c->sql.size());
+    if (wait(c, status))
+        return;
+    if (err) {
+        finish(c, mysql_errno(c->mysql));
+        return;
+    }
+    step(c, 0);
+}
+
+/* 用 c->params 执行 c->stmt_id, 结束后调用 finish */
+void sql_async::run_stmt(sql_conn *c) {
+    c->stmt = c->stmts.find(c->stmt_id);
+    if (c->stmt) {
+        execute_stmt(c);
+        return;
+    }
+
+    /* 这条连接上第一次执行该语句, 先 prepare */
+    c->stmt = mysql_stmt_init(c->mysql);
+    if (!c->stmt) {
+        finish(c, mysql_errno(c->mysql));
+        return;
+    }
+    c->state = PREPARE;
+    int err = 0;
+    const char *sql = stmt_cache::sql(c->stmt_id);
+    int status = mysql_stmt_prepare_start(&err, c->stmt, sql, strlen(sql));
+    if (wait(c, status))
+        return;
+    prepared(c, err);
+}
+
+/* dispatch 已经把任务放进 c->group, 参数先拷出来, 之后提交者取消也不影响 */
+void sql_async::execute_group(sql_conn *c) {
+    c->task = NULL;
+    c->result = NULL;
+    c->stmt_id = c->group[0]->stmt;
+    for (int i = 0; i < c->group_size; ++i) {
+        for (int j = 0; j < stmt_cache::param_count(c->stmt_id); ++j)
+            c->group_params[i][j] = c->group[i]->params[j];
+        c->group_err[i] = 0;
+    }
+    c->group_pos = 0;
+    group_query(c, BEGIN, "START TRANSACTION");
+}
+
+void sql_async::group_query(sql_conn *c, STATE state, const char *sql) {
+    c->state = state;
+    int err = 0;
+    int status = mysql_real_query_start(&err, c->mysql, sql, strlen(sql));
+    if (wait(c, status))
+        return;
+    group_step(c, err ? mysql_errno(c->mysql) : 0);
+}
+
+/*
+    组提交的一步完成: BEGIN -> 逐行执行 -> COMMIT
+    单行出错(如用户名重复)只回滚这一条语句, 记下错误继续执行下一行;
+    连接出错或死锁时整个事务已经作废, 整组以该错误结束
+ */
+void sql_async::group_step(sql_conn *c, unsigned int err) {
+    if (c->state == COMMIT || err >= 2000 || err == DEADLOCK_ERRNO || (c->state == BEGIN && err)) {
+        group_done(c, err);
+        return;
+    }
+
+    if (c->state != BEGIN)
+        c->group_err[c->group_pos++] = err;
+    if (c->group_pos == c->group_size) {
+        group_query(c, COMMIT, "COMMIT");
+        return;
+    }
+
+    for (int j = 0; j < stmt_cache::param_count(c->stmt_id); ++j)
+        c->params[j] = c->group_params[c->group_pos][j];
+    c->value.clear();
+    c->found = false;
+    run_stmt(c);
+}
+
+/* 事务结束, err 非0表示整组都没有写入 */
+void sql_async::group_done(sql_conn *c, unsigned int err) {
+    int size = c->group_size;
+    c->group_size = 0;
+    c->deadline = 0;
+    c->expire = 0;
+    c->state = IDLE;
+
+    if (err >= 2000) {
+        LOG_ERROR("async mysql group commit error:%s", mysql_error(c->mysql));
+        disconnect(c);
+        connect(c);
+    }
+    else {
+        if (err)
+            LOG_ERROR("async mysql group commit error:%u", err);
+        wait(c, MYSQL_WAIT_READ);
+    }
+
+    for (int i = 0; i < size; ++i) {
+        if (c->group[i])
+            fail(c->group[i], err ? err : c->group_err[i]);
+    }
+    dispatch();
+}
+
+void sql_async::prepared(sql_conn *c, int err) {
+    if (err) {
+        unsigned int code = mysql_stmt_errno(c->stmt);
+        mysql_stmt_close(c->stmt);
+        c->stmt = NULL;
+        finish(c, code);
+        return;
+    }
+    c->stmts.set(c->stmt_id, c->stmt);
+    execute_stmt(c);
+}
+
+void sql_async::execute_stmt(sql_conn *c) {
+    if (!c->binding.bind(c->stmt, c->stmt_id, c->params)) {
+        finish(c, mysql_stmt_errno(c->stmt));
+        return;
+    }
+    c->state = EXECUTE;
+    int err = 0;
+    int status = mysql_stmt_execute_start(&err, c->stmt);
+    if (wait(c, status))
+        return;
+    executed(c, err);
+}
+
+void sql_async::executed(sql_conn *c, int err) {
+    if (err) {
+        finish(c, mysql_stmt_errno(c->stmt));
+        return;
+    }
+    c->state = STMT_STORE;
+    int status = mysql_stmt_store_result_start(&err, c->stmt);
+    if (wait(c, status))
+        return;
+    stored(c, err);
+}
+
+/* 结果集已在本地, 取第一行不再访问网络 */
+void sql_async::stored(sql_conn *c, int err) {
+    if (err) {
+        finish(c, mysql_stmt_errno(c->stmt));
+        return;
+    }
+    finish(c, c->binding.fetch(c->stmt, &c->value, &c->found));
+}
+
+/*
+    状态机: CONNECTING -> IDLE
+            QUERY -> (有结果集) STORE -> IDLE
+            (第一次) PREPARE -> EXECUTE -> STMT_STORE -> IDLE
+            组提交: BEGIN -> (每行) EXECUTE -> STMT_STORE -> COMMIT -> IDLE
+    每个 *_cont 返回非0表示还要等待, 重新注册事件后返回
+ */
+void sql_async::step(sql_conn *c, int status) {
+    switch (c->state) {
+        case CONNECTING: {
+            MYSQL *ret = NULL;
+            status = mysql_real_connect_cont(&ret, c->mysql, status);
+            if (wait(c, status))
+                return;
+            if (!ret) {
+                LOG_ERROR("async mysql connect error:%s", mysql_error(c->mysql));
+                disconnect(c);
+                return;
+            }
+            c->state = IDLE;
+            wait(c, MYSQL_WAIT_READ);
+            dispatch();
+            return;
+        }
+        case QUERY: {
+            // execute 中 start 已直接完成时 status 为0, 不需要 cont
+            if (status) {
+                int err = 0;
+                status = mysql_real_query_cont(&err, c->mysql, status);
+                if (wait(c, status))
+                    return;
+                if (err) {
+                    finish(c, mysql_errno(c->mysql));
+                    return;
+                }
+            }
+            if (mysql_field_count(c->mysql) == 0) {
+                finish(c, 0);
+                return;
+            }
+            c->state = STORE;
+            status = mysql_store_result_start(&c->result, c->mysql);
+            if (wait(c, status))
+                return;
+            finish(c, c->result ? 0 : mysql_errno(c->mysql));
+            return;
+        }
+        case STORE: {
+            status = mysql_store_result_cont(&c->result, c->mysql, status);
+            if (wait(c, status))
+                return;
+            finish(c, c->result ? 0 : mysql_errno(c->mysql));
+            return;
+        }
+        case PREPARE: {
+            int err = 0;
+            status = mysql_stmt_prepare_cont(&err, c->stmt, status);
+            if (wait(c, status))
+                return;
+            prepared(c, err);
+            return;
+        }
+        case EXECUTE: {
+            int err = 0;
+            status = mysql_stmt_execute_cont(&err, c->stmt, status);
+            if (wait(c, status))
+                return;
+            executed(c, err);
+            return;
+        }
+        case STMT_STORE: {
+            int err = 0;
+            status = mysql_stmt_store_result_cont(&err, c->stmt, status);
+            if (wait(c, status))
+                return;
+            stored(c, err);
+            return;
+        }
+        case BEGIN:
+        case COMMIT: {
+            int err = 0;
+            status = mysql_real_query_cont(&err, c->mysql, status);
+            if (wait(c, status))
+                return;
+            group_step(c, err ? mysql_errno(c->mysql) : 0);
+            return;
+        }
+        default:
+            return;
+    }
+}
+
+void sql_async::finish(sql_conn *c, unsigned int err) {
+    // 组提交中的一行结束, 继续执行下一行
+    if (c->group_size > 0) {
+        group_step(c, err);
+        return;
+    }
+
+    sql_task *task = c->task;
+    MYSQL_RES *result = c->result;
+    c->task = NULL;
+    c->result = NULL;
+    c->deadline = 0;
+    c->expire = 0;
+    c->state = IDLE;
+
+    // 2000 以上是客户端错误(断线、超时等), 连接不能再用
+    if (err >= 2000) {
+        LOG_ERROR("async mysql query error:%s", mysql_error(c->mysql));
+        disconnect(c);
+        connect(c);
+    }
+    else {
+        // 空闲时只关心服务器主动关闭
+        wait(c, MYSQL_WAIT_READ);
+    }
+
+    if (task) {
+        task->err = err;
+        task->result = result;
+        task->value = c->value;
+        task->found = c->found;
+        task->done(task);
+    }
+    else if (result) {
+        mysql_free_result(result);
+    }
+    dispatch();
+}
+
+/*
+    超时时驱动可能正阻塞在任意一步, 没有办法取消, 只能关闭连接重连;
+    先收集要回调的任务, 回调里可能提交新的查询
+ */
+void sql_async::abort_running(sql_conn *c) {
+    LOG_ERROR("async mysql query timed out after %d seconds, reconnecting", QUERY_TIMEOUT);
+    sql_task *tasks[GROUP_MAX];
+    int n = 0;
+    if (c->group_size > 0) {
+        for (int i = 0; i < c->group_size; ++i) {
+            if (c->group[i])
+                tasks[n++] = c->group[i];
+        }
+        c->group_size = 0;
+    }
+    else if (c->task) {
+        tasks[n++] = c->task;
+    }
+    c->task = NULL;
+    if (c->result) {
+        mysql_free_result(c->result);
+        c->result = NULL;
+    }
+    c->expire = 0;
+    disconnect(c);
+    connect(c);
+
+    for (int i = 0; i < n; ++i)
+        fail(tasks[i], TIMEOUT);
+}
+
+void sql_async::fail(sql_task *task, unsigned int err) {
+    task->err = err;
+    task->result = NULL;
+    task->value.clear();
+    task->found = false;
+    task->done(task);
+}
+
+void sql_async::dispatch() {
+    for (int i = 0; i < m_conn_num; ++i) {
+        sql_conn *c = &m_conns[i];
+        if (c->state != IDLE)
+            continue;
+
+        m_lock.lock();
+        if (m_queue.empty()) {
+            m_lock.unlock();
+            return;
+        }
+        sql_task *task = m_queue.front();
+        m_queue.pop_front();
+
+        /*
+            把排队中同一语句的 batch 任务一起取出, 放进一个事务;
+            积压的任务按可用连接数平分, 忙碌的连接结束后还能分到一份
+         */
+        int n = 1;
+        if (task->batch && task->stmt != STMT_NONE) {
+            int live = 0;
+            for (int j = 0; j < m_conn_num; ++j)
+                live += m_conns[j].state != CLOSED && m_conns[j].state != CONNECTING;
+            int limit = ((int)m_queue.size() + live) / live;
+            if (limit > GROUP_MAX)
+                limit = GROUP_MAX;
+
+            c->group[0] = task;
+            std::list<sql_task *>::iterator it = m_queue.begin();
+            while (it != m_queue.end() && n < limit) {
+                if ((*it)->batch && (*it)->stmt == task->stmt) {
+                    c->group[n++] = *it;
+                    it = m_queue.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+        m_lock.unlock();
+
+        // 队列按提交顺序排列, 第一个任务最早提交
+        c->expire = task->submitted + QUERY_TIMEOUT;
+        if (n > 1) {
+            c->group_size = n;
+            execute_group(c);
+        }
+        else {
+            execute(c, task);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#ifndef SQL_ASYNC_H
+#define SQL_ASYNC_H
+
+#include <time.h>
+#include <list>
+#include <string>
+#include <mysql/mysql.h>
+#include "locker.h"
+#include "sql_stmt.h"
+
+/* 一次异步查询, 由提交者持有; 回调之前不能重复提交 */
+struct sql_task {
+    SQL_STMT stmt;         // 预处理语句, STMT_NONE 表示执行文本查询 sql
+    std::string params[stmt_cache::MAX_PARAMS];
+    std::string sql;
+    unsigned int err;      // 0 表示成功, 否则为 mysql_errno
+    MYSQL_RES *result;     // 文本查询带结果集时有效, 由回调负责 mysql_free_result
+    std::string value;     // 预处理语句结果的第一行
+    bool found;
+    bool batch;            // 可以和排队中同一语句的任务合并到一个事务里提交
+    time_t submitted;      // 提交时间, 超过 sql_async::QUERY_TIMEOUT 没有完成时以 TIMEOUT 结束
+    void (*done)(sql_task *task);
+    void *ctx;
+};
+
+/*************************************************************
+ * 非阻塞数据库查询
+ *
+ * 使用 MariaDB 的非阻塞接口(mysql_*_start / mysql_*_cont), 数据库连接的
+ * 套接字注册在主线程的 epoll 中, 查询过程中不占用任何工作线程:
+ *   - 工作线程 submit 后直接返回, 请求挂起
+ *   - 主线程收到 eventfd 通知后把排队的查询分配给空闲连接
+ *   - 连接可读/可写时推进查询, 完成后在主线程回调, 请求继续处理
+ * 除 submit 外, 其余接口都只在主线程调用, 连接状态不需要加锁
+ *
+ * 组提交: 连接空闲时如果队列里积压了多个 batch 任务, 一次取出至多
+ * GROUP_MAX 个放进同一个事务, 逐行执行后只 COMMIT 一次, 整组提交后
+ * 再逐个回调. 负载低时队列里只有一个任务, 照常单独执行, 不增加延迟
+ *
+ * 超时: 数据库卡住或连接全部断开时, 任务从提交起超过 QUERY_TIMEOUT 秒
+ * 以 TIMEOUT 错误回调; 还在排队的直接移除, 正在执行的关闭连接后重连
+ **************************************************************/
+class sql_async {
+public:
+    static const int RETRY_INTERVAL = 5;  // 连接断开后重连的间隔(秒)
+    static const int GROUP_MAX = 64;      // 一个事务最多合并的任务数
+    /*
+        任务从提交到完成的最长时间(秒), 由 on_tick 检查, 实际在 5~10 秒之间结束,
+        早于挂起请求的连接被空闲定时器关闭(3 * TIMESLOT)
+     */
+    static const int QUERY_TIMEOUT = 5;
+    static const unsigned int TIMEOUT = 3024;  // 超时任务的错误码, 和 MySQL 的 ER_QUERY_TIMEOUT 相同
+
+public:
+    static sql_async *get_instance();
+
+    /* 创建连接句柄, 还不连接 */
+    void init(std::string url, std::string user, std::string passwd, std::string dbname,
+              int port, int conn_num, int close_log);
+    /* 注册到事件循环并开始连接 */
+    bool start(int epollfd);
+    bool enabled() const { return m_epollfd >= 0 && m_conn_num > 0; }
+
+    /* 提交查询, 可在任意线程调用 */
+    void submit(sql_task *task);
+    /* 提交者提前结束(连接关闭): 排队中的直接移除, 执行中的完成后不再回调 */
+    void cancel(sql_task *task);
+
+    /* fd 是否属于本模块(eventfd 或数据库连接) */
+    bool owns(int fd) const;
+    void on_event(int fd, unsigned int events);
+    /* 定时器周期调用, 处理驱动超时、任务超时和断线重连 */
+    void on_tick();
+
+private:
+    enum STATE {
+        CLOSED = 0,   // 未连接, 等待重连
+        CONNECTING,
+        IDLE,
+        QUERY,        // mysql_real_query
+        STORE,        // mysql_store_result
+        PREPARE,      // mysql_stmt_prepare, 每条连接每个语句只做一次
+        EXECUTE,      // mysql_stmt_execute
+        STMT_STORE,   // mysql_stmt_store_result
+        BEGIN,        // 组提交: START TRANSACTION
+        COMMIT        // 组提交: COMMIT
+    };
+    struct sql_conn {
+        MYSQL *mysql;
+        int fd;
+        STATE state;
+        std::string sql;   // 查询语句和参数的副本, 提交者取消后仍然有效
+        std::string params[stmt_cache::MAX_PARAMS];
+        sql_task *task;    // NULL 表示提交者已取消
+        MYSQL_RES *result;
+        SQL_STMT stmt_id;
+        MYSQL_STMT *stmt;
+        stmt_cache stmts;  // 连接上已预处理的语句
+        stmt_binding binding;
+        std::string value;
+        bool found;
+        /* 组提交, group_size 为0表示当前不是组提交 */
+        sql_task *group[GROUP_MAX];  // NULL 表示该任务已取消
+        std::string group_params[GROUP_MAX][stmt_cache::MAX_PARAMS];
+        unsigned int group_err[GROUP_MAX];
+        int group_size;
+        int group_pos;               // 正在执行的行
+        time_t deadline;   // 驱动要求的超时时刻, 0 表示没有
+        time_t expire;     // 正在执行的任务的超时时刻, 由其中最早提交的任务决定, 0 表示空闲
+        time_t retry_at;   // CLOSED 状态下的重连时刻
+    };
+
+private:
+    sql_async();
+    ~sql_async();
+
+    void connect(sql_conn *c);
+    void disconnect(sql_conn *c);
+    void execute(sql_conn *c, sql_task *task);
+    void run_stmt(sql_conn *c);
+    void execute_group(sql_conn *c);
+    void group_query(sql_conn *c, STATE state, const char *sql);
+    void group_step(sql_conn *c, unsigned int err);
+    void group_done(sql_conn *c, unsigned int err);
+    void prepared(sql_conn *c, int err);
+    void execute_stmt(sql_conn *c);
+    void executed(sql_conn *c, int err);
+    void stored(sql_conn *c, int err);
+    /* 用驱动返回的等待状态推进状态机, status 为就绪的事件 */
+    void step(sql_conn *c, int status);
+    bool wait(sql_conn *c, int status);
+    void finish(sql_conn *c, unsigned int err);
+    /* 正在执行的任务超时: 关闭连接, 以 TIMEOUT 回调所有任务 */
+    void abort_running(sql_conn *c);
+    /* 以 err 结束一个没有结果的任务 */
+    void fail(sql_task *task, unsigned int err);
+    /* 把排队的查询分配给空闲连接 */
+    void dispatch();
+    sql_conn *find(int fd);
+
+private:
+    std::string m_url;
+    std::string m_user;
+    std::string m_passwd;
+    std::string m_dbname;
+    int m_port;
+    int m_close_log;
+
+    int m_epollfd;
+    int m_eventfd;              // 工作线程提交查询后唤醒主线程
+    sql_conn *m_conns;
+    int m_conn_num;
+
+    locker m_lock;              // 保护 m_queue
+    std::list<sql_task *> m_queue;
+};
+
+#endif  // SQL_ASYNC_H
@@ -0,0 +1,346 @@
+#include <mysql/mysql.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "sql_connection_pool.h"
+
+using namespace std;
+
+// 线程上一次使用的连接槽, 取连接时优先尝试
+static thread_local int t_last_slot = -1;
+
+connection_pool::connection_pool()
+{
+    m_MaxConn = 0;
+    m_MinConn = 0;
+    m_CurConn = 0;
+    m_FreeConn = 0;
+    m_LiveConn = 0;
+    m_slots = NULL;
+    m_ping_tid = 0;
+    m_stop = false;
+}
+
+connection_pool *connection_pool::GetInstance()
+{
+    static connection_pool connPool;
+    return &connPool;
+}
+
+//构造初始化
+void connection_pool::init(string url, string User, string PassWord, string DBName, int Port, int MaxConn, int close_log,
+                           int MinConn)
+{
+    m_url = url;
+    m_Port = to_string(Port);
+    m_User = User;
+    m_PassWord = PassWord;
+    m_DatabaseName = DBName;
+    m_close_log = close_log;
+
+    if (MaxConn <= 0)
+        MaxConn = 1;
+    if (MinConn > MaxConn)
+        MinConn = MaxConn;
+    m_MaxConn = MaxConn;
+    m_MinConn = MinConn;
+
+    m_slots = new slot[m_MaxConn];
+    for (int i = 0; i < m_MaxConn; i++)
+    {
+        m_slots[i].state = SLOT_EMPTY;
+        m_slots[i].conn = NULL;
+        m_slots[i].last_used = 0;
+    }
+
+    //先建立最少的连接, 其余在负载上来时再建立
+    for (int i = 0; i < m_MinConn; i++)
+    {
+        MYSQL *con = connect();
+        if (!con)
+            break;
+        m_slots[i].conn = con;
+        m_slots[i].last_used = time(NULL);
+        m_slots[i].state = SLOT_FREE;
+        ++m_LiveConn;
+        ++m_FreeConn;
+        reserve.post();
+    }
+
+    if (pthread_create(&m_ping_tid, NULL, ping_thread, this) != 0)
+        m_ping_tid = 0;
+}
+
+MYSQL *connection_pool::connect()
+{
+    MYSQL *con = mysql_init(NULL);
+    if (con == NULL)
+    {
+        LOG_ERROR("%s", "MySQL init error");
+        return NULL;
+    }
+
+    if (mysql_real_connect(con, m_url.c_str(), m_User.c_str(), m_PassWord.c_str(), m_DatabaseName.c_str(),
+                           atoi(m_Port.c_str()), NULL, 0) == NULL)
+    {
+        LOG_ERROR("MySQL connect error:%s", mysql_error(con));
+        mysql_close(con);
+        return NULL;
+    }
+    return con;
+}
+
+int connection_pool::claim_free()
+{
+    // 名额对应的空闲槽一定存在, 但可能正被其他拿到名额的线程抢先占用, 继续找下一个
+    int i = t_last_slot >= 0 && t_last_slot < m_MaxConn ? t_last_slot : 0;
+    while (true)
+    {
+        int expected = SLOT_FREE;
+        if (m_slots[i].state.compare_exchange_strong(expected, SLOT_BUSY))
+            return i;
+        i = (i + 1) % m_MaxConn;
+    }
+}
+
+int connection_pool::grow()
+{
+    for (int i = 0; i < m_MaxConn; i++)
+    {
+        int expected = SLOT_EMPTY;
+        if (!m_slots[i].state.compare_exchange_strong(expected, SLOT_BUSY))
+            continue;
+
+        // 建立连接比较慢, 槽已经占住, 不持有任何锁
+        MYSQL *con = connect();
+        if (!con)
+        {
+            m_slots[i].state = SLOT_EMPTY;
+            return -1;
+        }
+        m_slots[i].conn = con;
+        ++m_LiveConn;
+        LOG_INFO("connection pool grow to %d", (int)m_LiveConn);
+        return i;
+    }
+    return -1;
+}
+
+//当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+MYSQL *connection_pool::GetConnection()
+{
+    if (!m_slots)
+        return NULL;
+
+    int i;
+    if (reserve.trywait())
+    {
+        --m_FreeConn;
+        i = claim_free();
+    }
+    else if ((i = grow()) < 0)
+    {
+        //数据库不可用且一个连接也没有时不再等待
+        if (m_LiveConn == 0)
+            return NULL;
+        reserve.wait();
+        --m_FreeConn;
+        i = claim_free();
+    }
+
+    ++m_CurConn;
+    t_last_slot = i;
+    return m_slots[i].conn;
+}
+
+void connection_pool::put_back(int i)
+{
+    m_slots[i].last_used = time(NULL);
+    m_slots[i].state.store(SLOT_FREE);
+    ++m_FreeConn;
+    reserve.post();
+}
+
+int connection_pool::find_slot(MYSQL *con)
+{
+    if (NULL == con || !m_slots)
+        return -1;
+
+    //通常就是本线程上一次取出的槽
+    int i = t_last_slot;
+    if (i >= 0 && i < m_MaxConn && m_slots[i].conn == con)
+        return i;
+    for (i = 0; i < m_MaxConn; i++)
+    {
+        if (m_slots[i].conn == con)
+            return i;
+    }
+    return -1;
+}
+
+//关闭槽上的连接, 预处理语句随连接一起释放
+void connection_pool::close_slot(int i)
+{
+    m_slots[i].stmts.clear();
+    mysql_close(m_slots[i].conn);
+    m_slots[i].conn = NULL;
+}
+
+stmt_cache *connection_pool::GetStatements(MYSQL *con)
+{
+    int i = find_slot(con);
+    return i < 0 ? NULL : &m_slots[i].stmts;
+}
+
+//释放当前使用的连接
+bool connection_pool::ReleaseConnection(MYSQL *con)
+{
+    int i = find_slot(con);
+    if (i < 0)
+        return false;
+
+    --m_CurConn;
+    put_back(i);
+    return true;
+}
+
+void *connection_pool::ping_thread(void *args)
+{
+    connection_pool *pool = (connection_pool *)args;
+    while (true)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += PING_INTERVAL;
+
+        pool->m_stop_lock.lock();
+        if (!pool->m_stop)
+            pool->m_stop_cond.timewait(pool->m_stop_lock.get(), t);
+        bool stop = pool->m_stop;
+        pool->m_stop_lock.unlock();
+        if (stop)
+            break;
+
+        pool->ping_idle();
+    }
+    return NULL;
+}
+
+/*
+    逐个检查空闲连接: 和取连接一样先拿空闲名额再占用槽, 检查期间不会被取走;
+    ping 失败的重新连接, 超过最少连接数且空闲太久的关闭
+ */
+void connection_pool::ping_idle()
+{
+    time_t now = time(NULL);
+    for (int i = 0; i < m_MaxConn; i++)
+    {
+        if (m_slots[i].state.load() != SLOT_FREE || !reserve.trywait())
+            continue;
+
+        int expected = SLOT_FREE;
+        if (!m_slots[i].state.compare_exchange_strong(expected, SLOT_BUSY))
+        {
+            reserve.post();
+            continue;
+        }
+        --m_FreeConn;
+
+        MYSQL *con = m_slots[i].conn;
+        bool idle_too_long = now - m_slots[i].last_used > IDLE_TIMEOUT;
+        if (idle_too_long && m_LiveConn > m_MinConn)
+        {
+            close_slot(i);
+            --m_LiveConn;
+            m_slots[i].state = SLOT_EMPTY;
+            LOG_INFO("connection pool shrink to %d", (int)m_LiveConn);
+            continue;
+        }
+
+        if (mysql_ping(con) != 0)
+        {
+            LOG_ERROR("MySQL ping error:%s, reconnect", mysql_error(con));
+            close_slot(i);
+            con = connect();
+            m_slots[i].conn = con;
+            if (!con)
+            {
+                --m_LiveConn;
+                m_slots[i].state = SLOT_EMPTY;
+                continue;
+            }
+        }
+        put_back(i);
+    }
+
+    //数据库恢复后补足最少连接数
+    while (m_LiveConn < m_MinConn)
+    {
+        int slot = grow();
+        if (slot < 0)
+            break;
+        put_back(slot);
+    }
+}
+
+//当前空闲的连接数
+int connection_pool::GetFreeConn()
+{
+    return m_FreeConn;
+}
+
+int connection_pool::GetUsedConn()
+{
+    return m_CurConn;
+}
+
+int connection_pool::GetMaxConn()
+{
+    return m_MaxConn;
+}
+
+//销毁数据库连接池
+void connection_pool::DestroyPool()
+{
+    if (m_ping_tid)
+    {
+        m_stop_lock.lock();
+        m_stop = true;
+        m_stop_cond.signal();
+        m_stop_lock.unlock();
+        pthread_join(m_ping_tid, NULL);
+        m_ping_tid = 0;
+    }
+
+    if (m_slots)
+    {
+        for (int i = 0; i < m_MaxConn; i++)
+        {
+            if (m_slots[i].conn)
+                close_slot(i);
+        }
+        delete[] m_slots;
+        m_slots = NULL;
+    }
+    m_CurConn = 0;
+    m_FreeConn = 0;
+    m_LiveConn = 0;
+}
+
+connection_pool::~connection_pool()
+{
+    DestroyPool();
+}
+
+connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool){
+    *SQL = connPool->GetConnection();
+
+    conRAII = *SQL;
+    poolRAII = connPool;
+}
+
+connectionRAII::~connectionRAII(){
+    poolRAII->ReleaseConnection(conRAII);
+}
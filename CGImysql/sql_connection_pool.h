@@ -0,0 +1,110 @@
+#ifndef _CONNECTION_POOL_
+#define _CONNECTION_POOL_
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <mysql/mysql.h>
+#include <string.h>
+#include <string>
+#include "locker.h"
+#include "sql_stmt.h"
+#include "log.h"
+
+using namespace std;
+
+/*************************************************************
+ * 数据库连接池
+ *
+ *   - 启动时只建立 MinConn 个连接, 负载上来后按需增长到 MaxConn,
+ *     空闲超过 IDLE_TIMEOUT 的多余连接由后台线程关闭
+ *   - 每个连接槽用一个原子状态表示空闲/占用, 取出和归还都是 CAS, 不加锁;
+ *     信号量只记录空闲连接数, 连接用满时让取连接的线程阻塞等待
+ *   - 线程优先取回自己上一次用过的连接
+ *   - 后台线程定期 ping 空闲连接, 断开的重新连接, 数据库重启后连接池自动恢复
+ **************************************************************/
+class connection_pool
+{
+public:
+    static const int PING_INTERVAL = 30;   // 后台检查空闲连接的间隔(秒)
+    static const int IDLE_TIMEOUT = 300;   // 超过 MinConn 的连接空闲多久后关闭(秒)
+
+public:
+    MYSQL *GetConnection();              //获取数据库连接
+    bool ReleaseConnection(MYSQL *conn); //释放连接
+    int GetFreeConn();                   //获取空闲连接数
+    int GetUsedConn();                   //获取已取出的连接数
+    int GetMaxConn();                    //获取最大连接数
+    stmt_cache *GetStatements(MYSQL *conn); //取出连接上的预处理语句, 只能在持有连接时使用
+    void DestroyPool();                  //销毁所有连接
+
+    //单例模式
+    static connection_pool *GetInstance();
+
+    void init(string url, string User, string PassWord, string DataBaseName, int Port, int MaxConn, int close_log,
+              int MinConn = 1);
+
+private:
+    connection_pool();
+    ~connection_pool();
+
+    enum SLOT_STATE {
+        SLOT_EMPTY = 0,  // 没有连接
+        SLOT_FREE,       // 空闲, 可以取出
+        SLOT_BUSY        // 已被取出, 或正在连接/检查
+    };
+    struct slot {
+        std::atomic<int> state;
+        std::atomic<MYSQL *> conn;
+        time_t last_used;  // 只由持有该槽的线程读写
+        stmt_cache stmts;  // 连接上的预处理语句, 同样只由持有者使用
+    };
+
+    MYSQL *connect();
+    /* 已经拿到一个空闲名额, 找到并占用对应的空闲槽 */
+    int claim_free();
+    /* 还没到上限时占用一个空槽并建立新连接, 失败返回-1 */
+    int grow();
+    void put_back(int i);
+    int find_slot(MYSQL *con);
+    void close_slot(int i);
+
+    static void *ping_thread(void *args);
+    void ping_idle();
+
+private:
+    int m_MaxConn;  //最大连接数
+    int m_MinConn;  //最少保持的连接数
+    std::atomic<int> m_CurConn;   //当前已使用的连接数
+    std::atomic<int> m_FreeConn;  //当前空闲的连接数
+    std::atomic<int> m_LiveConn;  //已建立的连接数
+    slot *m_slots;                //连接槽, 长度为 m_MaxConn
+    sem reserve;                  //空闲连接数
+
+    pthread_t m_ping_tid;
+    bool m_stop;
+    locker m_stop_lock;
+    cond m_stop_cond;
+
+public:
+    string m_url;          //主机地址
+    string m_Port;         //数据库端口号
+    string m_User;         //登陆数据库用户名
+    string m_PassWord;     //登陆数据库密码
+    string m_DatabaseName; //使用数据库名
+    int m_close_log;       //日志开关
+};
+
+class connectionRAII{
+
+public:
+    connectionRAII(MYSQL **con, connection_pool *connPool);
+    ~connectionRAII();
+
+private:
+    MYSQL *conRAII;
+    connection_pool *poolRAII;
+};
+
+#endif
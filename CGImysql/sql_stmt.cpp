@@ -0,0 +1,111 @@
+#include <string.h>
+#include "sql_stmt.h"
+
+static const char *stmt_sql[STMT_COUNT] = {
+    "INSERT INTO user(username, passwd) VALUES(?, ?)",
+    "SELECT passwd FROM user WHERE username = ?"
+};
+
+static const int stmt_params[STMT_COUNT] = {2, 1};
+
+stmt_cache::stmt_cache() {
+    for (int i = 0; i < STMT_COUNT; ++i)
+        m_stmts[i] = NULL;
+}
+
+stmt_cache::~stmt_cache() {
+    clear();
+}
+
+const char *stmt_cache::sql(SQL_STMT id) {
+    return stmt_sql[id];
+}
+
+int stmt_cache::param_count(SQL_STMT id) {
+    return stmt_params[id];
+}
+
+MYSQL_STMT *stmt_cache::get(MYSQL *mysql, SQL_STMT id) {
+    if (m_stmts[id])
+        return m_stmts[id];
+
+    MYSQL_STMT *stmt = mysql_stmt_init(mysql);
+    if (!stmt)
+        return NULL;
+    if (mysql_stmt_prepare(stmt, stmt_sql[id], strlen(stmt_sql[id])) != 0) {
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    m_stmts[id] = stmt;
+    return stmt;
+}
+
+void stmt_cache::set(SQL_STMT id, MYSQL_STMT *stmt) {
+    if (m_stmts[id] && m_stmts[id] != stmt)
+        mysql_stmt_close(m_stmts[id]);
+    m_stmts[id] = stmt;
+}
+
+void stmt_cache::clear() {
+    for (int i = 0; i < STMT_COUNT; ++i) {
+        if (m_stmts[i]) {
+            mysql_stmt_close(m_stmts[i]);
+            m_stmts[i] = NULL;
+        }
+    }
+}
+
+bool stmt_binding::bind(MYSQL_STMT *stmt, SQL_STMT id, const std::string *params) {
+    int count = stmt_cache::param_count(id);
+    memset(m_param_bind, 0, sizeof(m_param_bind));
+    for (int i = 0; i < count; ++i) {
+        m_params[i] = params[i];
+        m_param_len[i] = m_params[i].size();
+        m_param_bind[i].buffer_type = MYSQL_TYPE_STRING;
+        m_param_bind[i].buffer = (void *)m_params[i].data();
+        m_param_bind[i].buffer_length = m_param_len[i];
+        m_param_bind[i].length = &m_param_len[i];
+    }
+    return mysql_stmt_bind_param(stmt, m_param_bind) == 0;
+}
+
+unsigned int stmt_binding::fetch(MYSQL_STMT *stmt, std::string *value, bool *found) {
+    if (found)
+        *found = false;
+    if (mysql_stmt_field_count(stmt) == 0)
+        return 0;
+
+    memset(&m_result_bind, 0, sizeof(m_result_bind));
+    m_result_bind.buffer_type = MYSQL_TYPE_STRING;
+    m_result_bind.buffer = m_value;
+    m_result_bind.buffer_length = VALUE_LEN;
+    m_result_bind.length = &m_value_len;
+    m_result_bind.is_null = &m_is_null;
+    if (mysql_stmt_bind_result(stmt, &m_result_bind) != 0)
+        return mysql_stmt_errno(stmt);
+
+    /* 结果集已经 store 到本地, fetch 不会再访问网络 */
+    int ret = mysql_stmt_fetch(stmt);
+    if (ret == 0 || ret == MYSQL_DATA_TRUNCATED) {
+        if (found)
+            *found = !m_is_null;
+        if (value && !m_is_null)
+            value->assign(m_value, m_value_len < (unsigned long)VALUE_LEN ? m_value_len : VALUE_LEN);
+    }
+    mysql_stmt_free_result(stmt);
+    return (ret == 0 || ret == MYSQL_NO_DATA || ret == MYSQL_DATA_TRUNCATED) ? 0 : mysql_stmt_errno(stmt);
+}
+
+unsigned int stmt_execute(MYSQL *mysql, stmt_cache *cache, SQL_STMT id, const std::string *params,
+                          std::string *value, bool *found) {
+    MYSQL_STMT *stmt = cache->get(mysql, id);
+    if (!stmt)
+        return mysql_errno(mysql);
+
+    stmt_binding binding;
+    if (!binding.bind(stmt, id, params))
+        return mysql_stmt_errno(stmt);
+    if (mysql_stmt_execute(stmt) != 0 || mysql_stmt_store_result(stmt) != 0)
+        return mysql_stmt_errno(stmt);
+    return binding.fetch(stmt, value, found);
+}
@@ -0,0 +1,71 @@
+#ifndef SQL_STMT_H
+#define SQL_STMT_H
+
+#include <string>
+#include <mysql/mysql.h>
+
+/* 预处理语句编号 */
+enum SQL_STMT {
+    STMT_NONE = -1,
+    STMT_INSERT_USER = 0,   // INSERT INTO user(username, passwd) VALUES(?, ?)
+    STMT_SELECT_USER,       // SELECT passwd FROM user WHERE username = ?
+    STMT_COUNT
+};
+
+/*************************************************************
+ * 一条连接上已经预处理过的语句
+ * 服务端只解析一次, 之后用二进制协议传参数执行, 参数不经过SQL拼接;
+ * 语句句柄属于连接, 连接关闭或重连前必须 clear
+ **************************************************************/
+class stmt_cache {
+public:
+    static const int MAX_PARAMS = 2;
+
+public:
+    stmt_cache();
+    ~stmt_cache();
+
+    static const char *sql(SQL_STMT id);
+    static int param_count(SQL_STMT id);
+
+    /* 取出语句, 第一次使用时在这条连接上 prepare(阻塞), 失败返回NULL */
+    MYSQL_STMT *get(MYSQL *mysql, SQL_STMT id);
+    /* 只取已有的语句, 非阻塞路径自己完成 prepare 后用 set 放入 */
+    MYSQL_STMT *find(SQL_STMT id) const { return m_stmts[id]; }
+    void set(SQL_STMT id, MYSQL_STMT *stmt);
+    void clear();
+
+private:
+    MYSQL_STMT *m_stmts[STMT_COUNT];
+};
+
+/*************************************************************
+ * 一次执行的参数和结果缓冲区
+ * 所有语句最多一个结果列, 取第一行; 执行期间缓冲区必须保持有效
+ **************************************************************/
+class stmt_binding {
+public:
+    static const int VALUE_LEN = 256;  // 结果列的最大长度
+
+public:
+    /* 绑定参数, 参数内容拷贝到本对象中 */
+    bool bind(MYSQL_STMT *stmt, SQL_STMT id, const std::string *params);
+    /* 执行完毕后取第一行, 没有结果集或没有行时 found 为false */
+    unsigned int fetch(MYSQL_STMT *stmt, std::string *value, bool *found);
+
+private:
+    std::string m_params[stmt_cache::MAX_PARAMS];
+    MYSQL_BIND m_param_bind[stmt_cache::MAX_PARAMS];
+    unsigned long m_param_len[stmt_cache::MAX_PARAMS];
+
+    MYSQL_BIND m_result_bind;
+    char m_value[VALUE_LEN];
+    unsigned long m_value_len;
+    my_bool m_is_null;
+};
+
+/* 同步执行预处理语句, 返回0或错误码 */
+unsigned int stmt_execute(MYSQL *mysql, stmt_cache *cache, SQL_STMT id, const std::string *params,
+                          std::string *value = NULL, bool *found = NULL);
+
+#endif  // SQL_STMT_H
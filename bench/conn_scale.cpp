@@ -0,0 +1,469 @@
+/*
+    大量空闲连接的规模测试
+    ./conn_scale [选项]
+      -h 地址      默认 127.0.0.1
+      -p 端口      默认 9006
+      -c 连接数    默认 100000
+      -s 源地址数  默认 8, 本地连接从 127.0.0.1 .. 127.0.0.N 发起,
+                   每个源地址最多用到 ip_local_port_range 个端口(约 28000)
+      -C 并发连接数  同时在握手中的连接数, 默认 256
+      -d 秒数      连接建立后的空闲阶段时长, 默认 30
+      -r 每秒请求数  空闲阶段在所有连接上轮流发请求, 默认为 连接数/10,
+                   即每个连接约 10 秒一个请求, 短于服务器 15 秒的超时
+      -u 路径      空闲阶段请求的路径, 默认 /
+      -M 字节      每个连接占用的常驻内存超过该值时返回 2, 用于回归检查
+    过程: 建立所有连接, 等服务器 accept 完毕, 记录内存, 再空闲并轮流发请求;
+    服务器的常驻内存、定时器 tick 耗时和 accept 数从 /metrics 读取.
+    结束时向标准输出打印一行 JSON; 没有建立全部连接时返回 1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "histogram.h"
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+struct options {
+    std::string host;
+    int port;
+    int connections;
+    int sources;
+    int inflight;
+    double duration;
+    double rate;
+    std::string path;
+    long max_rss_per_conn;
+};
+
+enum CONN_STATE {
+    CONN_CONNECTING = 0,
+    CONN_IDLE,       // 已连接, 没有未完成的请求
+    CONN_WAITING,    // 等待响应
+    CONN_CLOSED
+};
+
+struct connection {
+    int fd;
+    CONN_STATE state;
+    long long started;  // 开始连接或发出请求的时刻
+    std::string in;     // 已收到的响应
+};
+
+static long long now_usec() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+}
+
+static struct sockaddr_in g_addr;
+
+/*************************************************************
+ * 读取服务器的 /metrics
+ **************************************************************/
+typedef std::map<std::string, double> metric_map;
+
+/* 去掉 chunked 编码 */
+static std::string dechunk(const std::string &body) {
+    std::string out;
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t eol = body.find("\r\n", pos);
+        if (eol == std::string::npos)
+            break;
+        size_t len = strtoul(body.c_str() + pos, NULL, 16);
+        if (len == 0)
+            break;
+        out.append(body, eol + 2, len);
+        pos = eol + 2 + len + 2;
+    }
+    return out;
+}
+
+static bool scrape(metric_map &out) {
+    out.clear();
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    const char req[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    if (write(fd, req, sizeof(req) - 1) != (ssize_t)sizeof(req) - 1) {
+        close(fd);
+        return false;
+    }
+    std::string resp;
+    char buf[16384];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        resp.append(buf, n);
+    close(fd);
+
+    size_t head = resp.find("\r\n\r\n");
+    if (head == std::string::npos || resp.compare(0, 12, "HTTP/1.1 200") != 0)
+        return false;
+    std::string body = resp.substr(head + 4);
+    if (strcasestr(resp.substr(0, head).c_str(), "chunked"))
+        body = dechunk(body);
+
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t eol = body.find('\n', pos);
+        if (eol == std::string::npos)
+            eol = body.size();
+        std::string line = body.substr(pos, eol - pos);
+        pos = eol + 1;
+        size_t sp = line.rfind(' ');
+        if (line.empty() || line[0] == '#' || sp == std::string::npos)
+            continue;
+        out[line.substr(0, sp)] = atof(line.c_str() + sp + 1);
+    }
+    return true;
+}
+
+static double metric(const metric_map &m, const char *name) {
+    metric_map::const_iterator it = m.find(name);
+    return it == m.end() ? -1 : it->second;
+}
+
+/* 系统中 TCP 缓冲区占用的页数(/proc/net/sockstat), 包括两端的连接 */
+static long tcp_mem_pages() {
+    FILE *fp = fopen("/proc/net/sockstat", "r");
+    if (!fp)
+        return -1;
+    char line[256];
+    long pages = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        const char *p = strstr(line, " mem ");
+        if (strncmp(line, "TCP:", 4) == 0 && p)
+            pages = atol(p + 5);
+    }
+    fclose(fp);
+    return pages;
+}
+
+/*************************************************************
+ * 连接
+ **************************************************************/
+static bool conn_open(int epfd, std::vector<connection> &conns, int index, const options &opt) {
+    connection &c = conns[index];
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0)
+        return false;
+
+    /* 轮流使用各个源地址, 端口在 connect 时按四元组分配 */
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    struct sockaddr_in src;
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index % opt.sources);
+    if (bind(c.fd, (struct sockaddr *)&src, sizeof(src)) < 0 ||
+        (connect(c.fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0 && errno != EINPROGRESS)) {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.state = CONN_CONNECTING;
+    c.started = now_usec();
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u32 = index;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+static void conn_close(int epfd, connection &c) {
+    if (c.fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+    }
+    c.fd = -1;
+    c.state = CONN_CLOSED;
+    c.in.clear();
+}
+
+/* 读取响应; 连接被关闭时返回 false. 收完一个响应时把 done 置为 true */
+static bool conn_read(connection &c, bool &done) {
+    char buf[16384];
+    done = false;
+    while (true) {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n > 0) {
+            c.in.append(buf, n);
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN)
+            break;
+        return false;
+    }
+    if (c.state != CONN_WAITING) {
+        c.in.clear();
+        return true;
+    }
+    size_t head = c.in.find("\r\n\r\n");
+    if (head == std::string::npos)
+        return true;
+    const char *cl = strcasestr(c.in.c_str(), "Content-Length:");
+    size_t len = cl && cl < c.in.c_str() + head ? strtoul(cl + 15, NULL, 10) : 0;
+    if (c.in.size() >= head + 4 + len) {
+        c.in.clear();
+        done = true;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    options opt;
+    opt.host = "127.0.0.1";
+    opt.port = 9006;
+    opt.connections = 100000;
+    opt.sources = 8;
+    opt.inflight = 256;
+    opt.duration = 30;
+    opt.rate = 0;
+    opt.path = "/";
+    opt.max_rss_per_conn = 0;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:c:s:C:d:r:u:M:")) != -1) {
+        switch (ch) {
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 'c': opt.connections = atoi(optarg); break;
+            case 's': opt.sources = atoi(optarg); break;
+            case 'C': opt.inflight = atoi(optarg); break;
+            case 'd': opt.duration = atof(optarg); break;
+            case 'r': opt.rate = atof(optarg); break;
+            case 'u': opt.path = optarg; break;
+            case 'M': opt.max_rss_per_conn = atol(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-c connections] [-s sources] [-C inflight] "
+                        "[-d seconds] [-r rate] [-u path] [-M max_rss_per_conn]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (opt.connections < 1 || opt.sources < 1 || opt.sources > 254 || opt.inflight < 1) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+    if (opt.rate <= 0)
+        opt.rate = opt.connections / 10.0;
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host.c_str(), &g_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", opt.host.c_str());
+        return 1;
+    }
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < (rlim_t)opt.connections + 16)
+        fprintf(stderr, "warning: RLIMIT_NOFILE is %llu, not enough for %d connections\n",
+                (unsigned long long)limit.rlim_cur, opt.connections);
+
+    metric_map before, connected, after;
+    if (!scrape(before))
+        fprintf(stderr, "warning: cannot read /metrics, server side numbers will be -1\n");
+
+    int epfd = epoll_create1(0);
+    std::vector<connection> conns(opt.connections);
+    for (int i = 0; i < opt.connections; ++i) {
+        conns[i].fd = -1;
+        conns[i].state = CONN_CLOSED;
+    }
+    struct epoll_event events[1024];
+    long long connect_timeout = 10 * 1000000LL;
+
+    /* 建立连接, 同时最多 opt.inflight 个在握手 */
+    long long begin = now_usec();
+    int next = 0, pending = 0, established = 0, failed = 0, closed = 0;
+    histogram connect_hist;
+    while (next < opt.connections || pending > 0) {
+        while (pending < opt.inflight && next < opt.connections) {
+            if (conn_open(epfd, conns, next, opt))
+                ++pending;
+            else
+                ++failed;
+            ++next;
+        }
+        int n = epoll_wait(epfd, events, 1024, 100);
+        long long now = now_usec();
+        for (int i = 0; i < n; ++i) {
+            connection &c = conns[events[i].data.u32];
+            if (c.state == CONN_CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                --pending;
+                if (err) {
+                    ++failed;
+                    conn_close(epfd, c);
+                    continue;
+                }
+                ++established;
+                connect_hist.record(now - c.started);
+                c.state = CONN_IDLE;
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.u32 = events[i].data.u32;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+            } else {
+                // 服务器满了会发一句提示后关闭
+                bool done;
+                if (!conn_read(c, done)) {
+                    ++closed;
+                    conn_close(epfd, c);
+                }
+            }
+        }
+        /* 握手超时的连接 */
+        if (n == 0) {
+            for (int i = 0; i < next; ++i) {
+                connection &c = conns[i];
+                if (c.state == CONN_CONNECTING && now - c.started > connect_timeout) {
+                    --pending;
+                    ++failed;
+                    conn_close(epfd, c);
+                }
+            }
+        }
+    }
+    long long connect_usec = now_usec() - begin;
+
+    /* 等服务器 accept 完所有连接, 最多 30 秒; 两次读到的活动连接数都包含读 /metrics 的连接本身 */
+    double base = metric(before, "tws_active_connections");
+    long long accept_usec = -1;
+    for (int i = 0; i < 300 && base >= 0 && scrape(connected); ++i) {
+        if (metric(connected, "tws_active_connections") - base >= established - closed) {
+            accept_usec = now_usec() - begin;
+            break;
+        }
+        usleep(100000);
+    }
+    sleep(1);
+    scrape(connected);
+    double accepted = base >= 0 ? metric(connected, "tws_active_connections") - base : -1;
+    long tcp_pages_connected = tcp_mem_pages();
+
+    /* 空闲阶段: 按固定速率在连接上轮流发请求 */
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: keep-alive\r\n\r\n",
+                               opt.path.c_str(), opt.host.c_str(), opt.port);
+    histogram request_hist;
+    long long sent = 0, responses = 0, skipped = 0;
+    long long idle_begin = now_usec();
+    long long idle_end = idle_begin + (long long)(opt.duration * 1000000);
+    long long interval = (long long)(1000000 / opt.rate);
+    long long next_send = idle_begin;
+    int cursor = 0;
+    while (true) {
+        long long now = now_usec();
+        if (now >= idle_end)
+            break;
+        while (next_send <= now) {
+            next_send += interval > 0 ? interval : 1;
+            connection &c = conns[cursor];
+            cursor = (cursor + 1) % opt.connections;
+            if (c.state != CONN_IDLE) {
+                ++skipped;
+                continue;
+            }
+            if (write(c.fd, request, request_len) != request_len) {
+                ++closed;
+                conn_close(epfd, c);
+                continue;
+            }
+            c.state = CONN_WAITING;
+            c.started = now;
+            ++sent;
+        }
+        long long wait = (next_send - now) / 1000;
+        int n = epoll_wait(epfd, events, 1024, wait > 100 ? 100 : (int)wait);
+        now = now_usec();
+        for (int i = 0; i < n; ++i) {
+            connection &c = conns[events[i].data.u32];
+            bool done;
+            if (!conn_read(c, done)) {
+                ++closed;
+                conn_close(epfd, c);
+                continue;
+            }
+            if (done) {
+                request_hist.record(now - c.started);
+                ++responses;
+                c.state = CONN_IDLE;
+            }
+        }
+    }
+    scrape(after);
+    long tcp_pages_after = tcp_mem_pages();
+
+    int open_conns = 0;
+    for (int i = 0; i < opt.connections; ++i) {
+        if (conns[i].state != CONN_CLOSED)
+            ++open_conns;
+    }
+
+    double rss_before = metric(before, "process_resident_memory_bytes");
+    double rss_connected = metric(connected, "process_resident_memory_bytes");
+    double rss_after = metric(after, "process_resident_memory_bytes");
+    double rss_per_conn = -1, rss_total_per_conn = -1;
+    if (rss_before >= 0 && rss_connected >= 0 && established > 0) {
+        rss_per_conn = (rss_connected - rss_before) / established;
+        rss_total_per_conn = rss_connected / established;
+    }
+
+    printf("{\"connections\":%d,\"established\":%d,\"failed\":%d,\"closed_by_server\":%d,\"open_at_end\":%d,"
+           "\"connect_secs\":%.2f,\"connect_rate\":%.0f,\"accept_secs\":%.2f,\"accept_rate\":%.0f,"
+           "\"server_active\":%.0f,\"server_rejects\":%.0f,\"timer_expirations\":%.0f,"
+           "\"connect_us\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu},"
+           "\"rss_before\":%.0f,\"rss_connected\":%.0f,\"rss_after\":%.0f,"
+           "\"rss_per_conn\":%.0f,\"rss_total_per_conn\":%.0f,\"tcp_mem_pages\":[%ld,%ld],"
+           "\"idle_secs\":%.1f,\"requests\":%lld,\"responses\":%lld,\"skipped\":%lld,"
+           "\"request_us\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu},"
+           "\"timer_tick_us\":{\"count\":%.0f,\"p50\":%.0f,\"p99\":%.0f,\"sum\":%.0f}}\n",
+           opt.connections, established, failed, closed, open_conns, connect_usec / 1e6,
+           established / (connect_usec / 1e6), accept_usec / 1e6, accept_usec > 0 ? established / (accept_usec / 1e6) : -1,
+           accepted,
+           metric(after, "tws_rejects_total"), metric(after, "tws_timer_expirations_total"),
+           (unsigned long long)connect_hist.quantile(0.5), (unsigned long long)connect_hist.quantile(0.99),
+           (unsigned long long)connect_hist.max(), rss_before, rss_connected, rss_after, rss_per_conn,
+           rss_total_per_conn, tcp_pages_connected, tcp_pages_after, opt.duration, sent, responses, skipped,
+           (unsigned long long)request_hist.quantile(0.5), (unsigned long long)request_hist.quantile(0.99),
+           (unsigned long long)request_hist.max(), metric(after, "tws_latency_us_count{phase=\"timer_tick\"}"),
+           metric(after, "tws_latency_us{phase=\"timer_tick\",quantile=\"0.5\"}"),
+           metric(after, "tws_latency_us{phase=\"timer_tick\",quantile=\"0.99\"}"),
+           metric(after, "tws_latency_us_sum{phase=\"timer_tick\"}"));
+
+    for (int i = 0; i < opt.connections; ++i)
+        conn_close(epfd, conns[i]);
+    close(epfd);
+
+    if (opt.max_rss_per_conn > 0 && rss_per_conn > opt.max_rss_per_conn) {
+        fprintf(stderr, "rss per connection %.0f exceeds %ld\n", rss_per_conn, opt.max_rss_per_conn);
+        return 2;
+    }
+    return established == opt.connections ? 0 : 1;
+}
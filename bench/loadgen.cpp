@@ -0,0 +1,625 @@
+/*
+    HTTP 压测客户端
+    ./loadgen [选项] 路径...
+      -h 地址      默认 127.0.0.1
+      -p 端口      默认 9006
+      -c 连接数    默认 100
+      -t 线程数    默认 4, 连接平均分给各线程, 每个线程一个 epoll
+      -d 秒数      压测时长, 默认 10
+      -r 每秒请求数  0(默认)为闭环: 每个连接收到响应后立即发下一个;
+                   大于0为开环: 按固定速率发送, 延迟从计划发送的时刻算起,
+                   服务器变慢时排队的时间也计入延迟(修正 coordinated omission);
+                   每个线程最多 1000000, 即 -r 不超过 -t 的一百万倍
+      -k 0|1       长连接, 默认 1; 为 0 时每个请求新建连接
+      -P 深度      每个连接上同时未完成的请求数(流水线), 默认 1
+      -b 消息体    发送 POST, 否则发送 GET; 消息体中的 {n} 替换为本次压测中唯一的序号,
+                   {r} 替换为 [0, -R) 中的随机数, 如 user=user{r}&passwd=mock
+      -R 范围      {r} 的范围, 默认 10000
+      -T 秒数      请求超时, 超时的连接关闭后重连, 默认 5
+      -n 名字      场景名, 原样写入结果
+    多个路径轮流请求. 结束时向标准输出打印一行 JSON:
+    吞吐量、错误数和延迟分位数(微秒). 超时的请求, 以及开环下到结束都没能发出的请求,
+    按计划时刻到超时/结束时已经过的时间计入延迟, 不会因为没有响应而从分位数中消失
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "histogram.h"
+
+struct options {
+    std::string host;
+    int port;
+    int connections;
+    int threads;
+    double duration;
+    double rate;
+    bool keep_alive;
+    int pipeline;
+    std::string body;
+    long range;
+    double timeout;
+    std::string name;
+    std::vector<std::string> paths;
+};
+
+static long long now_usec() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+}
+
+/* 一个发出去还没收到响应的请求 */
+struct pending {
+    long long start;  // 延迟的起点: 闭环为实际发送时刻, 开环为计划发送时刻
+    long long sent;   // 实际发送时刻, 用于判断超时
+};
+
+/* 响应解析状态 */
+enum PARSE_STATE {
+    RESP_HEAD,        // 状态行和头部
+    RESP_BODY,        // Content-Length 指定长度的消息体
+    RESP_CHUNK_SIZE,  // chunked: 块长度行
+    RESP_CHUNK_DATA,  // chunked: 块数据和结尾的 \r\n
+    RESP_CHUNK_END,   // chunked: 结束块之后的空行
+    RESP_UNTIL_CLOSE  // 没有长度, 读到连接关闭为止
+};
+
+struct connection {
+    int fd;
+    bool connected;
+    long long retry_at;        // 连接失败后下次重试的时间
+    long long opened;          // 发起连接的时刻, 短连接的延迟包含建立连接
+    int path_index;
+    std::string out;           // 待发送的请求
+    size_t out_pos;
+    bool want_out;             // 已注册 EPOLLOUT
+    std::deque<pending> inflight;
+    PARSE_STATE state;
+    std::string line;          // 正在积累的头部或块长度行
+    long long left;            // 消息体或当前块剩余的字节数
+    int status;
+    bool close_after;          // 响应带 Connection: close
+};
+
+struct worker {
+    const options *opt;
+    int id;
+    int epfd;
+    std::vector<connection> conns;
+    double rate;               // 本线程的开环速率
+    long long begin;
+    long long end;
+    size_t cursor;             // 开环发送时轮流选择连接
+    long seq;                  // 本线程发出的请求数, 用于 {n}
+    unsigned int seed;         // 用于 {r}
+
+    /* 结果 */
+    histogram hist;
+    long long requests;
+    long long non_2xx;
+    long long errors;
+    long long timeouts;
+    long long bytes;
+};
+
+static struct sockaddr_in g_addr;
+
+static void conn_reset(connection &c) {
+    c.out.clear();
+    c.out_pos = 0;
+    c.want_out = false;
+    c.inflight.clear();
+    c.state = RESP_HEAD;
+    c.line.clear();
+    c.left = 0;
+    c.status = 0;
+    c.close_after = false;
+}
+
+static void conn_close(worker &w, connection &c) {
+    if (c.fd >= 0) {
+        epoll_ctl(w.epfd, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+    }
+    c.fd = -1;
+    c.connected = false;
+    conn_reset(c);
+}
+
+static bool conn_open(worker &w, connection &c) {
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0)
+        return false;
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c.fd, (struct sockaddr *)&g_addr, sizeof(g_addr)) < 0 && errno != EINPROGRESS) {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    conn_reset(c);
+    c.opened = now_usec();
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = &c - &w.conns[0];
+    epoll_ctl(w.epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    c.want_out = true;
+    return true;
+}
+
+static void conn_failed(worker &w, connection &c, long long now) {
+    ++w.errors;
+    conn_close(w, c);
+    c.retry_at = now + 100000;
+}
+
+static void update_events(worker &w, connection &c) {
+    bool want = !c.connected || c.out_pos < c.out.size();
+    if (want == c.want_out)
+        return;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (want ? (uint32_t)EPOLLOUT : (uint32_t)0);
+    ev.data.u32 = &c - &w.conns[0];
+    epoll_ctl(w.epfd, EPOLL_CTL_MOD, c.fd, &ev);
+    c.want_out = want;
+}
+
+static bool flush_out(worker &w, connection &c) {
+    while (c.out_pos < c.out.size()) {
+        ssize_t n = write(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos);
+        if (n < 0) {
+            if (errno == EAGAIN)
+                break;
+            return false;
+        }
+        c.out_pos += n;
+    }
+    if (c.out_pos == c.out.size()) {
+        c.out.clear();
+        c.out_pos = 0;
+    }
+    update_events(w, c);
+    return true;
+}
+
+/* 替换消息体中的 {n} 和 {r} */
+static std::string expand_body(worker &w) {
+    const std::string &body = w.opt->body;
+    std::string out;
+    char num[32];
+    for (size_t i = 0; i < body.size(); ++i) {
+        if (body.compare(i, 3, "{n}") == 0) {
+            snprintf(num, sizeof(num), "%ld", w.seq * w.opt->threads + w.id);
+            out += num;
+            i += 2;
+        } else if (body.compare(i, 3, "{r}") == 0) {
+            snprintf(num, sizeof(num), "%ld", (long)(rand_r(&w.seed) % w.opt->range));
+            out += num;
+            i += 2;
+        } else {
+            out += body[i];
+        }
+    }
+    ++w.seq;
+    return out;
+}
+
+/* 排入一个请求, start 为延迟的起点 */
+static void send_request(worker &w, connection &c, long long start, long long now) {
+    const options &opt = *w.opt;
+    const std::string &path = opt.paths[c.path_index];
+    c.path_index = (c.path_index + 1) % opt.paths.size();
+
+    char head[512];
+    const char *conn_hdr = opt.keep_alive ? "keep-alive" : "close";
+    if (opt.body.empty()) {
+        snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\n\r\n", path.c_str(),
+                 opt.host.c_str(), opt.port, conn_hdr);
+        c.out += head;
+    } else {
+        std::string body = expand_body(w);
+        snprintf(head, sizeof(head),
+                 "POST %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: %s\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                 "Content-Length: %zu\r\n\r\n",
+                 path.c_str(), opt.host.c_str(), opt.port, conn_hdr, body.size());
+        c.out += head;
+        c.out += body;
+    }
+    pending p;
+    p.start = start;
+    p.sent = now;
+    c.inflight.push_back(p);
+    if (c.connected && !flush_out(w, c))
+        conn_failed(w, c, now);
+}
+
+/* 连接能否再发一个请求; 短连接每个连接只发一个 */
+static bool can_send(const worker &w, const connection &c) {
+    if (c.fd < 0)
+        return false;
+    int depth = w.opt->keep_alive ? w.opt->pipeline : 1;
+    return (int)c.inflight.size() < depth && !c.close_after;
+}
+
+/* 闭环: 把连接上的流水线填满 */
+static void fill(worker &w, connection &c, long long now) {
+    if (w.rate > 0 || now >= w.end)
+        return;
+    long long start = w.opt->keep_alive ? now : c.opened;
+    while (can_send(w, c) && c.fd >= 0)
+        send_request(w, c, start, now);
+}
+
+static bool parse_head(connection &c) {
+    // 状态行 HTTP/1.1 200 OK
+    const char *sp = strchr(c.line.c_str(), ' ');
+    if (!sp)
+        return false;
+    c.status = atoi(sp + 1);
+    c.left = -1;
+    bool chunked = false;
+    c.close_after = false;
+
+    size_t pos = c.line.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < c.line.size()) {
+        size_t next = c.line.find("\r\n", pos + 2);
+        std::string h = c.line.substr(pos + 2, (next == std::string::npos ? c.line.size() : next) - pos - 2);
+        size_t colon = h.find(':');
+        if (colon != std::string::npos) {
+            std::string key = h.substr(0, colon);
+            const char *value = h.c_str() + colon + 1;
+            while (*value == ' ' || *value == '\t')
+                ++value;
+            if (strcasecmp(key.c_str(), "Content-Length") == 0)
+                c.left = atoll(value);
+            else if (strcasecmp(key.c_str(), "Transfer-Encoding") == 0 && strcasestr(value, "chunked"))
+                chunked = true;
+            else if (strcasecmp(key.c_str(), "Connection") == 0 && strcasestr(value, "close"))
+                c.close_after = true;
+        }
+        pos = next;
+    }
+    if (chunked)
+        c.state = RESP_CHUNK_SIZE;
+    else if (c.left >= 0)
+        c.state = RESP_BODY;
+    else
+        c.state = RESP_UNTIL_CLOSE;
+    return true;
+}
+
+/* 一个响应接收完毕 */
+static void complete(worker &w, connection &c, long long now) {
+    if (!c.inflight.empty()) {
+        const pending &p = c.inflight.front();
+        if (now < w.end) {
+            w.hist.record(now - p.start);
+            ++w.requests;
+            if (c.status < 200 || c.status >= 300)
+                ++w.non_2xx;
+        }
+        c.inflight.pop_front();
+    }
+    c.state = RESP_HEAD;
+    c.line.clear();
+}
+
+/* 处理收到的数据, 返回 false 表示响应格式错误 */
+static bool feed(worker &w, connection &c, const char *p, size_t n, long long now) {
+    while (n > 0) {
+        switch (c.state) {
+            case RESP_HEAD: {
+                size_t old = c.line.size();
+                c.line.append(p, n);
+                size_t end = c.line.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+                if (end == std::string::npos) {
+                    if (c.line.size() > 64 * 1024)
+                        return false;
+                    return true;
+                }
+                size_t used = end + 4 - old;
+                c.line.resize(end);
+                if (!parse_head(c))
+                    return false;
+                c.line.clear();
+                p += used;
+                n -= used;
+                if (c.state == RESP_BODY && c.left == 0)
+                    complete(w, c, now);
+                break;
+            }
+            case RESP_BODY:
+            case RESP_CHUNK_DATA: {
+                size_t take = (long long)n < c.left ? n : c.left;
+                c.left -= take;
+                p += take;
+                n -= take;
+                if (c.left == 0) {
+                    if (c.state == RESP_BODY)
+                        complete(w, c, now);
+                    else
+                        c.state = RESP_CHUNK_SIZE;
+                }
+                break;
+            }
+            case RESP_CHUNK_SIZE:
+            case RESP_CHUNK_END: {
+                const char *lf = (const char *)memchr(p, '\n', n);
+                size_t take = lf ? lf - p + 1 : n;
+                c.line.append(p, take);
+                p += take;
+                n -= take;
+                if (!lf)
+                    break;
+                long long size = strtoll(c.line.c_str(), NULL, 16);
+                bool empty = c.line == "\r\n";
+                c.line.clear();
+                if (c.state == RESP_CHUNK_END) {
+                    if (empty)
+                        complete(w, c, now);
+                } else if (size == 0) {
+                    c.state = RESP_CHUNK_END;
+                } else {
+                    c.left = size + 2;
+                    c.state = RESP_CHUNK_DATA;
+                }
+                break;
+            }
+            case RESP_UNTIL_CLOSE:
+                n = 0;
+                break;
+        }
+    }
+    return true;
+}
+
+static void on_readable(worker &w, connection &c, long long now) {
+    char buf[64 * 1024];
+    while (c.fd >= 0) {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n > 0) {
+            w.bytes += n;
+            if (!feed(w, c, buf, n, now)) {
+                conn_failed(w, c, now);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN)
+            break;
+        // 对端关闭: 读到关闭为止的响应到此结束, 还有未完成的请求算作错误
+        if (c.state == RESP_UNTIL_CLOSE)
+            complete(w, c, now);
+        bool lost = !c.inflight.empty();
+        conn_close(w, c);
+        if (lost)
+            ++w.errors;
+        return;
+    }
+    if (c.fd >= 0 && c.close_after && c.inflight.empty() && c.state == RESP_HEAD)
+        conn_close(w, c);
+}
+
+static void *run(void *arg) {
+    worker &w = *(worker *)arg;
+    const options &opt = *w.opt;
+    long long timeout = opt.timeout * 1000000;
+    // 开环: 第 planned 个请求的计划时刻按浮点算, 速率不是整微秒间隔时也不会漂移
+    long long planned = 0;
+    long long next_send = w.begin;
+    std::deque<long long> backlog;  // 开环: 到了计划时刻但没有空闲连接的请求
+    struct epoll_event events[256];
+
+    while (true) {
+        long long now = now_usec();
+        if (now >= w.end)
+            break;
+
+        /* 关闭的连接重新建立, 超时的连接关闭 */
+        for (size_t i = 0; i < w.conns.size(); ++i) {
+            connection &c = w.conns[i];
+            if (c.fd < 0 && now >= c.retry_at) {
+                if (!conn_open(w, c)) {
+                    conn_failed(w, c, now);
+                    continue;
+                }
+            }
+            if (c.fd >= 0 && !c.inflight.empty() && now - c.inflight.front().sent > timeout) {
+                w.timeouts += c.inflight.size();
+                for (size_t j = 0; j < c.inflight.size(); ++j)
+                    w.hist.record(now - c.inflight[j].start);
+                conn_close(w, c);
+            }
+        }
+
+        /* 开环: 把到期的计划请求分给有空位的连接 */
+        if (w.rate > 0) {
+            while (next_send <= now) {
+                backlog.push_back(next_send);
+                ++planned;
+                next_send = w.begin + (long long)(planned * 1000000.0 / w.rate);
+            }
+            for (size_t tried = 0; !backlog.empty() && tried < w.conns.size(); ++tried) {
+                connection &c = w.conns[w.cursor];
+                w.cursor = (w.cursor + 1) % w.conns.size();
+                while (!backlog.empty() && can_send(w, c)) {
+                    send_request(w, c, backlog.front(), now);
+                    backlog.pop_front();
+                    tried = 0;
+                }
+            }
+        }
+
+        int wait_ms = 10;
+        if (w.rate > 0 && backlog.empty()) {
+            long long gap = (next_send - now) / 1000;
+            wait_ms = gap < wait_ms ? (int)gap : wait_ms;
+        }
+        int n = epoll_wait(w.epfd, events, 256, wait_ms);
+        now = now_usec();
+        for (int i = 0; i < n; ++i) {
+            connection &c = w.conns[events[i].data.u32];
+            if (c.fd < 0)
+                continue;
+            if (!c.connected && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    conn_failed(w, c, now);
+                    continue;
+                }
+                c.connected = true;
+                fill(w, c, now);
+                if (c.fd >= 0 && !flush_out(w, c)) {
+                    conn_failed(w, c, now);
+                    continue;
+                }
+            }
+            if (c.fd >= 0 && (events[i].events & EPOLLOUT) && !flush_out(w, c)) {
+                conn_failed(w, c, now);
+                continue;
+            }
+            if (c.fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                on_readable(w, c, now);
+            if (c.fd >= 0)
+                fill(w, c, now);
+        }
+    }
+
+    for (size_t i = 0; i < w.conns.size(); ++i)
+        conn_close(w, w.conns[i]);
+    // 开环: 到结束都没能发出的请求也是超时, 延迟至少是计划时刻到结束的时间
+    w.timeouts += backlog.size();
+    for (size_t i = 0; i < backlog.size(); ++i)
+        w.hist.record(w.end - backlog[i]);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-c connections] [-t threads] [-d seconds] [-r rate]\n"
+            "          [-k 0|1] [-P pipeline] [-b body] [-R range] [-T timeout] [-n name] path...\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    options opt;
+    opt.host = "127.0.0.1";
+    opt.port = 9006;
+    opt.connections = 100;
+    opt.threads = 4;
+    opt.duration = 10;
+    opt.rate = 0;
+    opt.keep_alive = true;
+    opt.pipeline = 1;
+    opt.range = 10000;
+    opt.timeout = 5;
+    opt.name = "default";
+
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:c:t:d:r:k:P:b:R:T:n:")) != -1) {
+        switch (ch) {
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = atoi(optarg); break;
+            case 'c': opt.connections = atoi(optarg); break;
+            case 't': opt.threads = atoi(optarg); break;
+            case 'd': opt.duration = atof(optarg); break;
+            case 'r': opt.rate = atof(optarg); break;
+            case 'k': opt.keep_alive = atoi(optarg) != 0; break;
+            case 'P': opt.pipeline = atoi(optarg); break;
+            case 'b': opt.body = optarg; break;
+            case 'R': opt.range = atol(optarg); break;
+            case 'T': opt.timeout = atof(optarg); break;
+            case 'n': opt.name = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    for (int i = optind; i < argc; ++i)
+        opt.paths.push_back(argv[i]);
+    if (opt.paths.empty())
+        opt.paths.push_back("/");
+    if (opt.threads < 1 || opt.range < 1 || opt.connections < opt.threads || opt.pipeline < 1 || opt.duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.rate < 0 || opt.rate / opt.threads > 1000000) {
+        fprintf(stderr, "rate %.0f out of range: at most 1000000 requests/s per thread (-t)\n", opt.rate);
+        return 1;
+    }
+
+    memset(&g_addr, 0, sizeof(g_addr));
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(opt.port);
+    if (inet_pton(AF_INET, opt.host.c_str(), &g_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", opt.host.c_str());
+        return 1;
+    }
+
+    std::vector<worker> workers(opt.threads);
+    std::vector<pthread_t> tids(opt.threads);
+    long long begin = now_usec();
+    long long end = begin + (long long)(opt.duration * 1000000);
+    for (int i = 0; i < opt.threads; ++i) {
+        worker &w = workers[i];
+        w.opt = &opt;
+        w.id = i;
+        w.epfd = epoll_create1(0);
+        int count = opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0);
+        w.conns.resize(count);
+        for (int j = 0; j < count; ++j) {
+            w.conns[j].fd = -1;
+            w.conns[j].connected = false;
+            w.conns[j].retry_at = 0;
+            w.conns[j].path_index = (i + j) % opt.paths.size();
+        }
+        w.rate = opt.rate / opt.threads;
+        w.begin = begin;
+        w.end = end;
+        w.cursor = 0;
+        w.seq = 0;
+        w.seed = i + 1;
+        w.requests = w.non_2xx = w.errors = w.timeouts = w.bytes = 0;
+        pthread_create(&tids[i], NULL, run, &w);
+    }
+
+    histogram total;
+    long long requests = 0, non_2xx = 0, errors = 0, timeouts = 0, bytes = 0;
+    for (int i = 0; i < opt.threads; ++i) {
+        pthread_join(tids[i], NULL);
+        close(workers[i].epfd);
+        total.add(workers[i].hist);
+        requests += workers[i].requests;
+        non_2xx += workers[i].non_2xx;
+        errors += workers[i].errors;
+        timeouts += workers[i].timeouts;
+        bytes += workers[i].bytes;
+    }
+    double seconds = (now_usec() - begin) / 1e6;
+
+    printf("{\"scenario\":\"%s\",\"mode\":\"%s\",\"rate\":%.0f,\"connections\":%d,\"threads\":%d,\"keep_alive\":%s,"
+           "\"pipeline\":%d,\"duration\":%.2f,\"requests\":%lld,\"throughput\":%.1f,\"bytes_per_sec\":%.0f,"
+           "\"non_2xx\":%lld,\"errors\":%lld,\"timeouts\":%lld,"
+           "\"latency_us\":{\"avg\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+           opt.name.c_str(), opt.rate > 0 ? "open" : "closed", opt.rate, opt.connections, opt.threads,
+           opt.keep_alive ? "true" : "false", opt.pipeline, seconds, requests, requests / seconds, bytes / seconds,
+           non_2xx, errors, timeouts, (unsigned long long)(total.count ? total.sum / total.count : 0),
+           (unsigned long long)total.quantile(0.5), (unsigned long long)total.quantile(0.9),
+           (unsigned long long)total.quantile(0.99), (unsigned long long)total.quantile(0.999),
+           (unsigned long long)total.max());
+    return 0;
+}
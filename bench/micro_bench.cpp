@@ -0,0 +1,634 @@
+/*
+    核心数据结构的微基准, 不走网络
+    ./micro_bench [-t 线程数] [-m 毫秒] [-r 次数] [-f 名字] [-o 保存文件] [-b 基线文件] [-l]
+      -t  竞争测试的线程数, 默认 4
+      -m  每次测量至少运行的时间, 默认 200ms, 迭代次数自动放大到超过它
+      -r  重复测量的次数, 取 ns/op 的中位数, 默认 3
+      -f  只运行名字中包含该字符串的项目
+      -o  把结果保存为基线文件
+      -b  和基线文件比较, 多出一列 ns/op 的变化
+      -l  列出所有项目
+    每一项输出:
+      ns/op      单线程时为每次操作的耗时; 多线程时为每个线程平均每次操作的耗时(墙钟时间 / 每线程迭代数)
+      allocs/op  operator new 的次数 / 总操作数
+      cycles/op  用户态 CPU 周期 / 总操作数(perf_event_open), 不可用时为 -
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "locker.h"
+#include "block_queue.h"
+#include "log.h"
+#include "lst_timer.h"
+#include "http_conn.h"
+
+/*************************************************************
+ * 分配计数: 替换全局 operator new
+ * 各种形式都直接调用 malloc/posix_memalign, 不互相调用,
+ * 编译器能看出每个 delete 释放的是配对的 new 分配的内存
+ **************************************************************/
+static std::atomic<long long> g_allocs(0);
+
+static void *counted_alloc(size_t size, size_t align) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void *p = NULL;
+    if (align <= alignof(max_align_t))
+        p = malloc(size ? size : 1);
+    else if (posix_memalign(&p, align, size ? size : 1) != 0)
+        p = NULL;
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size) {
+    return counted_alloc(size, 0);
+}
+void *operator new[](size_t size) {
+    return counted_alloc(size, 0);
+}
+/* alignas(64) 的 log_ring、lf_queue 走这两个 */
+void *operator new(size_t size, std::align_val_t align) {
+    return counted_alloc(size, (size_t)align);
+}
+void *operator new[](size_t size, std::align_val_t align) {
+    return counted_alloc(size, (size_t)align);
+}
+void operator delete(void *p) noexcept {
+    free(p);
+}
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+void operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+void operator delete[](void *p, std::align_val_t) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+static long long now_nsec() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+/* 当前线程的用户态周期计数器, 失败返回 -1 */
+static int open_cycles() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*************************************************************
+ * 测试项目
+ *
+ *   setup 在计时之外准备共享状态, run 由每个线程调用,
+ *   执行 iters 次操作; id 从 0 开始
+ **************************************************************/
+enum {
+    SINGLE = 1,     // 只跑单线程
+    CONTENDED = 2,  // 单线程和 -t 个线程各跑一次
+    PAIR = 4,       // 两个线程配合完成一次操作, 只跑两个线程
+    EVEN = 8        // 多线程时线程数取偶数(一半生产一半消费)
+};
+
+struct bench_def {
+    const char *name;
+    int mode;
+    void *(*setup)(int threads, long iters);
+    void (*run)(void *state, int id, int threads, long iters);
+    void (*teardown)(void *state);
+};
+
+/* ---------- http_conn: parse_line / process_read ---------- */
+
+/* 典型的浏览器请求, 不带结尾的空行, process_read 解析完所有头部后返回 NO_REQUEST, 不进入 do_request */
+static const char http_request[] =
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+    "Accept: text/html,application/xhtml+xml\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n";
+
+struct http_bench {
+    /* 切出请求中所有的行 */
+    static int parse_lines(http_conn *c) {
+        memcpy(c->m_read_buf, http_request, sizeof(http_request) - 1);
+        c->m_read_idx = sizeof(http_request) - 1;
+        c->m_checked_idx = 0;
+        c->m_start_line = 0;
+        int lines = 0;
+        while (c->parse_line() == http_conn::LINE_OK)
+            ++lines;
+        return lines;
+    }
+    /* 和处理完一个请求后一样先 init(), 再解析请求行和头部 */
+    static int process_read(http_conn *c) {
+        c->init();
+        c->m_close_log = 1;
+        memcpy(c->m_read_buf, http_request, sizeof(http_request) - 1);
+        c->m_read_idx = sizeof(http_request) - 1;
+        return c->process_read();
+    }
+};
+
+static_assert(sizeof(http_request) <= http_conn::READ_BUFFER_SIZE, "request must fit the read buffer");
+
+static void *http_setup(int threads, long) {
+    http_conn *conns = new http_conn[threads];
+    for (int i = 0; i < threads; ++i)
+        http_bench::process_read(&conns[i]);
+    return conns;
+}
+
+static void http_teardown(void *state) {
+    delete[] (http_conn *)state;
+}
+
+static void http_parse_line(void *state, int id, int, long iters) {
+    http_conn *c = (http_conn *)state + id;
+    for (long i = 0; i < iters; ++i) {
+        if (http_bench::parse_lines(c) != 7)
+            abort();
+    }
+}
+
+static void http_process_read(void *state, int id, int, long iters) {
+    http_conn *c = (http_conn *)state + id;
+    for (long i = 0; i < iters; ++i) {
+        if (http_bench::process_read(c) != http_conn::NO_REQUEST)
+            abort();
+    }
+}
+
+/* ---------- timer_heap: 只在主线程使用, 只测单线程 ---------- */
+
+static const int TIMER_BATCH = 4096;
+static const int TIMER_POOL = 1 << 16;  // 定时器对象循环使用, 必须是2的幂且不小于 TIMER_BATCH
+
+struct timer_state {
+    std::vector<heap_timer> timers;
+    std::vector<client_data> users;
+    timer_heap *heap;
+};
+
+static void timer_noop(client_data *) {}
+
+static void *timer_setup(int, long) {
+    timer_state *s = new timer_state;
+    s->timers.resize(TIMER_POOL);
+    s->users.resize(TIMER_POOL);
+    unsigned int seed = 1;
+    for (int i = 0; i < TIMER_POOL; ++i) {
+        s->users[i].sockfd = -1;
+        s->timers[i].user_data = &s->users[i];
+        s->timers[i].cb_func = timer_noop;
+        s->timers[i].expire = rand_r(&seed) % 1000000;  // 都已经过期
+    }
+    s->heap = new timer_heap(TIMER_BATCH);
+    for (int i = 0; i < TIMER_BATCH; ++i)
+        s->heap->add_timer(&s->timers[i]);
+    return s;
+}
+
+static void timer_teardown(void *state) {
+    timer_state *s = (timer_state *)state;
+    delete s->heap;
+    delete s;
+}
+
+/* 每 TIMER_BATCH 个换一个新堆, 堆的大小在 0 到 TIMER_BATCH 之间 */
+static void timer_add(void *state, int, int, long iters) {
+    timer_state *s = (timer_state *)state;
+    timer_heap *heap = NULL;
+    for (long i = 0; i < iters; ++i) {
+        if (i % TIMER_BATCH == 0) {
+            delete heap;
+            heap = new timer_heap(TIMER_BATCH);
+        }
+        heap->add_timer(&s->timers[i & (TIMER_POOL - 1)]);
+    }
+    delete heap;
+}
+
+/* TIMER_BATCH 个定时器的堆中, 轮流延长其中一个 */
+static void timer_adjust(void *state, int, int, long iters) {
+    timer_state *s = (timer_state *)state;
+    unsigned int pos = 1;
+    for (long i = 0; i < iters; ++i) {
+        pos = pos * 1103515245 + 12345;
+        s->heap->adjust_timer(1 + (pos >> 8) % TIMER_BATCH);
+    }
+}
+
+/* 一次操作为加入一个已过期的定时器, 再由 tick 取出 */
+static void timer_add_tick(void *state, int, int, long iters) {
+    timer_state *s = (timer_state *)state;
+    timer_heap heap(TIMER_BATCH);
+    for (long i = 0; i < iters; i += TIMER_BATCH) {
+        long n = std::min((long)TIMER_BATCH, iters - i);
+        for (long j = 0; j < n; ++j)
+            heap.add_timer(&s->timers[(i + j) & (TIMER_POOL - 1)]);
+        heap.tick();
+    }
+}
+
+/* ---------- block_queue ---------- */
+
+static void *queue_setup(int, long) {
+    return new block_queue<long>(10000);
+}
+
+static void queue_teardown(void *state) {
+    delete (block_queue<long> *)state;
+}
+
+/* 单线程时一次操作为 push + pop; 多线程时偶数号线程生产, 奇数号消费, 一次操作为传递一个元素 */
+static void queue_push_pop(void *state, int id, int threads, long iters) {
+    block_queue<long> *q = (block_queue<long> *)state;
+    long v;
+    if (threads == 1) {
+        for (long i = 0; i < iters; ++i) {
+            q->push(i);
+            q->pop(v);
+        }
+    } else if (id % 2 == 0) {
+        for (long i = 0; i < iters; ++i) {
+            while (!q->push(i))
+                sched_yield();
+        }
+    } else {
+        for (long i = 0; i < iters; ++i)
+            q->pop(v);
+    }
+}
+
+/* ---------- Log::write_log(异步模式) ---------- */
+
+/* 日志目录, 当天的日志文件是指向 /dev/null 的链接, 测的是写日志线程的开销和后台线程的格式化 */
+static char g_log_dir[64];
+
+static bool log_init() {
+    strcpy(g_log_dir, "/tmp/micro_bench.XXXXXX");
+    if (!mkdtemp(g_log_dir))
+        return false;
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    char link[128];
+    snprintf(link, sizeof(link), "%s/%d_%02d_%02d_bench.log", g_log_dir, my_tm.tm_year + 1900, my_tm.tm_mon + 1,
+             my_tm.tm_mday);
+    if (symlink("/dev/null", link) != 0)
+        return false;
+    std::string file = std::string(g_log_dir) + "/bench.log";
+    return Log::get_instance()->init(file.c_str(), 0, 8192, INT_MAX, 1);
+}
+
+/* 后台线程还开着这些文件, 先删掉名字 */
+static void log_cleanup() {
+    if (!g_log_dir[0])
+        return;
+    DIR *dir = opendir(g_log_dir);
+    if (!dir)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] != '.')
+            unlink((std::string(g_log_dir) + "/" + ent->d_name).c_str());
+    }
+    closedir(dir);
+    rmdir(g_log_dir);
+}
+
+static void *log_setup(int, long) {
+    static bool ok = log_init();
+    if (!ok) {
+        fprintf(stderr, "log init failed\n");
+        exit(1);
+    }
+    return NULL;
+}
+
+static void log_write(void *, int id, int, long iters) {
+    Log *log = Log::get_instance();
+    for (long i = 0; i < iters; ++i)
+        log->write_log(1, "[%d] request %ld %s done in %d us", id, i, "/judge.html", 42);
+}
+
+/* ---------- locker / cond ---------- */
+
+struct lock_state {
+    locker mutex;
+    cond cv;
+    long counter;
+    int turn;
+};
+
+static void *lock_setup(int, long) {
+    lock_state *s = new lock_state;
+    s->counter = 0;
+    s->turn = 0;
+    return s;
+}
+
+static void lock_teardown(void *state) {
+    delete (lock_state *)state;
+}
+
+static void locker_lock_unlock(void *state, int, int, long iters) {
+    lock_state *s = (lock_state *)state;
+    for (long i = 0; i < iters; ++i) {
+        s->mutex.lock();
+        ++s->counter;
+        s->mutex.unlock();
+    }
+}
+
+/* 没有等待者时 signal 的开销 */
+static void cond_signal(void *state, int, int, long iters) {
+    lock_state *s = (lock_state *)state;
+    for (long i = 0; i < iters; ++i)
+        s->cv.signal();
+}
+
+/* 两个线程轮流: 等到轮到自己, 交给对方并唤醒它; 一次操作为一次交接 */
+static void cond_ping_pong(void *state, int id, int, long iters) {
+    lock_state *s = (lock_state *)state;
+    for (long i = 0; i < iters; ++i) {
+        s->mutex.lock();
+        while (s->turn != id)
+            s->cv.wait(s->mutex.get());
+        s->turn = 1 - id;
+        s->cv.signal();
+        s->mutex.unlock();
+    }
+}
+
+static const bench_def benches[] = {
+    {"http_parse_line",     CONTENDED,       http_setup,  http_parse_line,    http_teardown},   // 一次操作: 切出请求的 7 行
+    {"http_process_read",   CONTENDED,       http_setup,  http_process_read,  http_teardown},   // 一次操作: init + 解析请求行和头部
+    {"timer_add",           SINGLE,          timer_setup, timer_add,          timer_teardown},
+    {"timer_adjust",        SINGLE,          timer_setup, timer_adjust,       timer_teardown},
+    {"timer_add_tick",      SINGLE,          timer_setup, timer_add_tick,     timer_teardown},
+    {"block_queue",         CONTENDED | EVEN, queue_setup, queue_push_pop,    queue_teardown},
+    {"log_write",           CONTENDED,       log_setup,   log_write,          NULL},
+    {"locker_lock_unlock",  CONTENDED,       lock_setup,  locker_lock_unlock, lock_teardown},
+    {"cond_signal",         SINGLE,          lock_setup,  cond_signal,        lock_teardown},
+    {"cond_ping_pong",      PAIR,            lock_setup,  cond_ping_pong,     lock_teardown},
+};
+
+/*************************************************************
+ * 测量
+ **************************************************************/
+struct result {
+    std::string name;
+    int threads;
+    double ns;       // 每线程每次操作
+    double allocs;   // 每次操作
+    double cycles;   // 每次操作, 不可用时为 -1
+    long long elapsed;
+};
+
+struct thread_arg {
+    const bench_def *b;
+    void *state;
+    int id;
+    int threads;
+    long iters;
+    pthread_barrier_t *barrier;
+    long long start;
+    long long end;
+    long long cycles;
+};
+
+static void *bench_thread(void *p) {
+    thread_arg *a = (thread_arg *)p;
+    int fd = open_cycles();
+    pthread_barrier_wait(a->barrier);
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    a->start = now_nsec();
+    a->b->run(a->state, a->id, a->threads, a->iters);
+    a->end = now_nsec();
+    a->cycles = -1;
+    if (fd >= 0) {
+        long long count;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) == sizeof(count))
+            a->cycles = count;
+        close(fd);
+    }
+    return NULL;
+}
+
+static result run_once(const bench_def &b, int threads, long iters) {
+    void *state = b.setup ? b.setup(threads, iters) : NULL;
+    std::vector<thread_arg> args(threads);
+    std::vector<pthread_t> tids(threads);
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, threads);
+
+    long long allocs = g_allocs.load(std::memory_order_relaxed);
+    for (int i = 0; i < threads; ++i) {
+        args[i].b = &b;
+        args[i].state = state;
+        args[i].id = i;
+        args[i].threads = threads;
+        args[i].iters = iters;
+        args[i].barrier = &barrier;
+        pthread_create(&tids[i], NULL, bench_thread, &args[i]);
+    }
+    long long start = LLONG_MAX, end = 0, cycles = 0;
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+        start = std::min(start, args[i].start);
+        end = std::max(end, args[i].end);
+        if (cycles >= 0)
+            cycles = args[i].cycles < 0 ? -1 : cycles + args[i].cycles;
+    }
+    allocs = g_allocs.load(std::memory_order_relaxed) - allocs;
+    pthread_barrier_destroy(&barrier);
+    if (b.teardown)
+        b.teardown(state);
+
+    double ops = (double)iters * threads;
+    result r;
+    r.name = b.name;
+    r.threads = threads;
+    r.elapsed = end - start;
+    r.ns = (double)r.elapsed / iters;
+    r.allocs = allocs / ops;
+    r.cycles = cycles < 0 ? -1 : cycles / ops;
+    return r;
+}
+
+/* 放大迭代次数直到一次测量超过 min_ns, 再重复 reps 次取中位数 */
+static result measure(const bench_def &b, int threads, long long min_ns, int reps) {
+    long iters = 16;
+    result r = run_once(b, threads, iters);
+    while (r.elapsed < min_ns) {
+        double scale = r.elapsed > 0 ? min_ns * 1.2 / r.elapsed : 100;
+        iters = (long)(iters * std::min(100.0, std::max(2.0, scale)));
+        r = run_once(b, threads, iters);
+    }
+    std::vector<result> runs(1, r);
+    for (int i = 1; i < reps; ++i)
+        runs.push_back(run_once(b, threads, iters));
+    std::sort(runs.begin(), runs.end(), [](const result &a, const result &b) { return a.ns < b.ns; });
+    return runs[runs.size() / 2];
+}
+
+/* 基线文件: 每行 名字 线程数 ns/op allocs/op cycles/op, # 开头为注释 */
+static bool load_baseline(const char *file, std::vector<result> &out) {
+    FILE *fp = fopen(file, "r");
+    if (!fp)
+        return false;
+    char line[256], name[128];
+    while (fgets(line, sizeof(line), fp)) {
+        result r;
+        if (line[0] == '#' || sscanf(line, "%127s %d %lf %lf %lf", name, &r.threads, &r.ns, &r.allocs, &r.cycles) != 5)
+            continue;
+        r.name = name;
+        out.push_back(r);
+    }
+    fclose(fp);
+    return true;
+}
+
+static bool save_baseline(const char *file, const std::vector<result> &results) {
+    FILE *fp = fopen(file, "w");
+    if (!fp)
+        return false;
+    fprintf(fp, "# micro_bench baseline: name threads ns/op allocs/op cycles/op\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const result &r = results[i];
+        fprintf(fp, "%s %d %.2f %.4f %.1f\n", r.name.c_str(), r.threads, r.ns, r.allocs, r.cycles);
+    }
+    fclose(fp);
+    return true;
+}
+
+static const result *find(const std::vector<result> &results, const result &r) {
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].name == r.name && results[i].threads == r.threads)
+            return &results[i];
+    }
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t threads] [-m min_ms] [-r reps] [-f filter] [-o save_file] [-b baseline_file] [-l]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = 4, reps = 3;
+    long long min_ns = 200 * 1000000LL;
+    const char *filter = NULL, *save_file = NULL, *base_file = NULL;
+    int ch;
+    while ((ch = getopt(argc, argv, "t:m:r:f:o:b:l")) != -1) {
+        switch (ch) {
+            case 't': threads = atoi(optarg); break;
+            case 'm': min_ns = atoll(optarg) * 1000000LL; break;
+            case 'r': reps = atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'o': save_file = optarg; break;
+            case 'b': base_file = optarg; break;
+            case 'l':
+                for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i)
+                    printf("%s\n", benches[i].name);
+                return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (threads < 2 || reps < 1 || min_ns <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<result> baseline;
+    if (base_file && !load_baseline(base_file, baseline)) {
+        fprintf(stderr, "cannot read baseline %s\n", base_file);
+        return 1;
+    }
+
+    printf("%-20s %7s %10s %10s %10s%s\n", "name", "threads", "ns/op", "allocs/op", "cycles/op",
+           base_file ? "   vs base" : "");
+    std::vector<result> results;
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        const bench_def &b = benches[i];
+        if (filter && !strstr(b.name, filter))
+            continue;
+        std::vector<int> counts;
+        if (b.mode & PAIR) {
+            counts.push_back(2);
+        } else {
+            counts.push_back(1);
+            if (b.mode & CONTENDED)
+                counts.push_back((b.mode & EVEN) ? threads / 2 * 2 : threads);
+        }
+        for (size_t j = 0; j < counts.size(); ++j) {
+            result r = measure(b, counts[j], min_ns, reps);
+            results.push_back(r);
+            char cycles[32] = "-";
+            if (r.cycles >= 0)
+                snprintf(cycles, sizeof(cycles), "%.1f", r.cycles);
+            printf("%-20s %7d %10.1f %10.3f %10s", r.name.c_str(), r.threads, r.ns, r.allocs, cycles);
+            const result *base = find(baseline, r);
+            if (base)
+                printf("   %+6.1f%%", (r.ns - base->ns) / base->ns * 100);
+            else if (base_file)
+                printf("   %7s", "new");
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    long long dropped = Log::get_instance()->dropped();
+    if (dropped > 0)
+        printf("log_write: %lld records dropped because a ring was full\n", dropped);
+    log_cleanup();
+
+    if (save_file && !save_baseline(save_file, results)) {
+        fprintf(stderr, "cannot write %s\n", save_file);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+    请求队列压测
+    ./queue_bench [生产者数] [消费者数] [每个生产者的元素数] [容量]
+    默认 4 生产者, 4 消费者, 每个 2000000 个元素, 容量 10000(和线程池的请求队列相同);
+    同样的负载分别跑 block_queue 和 mpmc_queue, 消费者为1时再跑 mpsc_queue,
+    输出每秒传递的元素数; 队列满时生产者让出 CPU 后重试
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <vector>
+#include "block_queue.h"
+#include "lf_queue.h"
+
+struct workload {
+    int producers;
+    int consumers;
+    long items;
+    int capacity;
+};
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* 两种队列的入队/出队接口不同, 统一成 put / take / finish */
+struct block_adapter {
+    block_queue<long> q;
+    int consumers;
+    block_adapter(int capacity, int consumers) : q(capacity), consumers(consumers) {}
+    bool put(long v) { return q.push(v); }
+    bool take(long &v) { return q.pop(v) && v >= 0; }
+    /* block_queue 不能关闭, 每个消费者一个结束标记 */
+    void finish() {
+        for (int i = 0; i < consumers; ++i)
+            while (!q.push(-1))
+                sched_yield();
+    }
+};
+
+template <bool MultiConsumer>
+struct lf_adapter {
+    lf_queue<long, MultiConsumer> q;
+    lf_adapter(int capacity, int) : q(capacity) {}
+    bool put(long v) { return q.try_push(std::move(v)); }
+    bool take(long &v) { return q.pop(v); }
+    void finish() { q.close(); }
+};
+
+template <typename Queue>
+struct bench_arg {
+    Queue *queue;
+    const workload *w;
+    int id;
+    long sum;
+    long count;
+};
+
+template <typename Queue>
+static void *producer(void *p) {
+    bench_arg<Queue> *arg = (bench_arg<Queue> *)p;
+    long base = (long)arg->id * arg->w->items;
+    for (long i = 0; i < arg->w->items; ++i) {
+        while (!arg->queue->put(base + i))
+            sched_yield();
+    }
+    return NULL;
+}
+
+template <typename Queue>
+static void *consumer(void *p) {
+    bench_arg<Queue> *arg = (bench_arg<Queue> *)p;
+    long v, sum = 0, count = 0;
+    while (arg->queue->take(v)) {
+        sum += v;
+        ++count;
+    }
+    arg->sum = sum;
+    arg->count = count;
+    return NULL;
+}
+
+template <typename Queue>
+static void run(const char *label, const workload &w) {
+    Queue queue(w.capacity, w.consumers);
+    std::vector<pthread_t> ptids(w.producers), ctids(w.consumers);
+    std::vector<bench_arg<Queue> > pargs(w.producers), cargs(w.consumers);
+
+    double start = now();
+    for (int i = 0; i < w.consumers; ++i) {
+        cargs[i].queue = &queue;
+        cargs[i].w = &w;
+        cargs[i].id = i;
+        pthread_create(&ctids[i], NULL, consumer<Queue>, &cargs[i]);
+    }
+    for (int i = 0; i < w.producers; ++i) {
+        pargs[i].queue = &queue;
+        pargs[i].w = &w;
+        pargs[i].id = i;
+        pthread_create(&ptids[i], NULL, producer<Queue>, &pargs[i]);
+    }
+    for (int i = 0; i < w.producers; ++i)
+        pthread_join(ptids[i], NULL);
+    queue.finish();
+
+    long sum = 0, count = 0;
+    for (int i = 0; i < w.consumers; ++i) {
+        pthread_join(ctids[i], NULL);
+        sum += cargs[i].sum;
+        count += cargs[i].count;
+    }
+    double end = now();
+
+    long total = (long)w.producers * w.items;
+    bool ok = count == total && sum == total * (total - 1) / 2;
+    printf("%-12s %.2fs  %.2f Mitems/s  %s\n", label, end - start, total / (end - start) / 1e6, ok ? "ok" : "LOST ITEMS");
+}
+
+int main(int argc, char *argv[]) {
+    workload w;
+    w.producers = argc > 1 ? atoi(argv[1]) : 4;
+    w.consumers = argc > 2 ? atoi(argv[2]) : 4;
+    w.items = argc > 3 ? atol(argv[3]) : 2000000;
+    w.capacity = argc > 4 ? atoi(argv[4]) : 10000;
+
+    printf("producers %d, consumers %d, items/producer %ld, capacity %d\n", w.producers, w.consumers, w.items,
+           w.capacity);
+
+    run<block_adapter>("block_queue", w);
+    run<lf_adapter<true> >("mpmc_queue", w);
+    if (w.consumers == 1)
+        run<lf_adapter<false> >("mpsc_queue", w);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/bash
+# 标准压测场景: 在本地启动 server, 用 loadgen 逐个跑完, 每个场景输出一行 JSON
+# 在仓库根目录运行(server 从当前目录的 root/ 取文件), 一般通过 make bench
+# 环境变量: PORT 端口, DURATION 每个场景的秒数, CONNS 连接数, THREADS 压测线程数,
+#          RATE 开环场景的每秒请求数, SERVER_ARGS 传给 server 的其他参数
+# 服务器收到流水线请求时只处理第一个, 默认场景不开流水线, 需要时直接运行 ./loadgen -P
+
+PORT=${PORT:-9106}
+DURATION=${DURATION:-10}
+CONNS=${CONNS:-100}
+THREADS=${THREADS:-4}
+RATE=${RATE:-5000}
+
+DB=$(mktemp /tmp/bench_users.XXXXXX)
+# 文件用户存储, 不需要 MySQL; 关闭服务器日志和访问日志
+./server -p $PORT -B 1 -F $DB -c 1 -A 0 $SERVER_ARGS >/dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -f $DB' EXIT
+
+for i in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+    sleep 0.1
+done
+
+run() {
+    ./loadgen -p $PORT -d $DURATION -t $THREADS "$@"
+}
+
+run -n page_keepalive    -c $CONNS -k 1 /judge.html
+run -n page_close        -c $CONNS -k 0 /judge.html
+run -n mixed_keepalive   -c $CONNS -k 1 / /5 /6 /7 /judge.html
+run -n image_small       -c $CONNS -k 1 /test1.jpg
+run -n image_large       -c $CONNS -k 1 /frame.jpg
+run -n page_open_loop    -c $CONNS -k 1 -r $RATE /judge.html
+run -n mixed_open_loop   -c $CONNS -k 1 -r $RATE / /5 /test1.jpg
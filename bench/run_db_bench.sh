@@ -0,0 +1,43 @@
+#!/bin/bash
+# 登录/注册压测: 服务器使用模拟数据库(-B 2), 对每组 连接池大小(-s) x 线程数(-t) 重启一次 server,
+# 同时跑登录和注册两个 loadgen, 每个输出一行 JSON, 场景名中带 s 和 t
+# 在仓库根目录运行, 一般通过 make bench_db
+# 环境变量:
+#   DB          模拟数据库参数 延迟微秒[,抖动微秒[,预置用户数]], 默认 2000,500,100000
+#   POOL_SIZES  要测的 -s, 默认 "4 8 16"
+#   THREADS     要测的 -t, 默认 "4 8 16"
+#   LOGIN_CONNS REGISTER_CONNS  登录和注册的连接数, 默认 90 和 10
+#   PORT DURATION
+# 用户缓存只留最小值(-U 0), 大部分登录都会查询数据库
+
+PORT=${PORT:-9107}
+DURATION=${DURATION:-10}
+DB=${DB:-2000,500,100000}
+POOL_SIZES=${POOL_SIZES:-4 8 16}
+THREADS=${THREADS:-4 8 16}
+LOGIN_CONNS=${LOGIN_CONNS:-90}
+REGISTER_CONNS=${REGISTER_CONNS:-10}
+
+USERS=$(echo $DB | cut -s -d, -f3)
+USERS=${USERS:-10000}
+
+for s in $POOL_SIZES; do
+    for t in $THREADS; do
+        ./server -p $PORT -B 2 -D $DB -s $s -t $t -U 0 -c 1 -A 0 >/dev/null 2>&1 &
+        SERVER=$!
+        for i in $(seq 50); do
+            (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+            sleep 0.1
+        done
+
+        ./loadgen -p $PORT -d $DURATION -t 2 -c $LOGIN_CONNS -n login_s${s}_t${t} -R $USERS \
+            -b 'user=user{r}&passwd=mock' /2CGISQL.cgi &
+        LOGIN=$!
+        ./loadgen -p $PORT -d $DURATION -t 1 -c $REGISTER_CONNS -n register_s${s}_t${t} \
+            -b 'user=bench{n}&passwd=mock' /3CGISQL.cgi
+        wait $LOGIN
+
+        kill $SERVER
+        wait $SERVER 2>/dev/null
+    done
+done
@@ -0,0 +1,34 @@
+#!/bin/bash
+# 大量空闲连接的规模测试: 在本地启动 server, 用 conn_scale 建立 CONNS 个连接并空闲 DURATION 秒,
+# 输出一行 JSON(每个连接的常驻内存、accept 速率、定时器 tick 耗时等)
+# 在仓库根目录运行, 一般通过 make scale_test
+# 默认用 make server_scale 编译的 server, 它的 MAX_FD 为 SCALE_MAX_FD(默认 262144), 默认的 server 只有 65536
+# 环境变量:
+#   CONNS             连接数, 默认 100000
+#   SOURCES           源地址个数, 默认 8
+#   DURATION          空闲阶段秒数, 默认 30
+#   MAX_RSS_PER_CONN  每个连接的常驻内存上限(字节), 超过时返回非0, 默认 4096
+#   SERVER_BIN        server 的路径, 默认 ./server_scale
+#   PORT SERVER_ARGS
+
+PORT=${PORT:-9108}
+SERVER_BIN=${SERVER_BIN:-./server_scale}
+CONNS=${CONNS:-100000}
+SOURCES=${SOURCES:-8}
+DURATION=${DURATION:-30}
+MAX_RSS_PER_CONN=${MAX_RSS_PER_CONN:-4096}
+
+# 两端的连接都在本机, 需要两倍的文件描述符
+ulimit -n $((CONNS + 4096)) 2>/dev/null || echo "warning: cannot raise open file limit to $((CONNS + 4096))" >&2
+
+DB=$(mktemp /tmp/scale_users.XXXXXX)
+$SERVER_BIN -p $PORT -B 1 -F $DB -c 1 -A 0 $SERVER_ARGS >/dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -f $DB' EXIT
+
+for i in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+    sleep 0.1
+done
+
+./conn_scale -p $PORT -c $CONNS -s $SOURCES -d $DURATION -M $MAX_RSS_PER_CONN
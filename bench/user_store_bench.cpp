@@ -0,0 +1,157 @@
+/*
+    用户表并发读写压测
+    ./user_store_bench [用户数] [线程数] [每线程操作数] [读比例%] [缓存MB]
+    默认 2000000 用户, 8 线程, 每线程 2000000 次, 99% 读, 缓存放得下全部用户;
+    同样的负载分别跑 user_store 和 读写锁保护的 std::map, 输出每秒操作数和命中率
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "user_store.h"
+
+struct workload {
+    int users;
+    int threads;
+    int ops;
+    int read_pct;
+    size_t cache_mb;
+};
+
+/* 对照组: 原来的 std::map, 加上读写锁才是正确的版本 */
+class map_store {
+public:
+    map_store() { pthread_rwlock_init(&m_lock, NULL); }
+    ~map_store() { pthread_rwlock_destroy(&m_lock); }
+
+    bool check(const std::string &name, const std::string &password) {
+        pthread_rwlock_rdlock(&m_lock);
+        std::map<std::string, std::string>::iterator it = m_users.find(name);
+        bool ok = it != m_users.end() && it->second == password;
+        pthread_rwlock_unlock(&m_lock);
+        return ok;
+    }
+    bool put(const std::string &name, const std::string &password) {
+        pthread_rwlock_wrlock(&m_lock);
+        bool ok = m_users.insert(std::make_pair(name, password)).second;
+        pthread_rwlock_unlock(&m_lock);
+        return ok;
+    }
+
+private:
+    pthread_rwlock_t m_lock;
+    std::map<std::string, std::string> m_users;
+};
+
+static std::string user_name(long i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user%08ld", i);
+    return buf;
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+template <typename Store>
+struct worker_arg {
+    Store *store;
+    const workload *w;
+    int id;
+    long hits;
+    long reads;
+};
+
+/* 登录请求带的是 char 数组, 两种实现都从这里开始查 */
+static bool do_check(user_store *s, const char *name, const char *password) {
+    std::string stored;
+    return s->lookup(name, &stored) == user_store::FOUND && stored == password;
+}
+static bool do_check(map_store *s, const char *name, const char *password) {
+    return s->check(name, password);
+}
+
+template <typename Store>
+static void *worker(void *p) {
+    worker_arg<Store> *arg = (worker_arg<Store> *)p;
+    const workload *w = arg->w;
+    unsigned int seed = arg->id * 7919 + 1;
+    long next_user = w->users + (long)arg->id * w->ops;
+    char name[32];
+    long hits = 0, reads = 0;
+
+    for (int i = 0; i < w->ops; ++i) {
+        if ((int)(rand_r(&seed) % 100) < w->read_pct) {
+            ++reads;
+            long u = ((long)rand_r(&seed) << 16 ^ rand_r(&seed)) % w->users;
+            snprintf(name, sizeof(name), "user%08ld", u);
+            hits += do_check(arg->store, name, "passwd");
+        } else {
+            snprintf(name, sizeof(name), "user%08ld", next_user++);
+            arg->store->put(name, "passwd");
+        }
+    }
+    arg->hits = hits;
+    arg->reads = reads;
+    return NULL;
+}
+
+template <typename Store>
+static void run(const char *label, Store *store, const workload &w) {
+    double start = now();
+    for (long i = 0; i < w.users; ++i)
+        store->put(user_name(i), "passwd");
+    double loaded = now();
+
+    std::vector<pthread_t> tids(w.threads);
+    std::vector<worker_arg<Store> > args(w.threads);
+    for (int i = 0; i < w.threads; ++i) {
+        args[i].store = store;
+        args[i].w = &w;
+        args[i].id = i;
+        args[i].hits = 0;
+        args[i].reads = 0;
+        pthread_create(&tids[i], NULL, worker<Store>, &args[i]);
+    }
+    long hits = 0;
+    for (int i = 0; i < w.threads; ++i) {
+        pthread_join(tids[i], NULL);
+        hits += args[i].hits;
+    }
+    double end = now();
+
+    double total = (double)w.threads * w.ops;
+    long reads = 0;
+    for (int i = 0; i < w.threads; ++i)
+        reads += args[i].reads;
+    printf("%-12s load %.2fs  run %.2fs  %.2f Mops/s  hit %.1f%%\n", label, loaded - start, end - loaded,
+           total / (end - loaded) / 1e6, reads ? 100.0 * hits / reads : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+    workload w;
+    w.users = argc > 1 ? atoi(argv[1]) : 2000000;
+    w.threads = argc > 2 ? atoi(argv[2]) : 8;
+    w.ops = argc > 3 ? atoi(argv[3]) : 2000000;
+    w.read_pct = argc > 4 ? atoi(argv[4]) : 99;
+    // 每个用户约 264 字节, 默认留两倍余量
+    w.cache_mb = argc > 5 ? atoi(argv[5]) : (size_t)w.users * 264 * 2 / (1 << 20) + 1;
+
+    printf("users %d, threads %d, ops/thread %d, read %d%%, cache %zuMB\n", w.users, w.threads, w.ops, w.read_pct,
+           w.cache_mb);
+
+    user_store *store = new user_store;
+    store->init(w.cache_mb << 20);
+    run("user_store", store, w);
+    delete store;
+
+    map_store *map = new map_store;
+    run("map+rwlock", map, w);
+    delete map;
+    return 0;
+}
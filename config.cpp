@@ -4,7 +4,7 @@ Config::Config(){
     //端口号,默认9006
     PORT = 9006;
 
-    //日志写入方式，默认同步
+    //日志写入方式，默认同步; 0 同步, 1 异步, 2 异步写二进制日志(用 log_decode 查看)
     LOGWrite = 0;
 
     //触发组合模式,默认listenfd LT + connfd LT
@@ -30,11 +30,45 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //TLS,默认不启用
+    tls = 0;
+
+    //TLS证书和私钥,默认在当前目录
+    tls_cert = "./server.crt";
+    tls_key = "./server.key";
+
+    //用户缓存大小(MB),默认64
+    user_cache = 64;
+
+    //用户缓存预热文件,默认不预热
+    user_hot_file = "";
+
+    //用户存储,默认MySQL
+    storage = 0;
+
+    //本地文件存储的数据文件
+    storage_file = "./user.db";
+
+    //运行时日志级别,默认info; 收到 SIGUSR2 在 debug 和该级别之间切换
+    log_level = 1;
+
+    //切分下来的日志文件在后台压缩成 .gz,默认压缩
+    log_compress = 1;
+
+    //访问日志,默认记录每个请求; 负载高时可以调大只记录一部分
+    access_sample = 1;
+
+    //模拟数据库(-B 2): 查询延迟1ms,无抖动,预置10000个用户
+    mock_db = "1000,0,10000";
+
+    //逐请求追踪,默认关闭; 开启后 SIGUSR1 导出 Chrome trace-event JSON
+    trace_file = "";
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:S:C:K:U:H:B:F:V:Z:A:D:X:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -79,6 +113,66 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'S':
+        {
+            tls = atoi(optarg);
+            break;
+        }
+        case 'C':
+        {
+            tls_cert = optarg;
+            break;
+        }
+        case 'K':
+        {
+            tls_key = optarg;
+            break;
+        }
+        case 'U':
+        {
+            user_cache = atoi(optarg);
+            break;
+        }
+        case 'H':
+        {
+            user_hot_file = optarg;
+            break;
+        }
+        case 'B':
+        {
+            storage = atoi(optarg);
+            break;
+        }
+        case 'F':
+        {
+            storage_file = optarg;
+            break;
+        }
+        case 'V':
+        {
+            log_level = atoi(optarg);
+            break;
+        }
+        case 'Z':
+        {
+            log_compress = atoi(optarg);
+            break;
+        }
+        case 'A':
+        {
+            access_sample = atoi(optarg);
+            break;
+        }
+        case 'D':
+        {
+            mock_db = optarg;
+            break;
+        }
+        case 'X':
+        {
+            trace_file = optarg;
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,40 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //是否启用TLS
+    int tls;
+
+    //TLS证书和私钥文件
+    string tls_cert;
+    string tls_key;
+
+    //用户缓存大小(MB)
+    int user_cache;
+
+    //用户缓存预热文件, 退出时写入, 启动时读取
+    string user_hot_file;
+
+    //用户存储: 0 MySQL, 1 本地文件, 2 模拟数据库(压测用)
+    int storage;
+
+    //本地文件存储的数据文件
+    string storage_file;
+
+    //运行时日志级别: 0 debug 1 info 2 warn 3 error
+    int log_level;
+
+    //是否压缩切分下来的日志文件
+    int log_compress;
+
+    //访问日志采样: 每 N 个请求记录一个, 0 关闭
+    int access_sample;
+
+    //模拟数据库: 查询延迟微秒[,抖动微秒[,预置用户数]]
+    string mock_db;
+
+    //逐请求追踪导出文件的前缀, 空表示不开启
+    string trace_file;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "body_reader.h"
+
+request_body::request_body() : m_fd(-1), m_size(0) {
+}
+
+request_body::~request_body() {
+    clear();
+}
+
+void request_body::clear() {
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    /* 超过阈值的容量不保留, 避免空闲连接常驻大块内存 */
+    if (m_mem.capacity() > (size_t)SPILL_THRESHOLD)
+        std::string().swap(m_mem);
+    else
+        m_mem.clear();
+    m_size = 0;
+}
+
+/* 创建匿名临时文件, 并把内存中已有的内容写进去 */
+bool request_body::spill() {
+#ifdef O_TMPFILE
+    m_fd = open(P_tmpdir, O_TMPFILE | O_RDWR, 0600);
+#endif
+    if (m_fd < 0) {
+        char path[] = P_tmpdir "/tinyweb_body_XXXXXX";
+        m_fd = mkstemp(path);
+        if (m_fd < 0)
+            return false;
+        unlink(path);
+    }
+
+    const char *p = m_mem.data();
+    size_t left = m_mem.size();
+    while (left > 0) {
+        ssize_t n = ::write(m_fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    std::string().swap(m_mem);
+    return true;
+}
+
+bool request_body::append(const char *data, int len) {
+    if (len <= 0)
+        return true;
+
+    if (m_fd < 0 && m_size + len > SPILL_THRESHOLD && !spill())
+        return false;
+
+    if (m_fd < 0) {
+        m_mem.append(data, len);
+    }
+    else {
+        while (len > 0) {
+            ssize_t n = ::write(m_fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= n;
+            m_size += n;
+        }
+        return true;
+    }
+    m_size += len;
+    return true;
+}
+
+body_reader::body_reader() : m_body(NULL), m_chunked(false), m_remain(0),
+                             m_chunk_state(CHUNK_SIZE), m_size_digits(0), m_status(BODY_DONE) {
+}
+
+void body_reader::init_length(long length, request_body *body) {
+    m_body = body;
+    m_chunked = false;
+    m_remain = length;
+    m_status = (length < 0 || length > MAX_BODY_SIZE) ? BODY_BAD : BODY_OPEN;
+    if (length == 0)
+        m_status = BODY_DONE;
+}
+
+void body_reader::init_chunked(request_body *body) {
+    m_body = body;
+    m_chunked = true;
+    m_remain = 0;
+    m_chunk_state = CHUNK_SIZE;
+    m_size_digits = 0;
+    m_status = BODY_OPEN;
+}
+
+body_reader::STATUS body_reader::feed(const char *data, int len, int *consumed) {
+    *consumed = 0;
+    if (m_status != BODY_OPEN)
+        return m_status;
+
+    if (m_chunked)
+        return m_status = feed_chunked(data, len, consumed);
+
+    int n = len < m_remain ? len : (int)m_remain;
+    if (!m_body->append(data, n))
+        return m_status = BODY_BAD;
+    m_remain -= n;
+    *consumed = n;
+    return m_status = (m_remain == 0 ? BODY_DONE : BODY_OPEN);
+}
+
+/*
+    chunked 编码:
+        块长度(十六进制)[;扩展]\r\n 块数据\r\n ... 0\r\n [trailer\r\n]* \r\n
+ */
+body_reader::STATUS body_reader::feed_chunked(const char *data, int len, int *consumed) {
+    int i = 0;
+    while (i < len) {
+        char c = data[i];
+        switch (m_chunk_state) {
+            case CHUNK_SIZE: {
+                int v;
+                if (c >= '0' && c <= '9') v = c - '0';
+                else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+                else if (m_size_digits > 0 && (c == ';' || c == ' ' || c == '\t')) {
+                    m_chunk_state = CHUNK_EXT;
+                    break;
+                }
+                else if (m_size_digits > 0 && c == '\r') {
+                    m_chunk_state = CHUNK_SIZE_LF;
+                    break;
+                }
+                else
+                    return BODY_BAD;
+                m_remain = m_remain * 16 + v;
+                /* 单块和整体都不能超过上限, 同时防止溢出 */
+                if (++m_size_digits > 8 || m_body->size() + m_remain > MAX_BODY_SIZE)
+                    return BODY_BAD;
+                break;
+            }
+            case CHUNK_EXT:
+                if (c == '\r')
+                    m_chunk_state = CHUNK_SIZE_LF;
+                break;
+            case CHUNK_SIZE_LF:
+                if (c != '\n')
+                    return BODY_BAD;
+                m_chunk_state = (m_remain == 0) ? CHUNK_TRAILER : CHUNK_DATA;
+                break;
+            case CHUNK_DATA: {
+                /* 块数据整段交给 request_body */
+                int n = (len - i) < m_remain ? (len - i) : (int)m_remain;
+                if (!m_body->append(data + i, n))
+                    return BODY_BAD;
+                m_remain -= n;
+                i += n;
+                if (m_remain == 0)
+                    m_chunk_state = CHUNK_DATA_CR;
+                continue;
+            }
+            case CHUNK_DATA_CR:
+                if (c != '\r')
+                    return BODY_BAD;
+                m_chunk_state = CHUNK_DATA_LF;
+                break;
+            case CHUNK_DATA_LF:
+                if (c != '\n')
+                    return BODY_BAD;
+                m_chunk_state = CHUNK_SIZE;
+                m_size_digits = 0;
+                break;
+            case CHUNK_TRAILER:
+                m_chunk_state = (c == '\r') ? CHUNK_END_LF : CHUNK_TRAILER_LINE;
+                break;
+            case CHUNK_TRAILER_LINE:
+                if (c == '\n')
+                    m_chunk_state = CHUNK_TRAILER;
+                break;
+            case CHUNK_END_LF:
+                if (c != '\n')
+                    return BODY_BAD;
+                *consumed = i + 1;
+                return BODY_DONE;
+        }
+        ++i;
+    }
+    *consumed = i;
+    return BODY_OPEN;
+}
@@ -0,0 +1,94 @@
+#ifndef BODY_READER_H
+#define BODY_READER_H
+
+#include <string>
+
+/*************************************************************
+ * 请求消息体的存储
+ *
+ * 小于 SPILL_THRESHOLD 的消息体保存在内存中, 可以直接当字符串用;
+ * 超过阈值后把已有内容连同后续数据一起写入临时文件,
+ * 每个连接常驻内存不随消息体大小增长
+ **************************************************************/
+class request_body {
+public:
+    static const int SPILL_THRESHOLD = 8192;  // 内存中最多保存的字节数
+
+public:
+    request_body();
+    ~request_body();
+
+    /* 清空内容, 关闭临时文件, 连接复用时调用 */
+    void clear();
+    /* 追加一段消息体 */
+    bool append(const char *data, int len);
+
+    long size() const { return m_size; }
+    bool in_memory() const { return m_fd < 0; }
+    /* 内存模式下返回以 \0 结尾的消息体, 已溢出到文件时返回NULL */
+    const char *c_str() const { return in_memory() ? m_mem.c_str() : NULL; }
+    /* 溢出模式下的临时文件, 文件已unlink, 关闭即删除 */
+    int fd() const { return m_fd; }
+
+private:
+    bool spill();
+
+private:
+    std::string m_mem;  // 内存中的消息体
+    int m_fd;           // 临时文件, -1 表示未溢出
+    long m_size;        // 消息体总长度
+};
+
+/*************************************************************
+ * 增量解析请求消息体
+ *
+ * 支持 Content-Length 和 Transfer-Encoding: chunked 两种方式,
+ * 每次把读缓冲区里已有的数据喂进来, 解出的数据片段交给 request_body,
+ * 读缓冲区随即可以清空, 不要求整个消息体同时待在 m_read_buf 中
+ **************************************************************/
+class body_reader {
+public:
+    static const long MAX_BODY_SIZE = 64 * 1024 * 1024;  // 消息体长度上限
+
+    enum STATUS {
+        BODY_OPEN = 0,  // 消息体还没收完
+        BODY_DONE,      // 消息体接收完毕
+        BODY_BAD        // 格式错误或超过长度上限
+    };
+
+public:
+    body_reader();
+
+    /* 按 Content-Length 读取 length 字节 */
+    void init_length(long length, request_body *body);
+    /* 按 chunked 编码读取 */
+    void init_chunked(request_body *body);
+
+    /* 喂入 len 字节, 全部消费或遇到结束/错误为止, consumed 返回消费的字节数 */
+    STATUS feed(const char *data, int len, int *consumed);
+
+private:
+    enum CHUNK_STATE {  // chunked 解码状态
+        CHUNK_SIZE = 0,   // 十六进制的块长度
+        CHUNK_EXT,        // 块扩展, 跳过到行尾
+        CHUNK_SIZE_LF,    // 块长度行的 \n
+        CHUNK_DATA,       // 块数据
+        CHUNK_DATA_CR,    // 块数据后的 \r
+        CHUNK_DATA_LF,    // 块数据后的 \n
+        CHUNK_TRAILER,    // trailer 行首
+        CHUNK_TRAILER_LINE,  // trailer 行中, 跳过到行尾
+        CHUNK_END_LF      // 最后空行的 \n
+    };
+
+    STATUS feed_chunked(const char *data, int len, int *consumed);
+
+private:
+    request_body *m_body;
+    bool m_chunked;
+    long m_remain;        // 当前需要读取的剩余字节数(整个消息体或当前块)
+    CHUNK_STATE m_chunk_state;
+    int m_size_digits;    // 块长度的十六进制位数
+    STATUS m_status;
+};
+
+#endif  // BODY_READER_H
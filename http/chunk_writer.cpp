@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "chunk_writer.h"
+
+static const char chunk_crlf[] = "\r\n";
+
+buffer_pool::buffer_pool() : m_free(NULL), m_free_count(0) {
+}
+
+buffer_pool::~buffer_pool() {
+    while (m_free) {
+        chunk_block *next = m_free->next;
+        delete m_free;
+        m_free = next;
+    }
+}
+
+buffer_pool *buffer_pool::get_instance() {
+    static buffer_pool instance;
+    return &instance;
+}
+
+chunk_block *buffer_pool::get() {
+    chunk_block *block = NULL;
+    m_mutex.lock();
+    if (m_free) {
+        block = m_free;
+        m_free = block->next;
+        --m_free_count;
+    }
+    m_mutex.unlock();
+
+    if (!block)
+        block = new chunk_block;
+    block->next = NULL;
+    block->len = 0;
+    block->hdr_len = 0;
+    return block;
+}
+
+void buffer_pool::put(chunk_block *block) {
+    m_mutex.lock();
+    if (m_free_count < MAX_FREE) {
+        block->next = m_free;
+        m_free = block;
+        ++m_free_count;
+        block = NULL;
+    }
+    m_mutex.unlock();
+
+    // 空闲块已经够多, 直接释放
+    delete block;
+}
+
+chunk_writer::chunk_writer() : m_head_data(NULL), m_head_len(0), m_head(NULL), m_tail(NULL),
+                               m_offset(0), m_pending(0), m_finished(false) {
+}
+
+chunk_writer::~chunk_writer() {
+    clear();
+}
+
+void chunk_writer::clear() {
+    while (m_head) {
+        chunk_block *next = m_head->next;
+        buffer_pool::get_instance()->put(m_head);
+        m_head = next;
+    }
+    m_tail = NULL;
+    m_head_data = NULL;
+    m_head_len = 0;
+    m_offset = 0;
+    m_pending = 0;
+    m_finished = false;
+}
+
+void chunk_writer::set_head(const char *head, int len) {
+    m_head_data = head;
+    m_head_len = len;
+}
+
+void chunk_writer::seal(chunk_block *block) {
+    block->hdr_len = snprintf(block->hdr, sizeof(block->hdr), "%x\r\n", block->len);
+    ++m_pending;
+}
+
+/* 返回可以继续写入的块, 当前块已封口或写满时从池里取一块新的 */
+chunk_block *chunk_writer::writable() {
+    if (m_tail && m_tail->hdr_len == 0 && m_tail->len < chunk_block::BLOCK_SIZE)
+        return m_tail;
+
+    if (m_tail && m_tail->hdr_len == 0)
+        seal(m_tail);
+
+    chunk_block *block = buffer_pool::get_instance()->get();
+    if (m_tail)
+        m_tail->next = block;
+    else
+        m_head = block;
+    m_tail = block;
+    return block;
+}
+
+bool chunk_writer::append(const char *data, int len) {
+    if (m_finished)
+        return false;
+
+    while (len > 0) {
+        chunk_block *block = writable();
+        int n = chunk_block::BLOCK_SIZE - block->len;
+        if (n > len)
+            n = len;
+        memcpy(block->data + block->len, data, n);
+        block->len += n;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool chunk_writer::printf(const char *format, ...) {
+    if (m_finished)
+        return false;
+
+    chunk_block *block = writable();
+    int room = chunk_block::BLOCK_SIZE - block->len;
+
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(block->data + block->len, room, format, arg_list);
+    va_end(arg_list);
+
+    if (len < 0)
+        return false;
+    if (len < room) {
+        block->len += len;
+        return true;
+    }
+
+    /* 当前块放不下, 格式化到临时缓冲区再分块拷贝 */
+    char *buf = new char[len + 1];
+    va_start(arg_list, format);
+    vsnprintf(buf, len + 1, format, arg_list);
+    va_end(arg_list);
+    bool ret = append(buf, len);
+    delete[] buf;
+    return ret;
+}
+
+void chunk_writer::finish() {
+    if (m_finished)
+        return;
+
+    if (m_tail && m_tail->hdr_len == 0 && m_tail->len > 0)
+        seal(m_tail);
+
+    // 长度为0的块即结束块 0\r\n\r\n
+    chunk_block *last = m_tail;
+    if (!last || last->hdr_len != 0) {
+        last = buffer_pool::get_instance()->get();
+        if (m_tail)
+            m_tail->next = last;
+        else
+            m_head = last;
+        m_tail = last;
+    }
+    seal(last);
+    m_finished = true;
+}
+
+int chunk_writer::gather(struct iovec *iv, int max) {
+    /* 正在写入的块也封口发出, 不等写满 */
+    if (m_tail && m_tail->hdr_len == 0 && m_tail->len > 0)
+        seal(m_tail);
+
+    int count = 0;
+    if (m_head_len > 0) {
+        iv[count].iov_base = (void *)m_head_data;
+        iv[count].iov_len = m_head_len;
+        ++count;
+    }
+
+    /* 每块最多三段: 块头、数据、\r\n, 跳过已发送的部分 */
+    int skip = m_offset;
+    for (chunk_block *b = m_head; b && b->hdr_len != 0 && count + 3 <= max; b = b->next) {
+        const char *part[3] = {b->hdr, b->data, chunk_crlf};
+        int part_len[3] = {b->hdr_len, b->len, 2};
+        for (int i = 0; i < 3; ++i) {
+            if (skip >= part_len[i]) {
+                skip -= part_len[i];
+                continue;
+            }
+            iv[count].iov_base = (void *)(part[i] + skip);
+            iv[count].iov_len = part_len[i] - skip;
+            ++count;
+            skip = 0;
+        }
+    }
+    return count;
+}
+
+/* 推进发送位置, 发完的块归还数据块池 */
+void chunk_writer::consume(int sent) {
+    int left = sent;
+    if (m_head_len > 0) {
+        int n = left < m_head_len ? left : m_head_len;
+        m_head_data += n;
+        m_head_len -= n;
+        left -= n;
+    }
+    while (left > 0 && m_head) {
+        int total = m_head->hdr_len + m_head->len + 2;
+        if (m_offset + left < total) {
+            m_offset += left;
+            break;
+        }
+        left -= total - m_offset;
+        m_offset = 0;
+        chunk_block *next = m_head->next;
+        buffer_pool::get_instance()->put(m_head);
+        --m_pending;
+        if (m_tail == m_head)
+            m_tail = NULL;
+        m_head = next;
+    }
+}
+
+void chunk_writer::drain(std::string &out) {
+    for (chunk_block *b = m_head; b; b = b->next)
+        out.append(b->data, b->len);
+    clear();
+}
@@ -0,0 +1,99 @@
+#ifndef CHUNK_WRITER_H
+#define CHUNK_WRITER_H
+
+#include <sys/uio.h>
+#include <string>
+#include "locker.h"
+
+/* 响应数据块, 发送时按 chunked 编码组帧: 块长度\r\n 数据 \r\n */
+struct chunk_block {
+    static const int BLOCK_SIZE = 4096 - 64;  // 每块数据区大小, 整块约一页
+
+    chunk_block *next;
+    int len;              // data 中已写入的字节数
+    int hdr_len;          // hdr 的长度, 0 表示还没封口
+    char hdr[16];         // 十六进制块长度 + \r\n
+    char data[BLOCK_SIZE];
+};
+
+/*************************************************************
+ * 数据块池
+ * 所有连接共用, 发送完毕的块归还到空闲链表, 避免每个响应反复 new/delete
+ **************************************************************/
+class buffer_pool {
+public:
+    static buffer_pool *get_instance();
+
+    chunk_block *get();
+    void put(chunk_block *block);
+
+private:
+    buffer_pool();
+    ~buffer_pool();
+
+private:
+    static const int MAX_FREE = 1024;  // 最多缓存的空闲块数
+
+    locker m_mutex;
+    chunk_block *m_free;
+    int m_free_count;
+};
+
+/*************************************************************
+ * chunked 响应写入器
+ *
+ * 处理函数把生成的内容 append/printf 进来, 写满一块就封口;
+ * flush 用一次 writev 把响应头和所有已封口的块一起发出去,
+ * 发送完毕的块立刻归还数据块池。
+ * 处理函数不必一次生成全部内容, 首字节时间与响应总大小无关
+ **************************************************************/
+class chunk_writer {
+public:
+    static const int HIGH_WATER = 16;  // 未发送的块超过该数量时暂停生成
+    static const int MAX_IOV = 64;     // 一次 gather 最多使用的 iovec 数
+
+public:
+    chunk_writer();
+    ~chunk_writer();
+
+    /* 归还所有块, 连接复用时调用 */
+    void clear();
+    /* 设置响应头, 在第一块之前原样发送 */
+    void set_head(const char *head, int len);
+
+    bool append(const char *data, int len);
+    bool printf(const char *format, ...);
+    /* 结束响应, 追加长度为0的结束块 */
+    void finish();
+
+    bool finished() const { return m_finished; }
+    /* 是否还有未发送的数据 */
+    bool empty() const { return m_head_len == 0 && (m_head == NULL || (m_head->hdr_len == 0 && m_head->len == 0)); }
+    /* 已封口待发送的块数, 用于背压 */
+    int pending() const { return m_pending; }
+
+    /* 取出全部未发送的内容(不含chunked组帧)追加到 out, 并归还所有块; 用于不需要chunked编码的场合 */
+    void drain(std::string &out);
+
+    /*
+        封口当前块, 把响应头和已封口的块填入 iv, 返回使用的 iovec 数, 0 表示没有可发送的数据;
+        发送由调用方完成(明文 writev 或 TLS), 然后用 consume 报告实际写出的字节数
+     */
+    int gather(struct iovec *iv, int max);
+    void consume(int sent);
+
+private:
+    void seal(chunk_block *block);
+    chunk_block *writable();
+
+private:
+    const char *m_head_data;  // 响应头
+    int m_head_len;           // 响应头剩余未发送的字节数
+    chunk_block *m_head;      // 最早的块
+    chunk_block *m_tail;      // 正在写入的块
+    int m_offset;             // m_head 已发送的字节数(含块头)
+    int m_pending;
+    bool m_finished;
+};
+
+#endif  // CHUNK_WRITER_H
@@ -0,0 +1,684 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "h2_session.h"
+
+/* 帧类型 */
+enum {
+    FRAME_DATA = 0x0,
+    FRAME_HEADERS = 0x1,
+    FRAME_PRIORITY = 0x2,
+    FRAME_RST_STREAM = 0x3,
+    FRAME_SETTINGS = 0x4,
+    FRAME_PUSH_PROMISE = 0x5,
+    FRAME_PING = 0x6,
+    FRAME_GOAWAY = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION = 0x9
+};
+
+/* 帧标志 */
+enum {
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20
+};
+
+/* SETTINGS 参数 */
+enum {
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+static const char client_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const int PREFACE_LEN = 24;
+static const long MAX_WINDOW = 0x7fffffff;
+
+static unsigned int read_u32(const unsigned char *p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+h2_stream::h2_stream(int stream_id, long window)
+    : id(stream_id), remote_closed(false), responded(false), headers_sent(false),
+      send_window(window), recv_window(h2_session::DEFAULT_WINDOW), recv_consumed(0),
+      status(0), content_type(NULL), map_addr(NULL), map_len(0), sent(0) {
+}
+
+h2_stream::~h2_stream() {
+    if (map_addr)
+        munmap(map_addr, map_len);
+}
+
+h2_session::h2_session(request_handler handler, void *ctx)
+    : m_handler(handler), m_ctx(ctx), m_last_stream_id(0), m_next_schedule(0), m_out_pos(0),
+      m_preface_ok(false), m_settings_seen(false), m_cont_stream(0), m_cont_end_stream(false),
+      m_send_window(DEFAULT_WINDOW), m_recv_window(DEFAULT_WINDOW), m_recv_consumed(0),
+      m_peer_initial_window(DEFAULT_WINDOW), m_peer_max_frame(MAX_FRAME_SIZE),
+      m_goaway_sent(false), m_peer_goaway(false) {
+}
+
+h2_session::~h2_session() {
+    for (std::map<int, h2_stream *>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+        delete it->second;
+}
+
+void h2_session::start() {
+    // 服务端连接序言就是一个 SETTINGS 帧
+    write_settings();
+}
+
+/* base64url 解码, 用于 HTTP2-Settings 头部 */
+static bool base64url_decode(const char *in, std::string &out) {
+    unsigned int acc = 0;
+    int bits = 0;
+    for (; *in && *in != '='; ++in) {
+        char c = *in;
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-' || c == '+') v = 62;
+        else if (c == '_' || c == '/') v = 63;
+        else if (c == ' ' || c == '\t') continue;
+        else return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += (char)((acc >> bits) & 0xff);
+        }
+    }
+    return true;
+}
+
+bool h2_session::start_upgrade(const char *settings, const char *method, const char *path) {
+    std::string payload;
+    if (!base64url_decode(settings, payload) || payload.size() % 6 != 0)
+        return false;
+    if (!apply_settings((const unsigned char *)payload.data(), payload.size()))
+        return false;
+
+    static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    m_out.append(switching, sizeof(switching) - 1);
+    write_settings();
+
+    /* 升级前的请求是流1, 处于半关闭(远端)状态 */
+    h2_stream *stream = new h2_stream(1, m_peer_initial_window);
+    stream->method = method;
+    stream->path = path;
+    stream->remote_closed = true;
+    m_streams[1] = stream;
+    m_last_stream_id = 1;
+    dispatch(stream);
+    return true;
+}
+
+bool h2_session::buffer(const char *data, int len) {
+    if (m_goaway_sent)
+        return false;
+    /*
+        DATA 受接收窗口限制, 正常客户端一次送来的数据远小于上限;
+        超过上限说明对端在灌控制帧或头部, ET 模式下不能一直读下去
+     */
+    if (m_in.size() + len > (size_t)MAX_IN_BUFFER)
+        return goaway(H2_ENHANCE_YOUR_CALM);
+    m_in.append(data, len);
+    return true;
+}
+
+bool h2_session::process() {
+    if (m_goaway_sent)
+        return false;
+
+    size_t pos = 0;
+    if (!m_preface_ok) {
+        size_t n = m_in.size() < (size_t)PREFACE_LEN ? m_in.size() : PREFACE_LEN;
+        if (memcmp(m_in.data(), client_preface, n) != 0)
+            return goaway(H2_PROTOCOL_ERROR);
+        if (n < (size_t)PREFACE_LEN)
+            return true;
+        m_preface_ok = true;
+        pos = PREFACE_LEN;
+    }
+
+    bool ok = true;
+    while (ok && m_in.size() - pos >= 9) {
+        const unsigned char *h = (const unsigned char *)m_in.data() + pos;
+        int len = (h[0] << 16) | (h[1] << 8) | h[2];
+        int type = h[3];
+        int flags = h[4];
+        int sid = read_u32(h + 5) & 0x7fffffff;
+
+        if (len > MAX_FRAME_SIZE) {
+            ok = goaway(H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (m_in.size() - pos < (size_t)(9 + len))
+            break;
+
+        /*
+            PING/SETTINGS 的 ACK, WINDOW_UPDATE 和 RST_STREAM 都是对端的帧触发的,
+            对端只发不读时这些回复会一直堆在发送缓冲区里
+         */
+        if (m_out.size() - m_out_pos > (size_t)MAX_OUT_BUFFER) {
+            ok = goaway(H2_ENHANCE_YOUR_CALM);
+            break;
+        }
+
+        /* 连接序言之后的第一帧必须是 SETTINGS */
+        if (!m_settings_seen && type != FRAME_SETTINGS) {
+            ok = goaway(H2_PROTOCOL_ERROR);
+            break;
+        }
+        /* 头部块未结束时只能收到同一个流的 CONTINUATION */
+        if (m_cont_stream && (type != FRAME_CONTINUATION || sid != m_cont_stream)) {
+            ok = goaway(H2_PROTOCOL_ERROR);
+            break;
+        }
+
+        ok = handle_frame(type, flags, sid, h + 9, len);
+        pos += 9 + len;
+    }
+    m_in.erase(0, pos);
+    return ok;
+}
+
+bool h2_session::handle_frame(int type, int flags, int sid, const unsigned char *payload, int len) {
+    switch (type) {
+        case FRAME_DATA:
+            return on_data(flags, sid, payload, len);
+        case FRAME_HEADERS:
+            return on_headers(flags, sid, payload, len);
+        case FRAME_CONTINUATION: {
+            if (!m_cont_stream)
+                return goaway(H2_PROTOCOL_ERROR);
+            if (m_header_block.size() + len > (size_t)MAX_HEADER_BLOCK)
+                return goaway(H2_ENHANCE_YOUR_CALM);
+            m_header_block.append((const char *)payload, len);
+            if (flags & FLAG_END_HEADERS) {
+                m_cont_stream = 0;
+                return on_header_block(sid, m_cont_end_stream);
+            }
+            return true;
+        }
+        case FRAME_PRIORITY: {
+            // 优先级已在 RFC 9113 中废弃, 校验后忽略
+            if (sid == 0)
+                return goaway(H2_PROTOCOL_ERROR);
+            if (len != 5)
+                reset_stream(sid, H2_FRAME_SIZE_ERROR);
+            return true;
+        }
+        case FRAME_RST_STREAM: {
+            if (sid == 0 || sid > m_last_stream_id)
+                return goaway(H2_PROTOCOL_ERROR);
+            if (len != 4)
+                return goaway(H2_FRAME_SIZE_ERROR);
+            close_stream(sid);
+            return true;
+        }
+        case FRAME_SETTINGS:
+            return on_settings(flags, sid, payload, len);
+        case FRAME_PUSH_PROMISE:
+            // 客户端不能推送
+            return goaway(H2_PROTOCOL_ERROR);
+        case FRAME_PING: {
+            if (sid != 0)
+                return goaway(H2_PROTOCOL_ERROR);
+            if (len != 8)
+                return goaway(H2_FRAME_SIZE_ERROR);
+            if (!(flags & FLAG_ACK))
+                write_frame(FRAME_PING, FLAG_ACK, 0, (const char *)payload, 8);
+            return true;
+        }
+        case FRAME_GOAWAY: {
+            if (sid != 0)
+                return goaway(H2_PROTOCOL_ERROR);
+            // 不再接受新流, 已有的流处理完后关闭连接
+            m_peer_goaway = true;
+            return true;
+        }
+        case FRAME_WINDOW_UPDATE:
+            return on_window_update(sid, payload, len);
+        default:
+            // 未知类型的帧必须忽略
+            return true;
+    }
+}
+
+bool h2_session::on_headers(int flags, int sid, const unsigned char *payload, int len) {
+    if (sid == 0 || (sid & 1) == 0)
+        return goaway(H2_PROTOCOL_ERROR);
+
+    /* 去掉填充和优先级字段 */
+    int pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1)
+            return goaway(H2_FRAME_SIZE_ERROR);
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (flags & FLAG_PRIORITY) {
+        if (len < 5)
+            return goaway(H2_FRAME_SIZE_ERROR);
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len)
+        return goaway(H2_PROTOCOL_ERROR);
+    len -= pad;
+
+    if (len > MAX_HEADER_BLOCK)
+        return goaway(H2_ENHANCE_YOUR_CALM);
+    m_header_block.assign((const char *)payload, len);
+
+    if (!(flags & FLAG_END_HEADERS)) {
+        m_cont_stream = sid;
+        m_cont_end_stream = (flags & FLAG_END_STREAM) != 0;
+        return true;
+    }
+    return on_header_block(sid, (flags & FLAG_END_STREAM) != 0);
+}
+
+bool h2_session::on_header_block(int sid, bool end_stream) {
+    /* 无论流最终是否被接受, 都必须解码以保持动态表同步 */
+    header_list headers;
+    if (!m_decoder.decode((const unsigned char *)m_header_block.data(), m_header_block.size(), headers))
+        return goaway(H2_COMPRESSION_ERROR);
+    m_header_block.clear();
+
+    h2_stream *stream = find_stream(sid);
+    if (stream) {
+        /* 已打开的流上再次收到头部, 只能是带 END_STREAM 的 trailer */
+        if (stream->remote_closed) {
+            reset_stream(sid, H2_STREAM_CLOSED);
+            close_stream(sid);
+            return true;
+        }
+        if (!end_stream)
+            return goaway(H2_PROTOCOL_ERROR);
+        stream->remote_closed = true;
+        dispatch(stream);
+        return true;
+    }
+
+    if (sid <= m_last_stream_id)
+        return goaway(H2_STREAM_CLOSED);
+    m_last_stream_id = sid;
+
+    if (m_peer_goaway)
+        return true;
+    if ((int)m_streams.size() >= MAX_CONCURRENT_STREAMS) {
+        reset_stream(sid, H2_REFUSED_STREAM);
+        return true;
+    }
+
+    stream = new h2_stream(sid, m_peer_initial_window);
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (headers[i].first == ":method")
+            stream->method = headers[i].second;
+        else if (headers[i].first == ":path")
+            stream->path = headers[i].second;
+    }
+    m_streams[sid] = stream;
+
+    if (stream->method.empty() || stream->path.empty()) {
+        reset_stream(sid, H2_PROTOCOL_ERROR);
+        close_stream(sid);
+        return true;
+    }
+
+    if (end_stream) {
+        stream->remote_closed = true;
+        dispatch(stream);
+    }
+    return true;
+}
+
+bool h2_session::on_data(int flags, int sid, const unsigned char *payload, int len) {
+    if (sid == 0)
+        return goaway(H2_PROTOCOL_ERROR);
+
+    /* 流量控制按整帧长度计算, 包含填充 */
+    int frame_len = len;
+    m_recv_window -= len;
+    if (m_recv_window < 0)
+        return goaway(H2_FLOW_CONTROL_ERROR);
+    m_recv_consumed += len;
+    if (m_recv_consumed >= DEFAULT_WINDOW / 2) {
+        write_window_update(0, m_recv_consumed);
+        m_recv_window += m_recv_consumed;
+        m_recv_consumed = 0;
+    }
+
+    int pad = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1)
+            return goaway(H2_FRAME_SIZE_ERROR);
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (pad > len)
+        return goaway(H2_PROTOCOL_ERROR);
+
+    h2_stream *stream = find_stream(sid);
+    if (!stream) {
+        if (sid > m_last_stream_id)
+            return goaway(H2_PROTOCOL_ERROR);
+        reset_stream(sid, H2_STREAM_CLOSED);
+        return true;
+    }
+    if (stream->remote_closed) {
+        reset_stream(sid, H2_STREAM_CLOSED);
+        close_stream(sid);
+        return true;
+    }
+
+    stream->recv_window -= frame_len;
+    if (stream->recv_window < 0) {
+        reset_stream(sid, H2_FLOW_CONTROL_ERROR);
+        close_stream(sid);
+        return true;
+    }
+
+    len -= pad;
+    if (stream->body.size() + len > body_reader::MAX_BODY_SIZE || !stream->body.append((const char *)payload, len)) {
+        reset_stream(sid, H2_ENHANCE_YOUR_CALM);
+        close_stream(sid);
+        return true;
+    }
+
+    if (flags & FLAG_END_STREAM) {
+        stream->remote_closed = true;
+        dispatch(stream);
+        return true;
+    }
+
+    stream->recv_consumed += frame_len;
+    if (stream->recv_consumed >= DEFAULT_WINDOW / 2) {
+        write_window_update(sid, stream->recv_consumed);
+        stream->recv_window += stream->recv_consumed;
+        stream->recv_consumed = 0;
+    }
+    return true;
+}
+
+bool h2_session::apply_settings(const unsigned char *payload, int len) {
+    for (int i = 0; i + 6 <= len; i += 6) {
+        int id = (payload[i] << 8) | payload[i + 1];
+        unsigned int value = read_u32(payload + i + 2);
+        switch (id) {
+            case SETTINGS_ENABLE_PUSH:
+                if (value > 1)
+                    return false;
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                if (value > (unsigned int)MAX_WINDOW)
+                    return false;
+                /* 调整所有流的发送窗口 */
+                long delta = (long)value - m_peer_initial_window;
+                for (std::map<int, h2_stream *>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+                    it->second->send_window += delta;
+                    if (it->second->send_window > MAX_WINDOW)
+                        return false;
+                }
+                m_peer_initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if (value < 16384 || value > 16777215)
+                    return false;
+                m_peer_max_frame = value;
+                break;
+            default:
+                // 我们从不向动态表插入条目, 其余参数不影响发送
+                break;
+        }
+    }
+    return true;
+}
+
+bool h2_session::on_settings(int flags, int sid, const unsigned char *payload, int len) {
+    if (sid != 0)
+        return goaway(H2_PROTOCOL_ERROR);
+    if (flags & FLAG_ACK) {
+        if (len != 0)
+            return goaway(H2_FRAME_SIZE_ERROR);
+        return true;
+    }
+    if (len % 6 != 0)
+        return goaway(H2_FRAME_SIZE_ERROR);
+    if (!apply_settings(payload, len))
+        return goaway(H2_PROTOCOL_ERROR);
+
+    m_settings_seen = true;
+    write_frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+bool h2_session::on_window_update(int sid, const unsigned char *payload, int len) {
+    if (len != 4)
+        return goaway(H2_FRAME_SIZE_ERROR);
+    long increment = read_u32(payload) & 0x7fffffff;
+
+    if (sid == 0) {
+        if (increment == 0)
+            return goaway(H2_PROTOCOL_ERROR);
+        m_send_window += increment;
+        if (m_send_window > MAX_WINDOW)
+            return goaway(H2_FLOW_CONTROL_ERROR);
+        return true;
+    }
+
+    if (sid > m_last_stream_id)
+        return goaway(H2_PROTOCOL_ERROR);
+    h2_stream *stream = find_stream(sid);
+    if (!stream)
+        return true;
+    if (increment == 0) {
+        reset_stream(sid, H2_PROTOCOL_ERROR);
+        close_stream(sid);
+        return true;
+    }
+    stream->send_window += increment;
+    if (stream->send_window > MAX_WINDOW) {
+        reset_stream(sid, H2_FLOW_CONTROL_ERROR);
+        close_stream(sid);
+    }
+    return true;
+}
+
+void h2_session::dispatch(h2_stream *stream) {
+    m_handler(m_ctx, stream);
+    stream->responded = true;
+}
+
+h2_stream *h2_session::find_stream(int sid) {
+    std::map<int, h2_stream *>::iterator it = m_streams.find(sid);
+    return it == m_streams.end() ? NULL : it->second;
+}
+
+void h2_session::close_stream(int sid) {
+    std::map<int, h2_stream *>::iterator it = m_streams.find(sid);
+    if (it != m_streams.end()) {
+        delete it->second;
+        m_streams.erase(it);
+    }
+}
+
+void h2_session::write_frame(int type, int flags, int sid, const char *payload, int len) {
+    char h[9];
+    h[0] = (len >> 16) & 0xff;
+    h[1] = (len >> 8) & 0xff;
+    h[2] = len & 0xff;
+    h[3] = type;
+    h[4] = flags;
+    h[5] = (sid >> 24) & 0x7f;
+    h[6] = (sid >> 16) & 0xff;
+    h[7] = (sid >> 8) & 0xff;
+    h[8] = sid & 0xff;
+    m_out.append(h, 9);
+    if (len > 0)
+        m_out.append(payload, len);
+}
+
+void h2_session::write_settings() {
+    char payload[6];
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    payload[2] = (MAX_CONCURRENT_STREAMS >> 24) & 0xff;
+    payload[3] = (MAX_CONCURRENT_STREAMS >> 16) & 0xff;
+    payload[4] = (MAX_CONCURRENT_STREAMS >> 8) & 0xff;
+    payload[5] = MAX_CONCURRENT_STREAMS & 0xff;
+    write_frame(FRAME_SETTINGS, 0, 0, payload, 6);
+}
+
+void h2_session::write_window_update(int sid, long increment) {
+    char payload[4];
+    payload[0] = (increment >> 24) & 0x7f;
+    payload[1] = (increment >> 16) & 0xff;
+    payload[2] = (increment >> 8) & 0xff;
+    payload[3] = increment & 0xff;
+    write_frame(FRAME_WINDOW_UPDATE, 0, sid, payload, 4);
+}
+
+void h2_session::reset_stream(int sid, ERROR_CODE code) {
+    char payload[4] = {0, 0, 0, (char)code};
+    write_frame(FRAME_RST_STREAM, 0, sid, payload, 4);
+}
+
+/* 连接错误: 发送 GOAWAY, 之后不再处理任何帧, 发送完毕后关闭连接 */
+bool h2_session::goaway(ERROR_CODE code) {
+    if (!m_goaway_sent) {
+        char payload[8];
+        payload[0] = (m_last_stream_id >> 24) & 0x7f;
+        payload[1] = (m_last_stream_id >> 16) & 0xff;
+        payload[2] = (m_last_stream_id >> 8) & 0xff;
+        payload[3] = m_last_stream_id & 0xff;
+        payload[4] = payload[5] = payload[6] = 0;
+        payload[7] = code;
+        write_frame(FRAME_GOAWAY, 0, 0, payload, 8);
+        m_goaway_sent = true;
+    }
+    return false;
+}
+
+bool h2_session::stream_ready(const h2_stream *stream) const {
+    if (!m_preface_ok || !stream->responded)
+        return false;
+    if (!stream->headers_sent)
+        return true;
+    return stream->sent < stream->resp_len() && stream->send_window > 0 && m_send_window > 0;
+}
+
+void h2_session::schedule() {
+    /*
+        升级时流1的响应等收到客户端连接序言后再发,
+        部分客户端只为 101 之后的数据预留了很小的缓冲区
+     */
+    if (m_goaway_sent || !m_preface_ok)
+        return;
+
+    bool progress = true;
+    while (progress && m_out.size() - m_out_pos < (size_t)OUT_HIGH_WATER) {
+        progress = false;
+
+        /* 从上一轮结束的位置开始, 每个就绪的流发一帧 */
+        std::map<int, h2_stream *>::iterator it = m_streams.lower_bound(m_next_schedule);
+        for (size_t visited = 0; visited < m_streams.size(); ++visited) {
+            if (it == m_streams.end())
+                it = m_streams.begin();
+            h2_stream *stream = it->second;
+            ++it;
+            if (!stream_ready(stream))
+                continue;
+            progress = true;
+
+            long len = stream->resp_len();
+            if (!stream->headers_sent) {
+                std::string block;
+                char number[24];
+                int n = snprintf(number, sizeof(number), "%ld", len);
+                hpack_encoder::encode_status(block, stream->status);
+                hpack_encoder::encode_header(block, HPACK_CONTENT_LENGTH, number, n);
+                if (stream->content_type)
+                    hpack_encoder::encode_header(block, HPACK_CONTENT_TYPE, stream->content_type, strlen(stream->content_type));
+                write_frame(FRAME_HEADERS, FLAG_END_HEADERS | (len == 0 ? FLAG_END_STREAM : 0),
+                            stream->id, block.data(), block.size());
+                stream->headers_sent = true;
+            }
+            else {
+                long n = len - stream->sent;
+                // 不超过 MAX_FRAME_SIZE, 调度器排队的数据才不会接近 MAX_OUT_BUFFER
+                if (n > m_peer_max_frame) n = m_peer_max_frame;
+                if (n > MAX_FRAME_SIZE) n = MAX_FRAME_SIZE;
+                if (n > stream->send_window) n = stream->send_window;
+                if (n > m_send_window) n = m_send_window;
+                bool last = (stream->sent + n == len);
+                write_frame(FRAME_DATA, last ? FLAG_END_STREAM : 0, stream->id, stream->resp_data() + stream->sent, n);
+                stream->sent += n;
+                stream->send_window -= n;
+                m_send_window -= n;
+            }
+
+            /* 响应发送完毕, 流关闭 */
+            if (stream->headers_sent && stream->sent == len) {
+                m_next_schedule = stream->id + 1;
+                close_stream(stream->id);
+                it = m_streams.lower_bound(m_next_schedule);
+            }
+            else {
+                m_next_schedule = it == m_streams.end() ? 0 : it->first;
+            }
+
+            if (m_out.size() - m_out_pos >= (size_t)OUT_HIGH_WATER)
+                break;
+        }
+    }
+}
+
+int h2_session::output(const char **data) {
+    schedule();
+    *data = m_out.data() + m_out_pos;
+    return m_out.size() - m_out_pos;
+}
+
+void h2_session::consume(int sent) {
+    m_out_pos += sent;
+    if (m_out_pos == m_out.size()) {
+        m_out.clear();
+        m_out_pos = 0;
+    }
+    else if (m_out_pos >= (size_t)OUT_HIGH_WATER) {
+        m_out.erase(0, m_out_pos);
+        m_out_pos = 0;
+    }
+}
+
+bool h2_session::want_write() {
+    if (m_out_pos < m_out.size())
+        return true;
+    if (m_goaway_sent)
+        return false;
+    for (std::map<int, h2_stream *>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+        if (stream_ready(it->second))
+            return true;
+    }
+    return false;
+}
+
+bool h2_session::closing() const {
+    if (m_out_pos < m_out.size())
+        return false;
+    return m_goaway_sent || (m_peer_goaway && m_streams.empty());
+}
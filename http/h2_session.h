@@ -0,0 +1,152 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include <map>
+#include <string>
+#include "hpack.h"
+#include "body_reader.h"
+
+/* HTTP/2 上的一个请求/响应流 */
+struct h2_stream {
+    int id;
+    bool remote_closed;      // 对端已发送 END_STREAM, 请求接收完毕
+    bool responded;          // 已交给处理函数, 响应已就绪
+    bool headers_sent;       // 响应头已发送
+    long send_window;        // 发送窗口
+    long recv_window;        // 接收窗口剩余
+    long recv_consumed;      // 已消费但还没通过 WINDOW_UPDATE 归还的字节数
+
+    /* 请求, 由会话填写 */
+    std::string method;
+    std::string path;
+    request_body body;
+
+    /* 响应, 由处理函数填写 */
+    int status;
+    const char *content_type;  // NULL 表示不发送 content-type
+    std::string data;          // 生成的响应内容
+    char *map_addr;            // 静态文件的 mmap 地址, 流结束时 munmap
+    long map_len;
+    long sent;                 // 已发送的响应体字节数
+
+    h2_stream(int stream_id, long window);
+    ~h2_stream();
+
+    const char *resp_data() const { return map_addr ? map_addr : data.data(); }
+    long resp_len() const { return map_addr ? map_len : (long)data.size(); }
+};
+
+/*************************************************************
+ * 明文 HTTP/2 (h2c) 会话
+ *
+ * 与 http_conn 的 HTTP/1.1 状态机并列, 一个会话对应一条 TCP 连接:
+ *   - 解析帧, 用 HPACK 解出请求头, 一条连接上可同时有多个流
+ *   - 请求接收完毕后交给 request_handler, 复用 HTTP/1.1 的路由和处理函数
+ *   - 连接级和流级流量控制
+ *   - 发送时由帧调度器在有数据且有窗口的流之间轮转, 每轮每个流最多一帧,
+ *     大文件不会阻塞同一连接上的其他资源
+ **************************************************************/
+class h2_session {
+public:
+    /* 请求处理函数, 填写 stream 中的响应部分 */
+    typedef void (*request_handler)(void *ctx, h2_stream *stream);
+
+    static const int MAX_FRAME_SIZE = 16384;           // 我们接收的最大帧, 即协议默认值
+    static const int MAX_CONCURRENT_STREAMS = 100;     // 同时处理的最大流数
+    static const int DEFAULT_WINDOW = 65535;           // 初始窗口
+    static const int MAX_HEADER_BLOCK = 16384;         // 单个头部块上限
+    static const int OUT_HIGH_WATER = 64 * 1024;       // 发送缓冲区超过该值时暂停调度
+    static const int MAX_IN_BUFFER = 256 * 1024;       // 接收缓冲区上限, 超过时 GOAWAY
+    static const int MAX_OUT_BUFFER = 4 * OUT_HIGH_WATER;  // 对端不读时发送缓冲区上限, 超过时 GOAWAY
+
+    enum ERROR_CODE {
+        H2_NO_ERROR = 0x0,
+        H2_PROTOCOL_ERROR = 0x1,
+        H2_INTERNAL_ERROR = 0x2,
+        H2_FLOW_CONTROL_ERROR = 0x3,
+        H2_STREAM_CLOSED = 0x5,
+        H2_FRAME_SIZE_ERROR = 0x6,
+        H2_REFUSED_STREAM = 0x7,
+        H2_COMPRESSION_ERROR = 0x9,
+        H2_ENHANCE_YOUR_CALM = 0xb
+    };
+
+public:
+    h2_session(request_handler handler, void *ctx);
+    ~h2_session();
+
+    /* 客户端直接发送连接序言(prior knowledge)时调用 */
+    void start();
+    /*
+        通过 Upgrade: h2c 切换协议时调用, settings 为 HTTP2-Settings 头部的值;
+        先发送 101 响应, 升级前的请求成为流1。settings 非法时返回false, 不做任何改动
+     */
+    bool start_upgrade(const char *settings, const char *method, const char *path);
+
+    /* 保存收到的数据, 由 process 解析; 超过 MAX_IN_BUFFER 时返回false, 已排队 GOAWAY */
+    bool buffer(const char *data, int len);
+    /* 解析并处理已收到的完整帧, 返回false表示连接出错, 已排队 GOAWAY */
+    bool process();
+
+    /* 调度并取出待发送的数据, 返回长度, 0 表示没有可发送的数据 */
+    int output(const char **data);
+    /* 报告实际写出的字节数, 发送由调用方完成(明文 send 或 TLS) */
+    void consume(int sent);
+    /* 是否有数据等待发送 */
+    bool want_write();
+    /* 会话已结束, 发送完毕后应关闭连接 */
+    bool closing() const;
+
+private:
+    bool handle_frame(int type, int flags, int sid, const unsigned char *payload, int len);
+    bool on_headers(int flags, int sid, const unsigned char *payload, int len);
+    bool on_header_block(int sid, bool end_stream);
+    bool on_data(int flags, int sid, const unsigned char *payload, int len);
+    bool on_settings(int flags, int sid, const unsigned char *payload, int len);
+    bool on_window_update(int sid, const unsigned char *payload, int len);
+    bool apply_settings(const unsigned char *payload, int len);
+
+    void dispatch(h2_stream *stream);
+    h2_stream *find_stream(int sid);
+    void close_stream(int sid);
+
+    void write_frame(int type, int flags, int sid, const char *payload, int len);
+    void write_settings();
+    void write_window_update(int sid, long increment);
+    void reset_stream(int sid, ERROR_CODE code);
+    bool goaway(ERROR_CODE code);
+
+    /* 帧调度: 为就绪的流生成 HEADERS/DATA 帧 */
+    void schedule();
+    bool stream_ready(const h2_stream *stream) const;
+
+private:
+    request_handler m_handler;
+    void *m_ctx;
+
+    hpack_decoder m_decoder;
+    std::map<int, h2_stream *> m_streams;
+    int m_last_stream_id;     // 对端打开过的最大流编号
+    int m_next_schedule;      // 调度器下一轮从该流编号开始, 保证轮转公平
+
+    std::string m_in;         // 接收缓冲区
+    std::string m_out;        // 发送缓冲区
+    size_t m_out_pos;         // m_out 已发送的位置
+
+    bool m_preface_ok;        // 已收到客户端连接序言
+    bool m_settings_seen;     // 已收到客户端第一个 SETTINGS
+    int m_cont_stream;        // 等待 CONTINUATION 的流编号, 0 表示无
+    bool m_cont_end_stream;   // 头部块所在 HEADERS 帧是否带 END_STREAM
+    std::string m_header_block;  // 拼接中的头部块
+
+    long m_send_window;       // 连接级发送窗口
+    long m_recv_window;       // 连接级接收窗口剩余
+    long m_recv_consumed;     // 连接级待归还的接收窗口
+    long m_peer_initial_window;  // 对端 SETTINGS_INITIAL_WINDOW_SIZE
+    int m_peer_max_frame;     // 对端 SETTINGS_MAX_FRAME_SIZE
+
+    bool m_goaway_sent;
+    bool m_peer_goaway;
+};
+
+#endif  // H2_SESSION_H
@@ -0,0 +1,363 @@
+#include "hpack.h"
+
+/* 静态表, 下标从1开始 (RFC 7541 附录A) */
+static const char *static_table[][2] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+static const unsigned int STATIC_TABLE_SIZE = sizeof(static_table) / sizeof(static_table[0]);
+
+/* Huffman 编码表, 最后一个是 EOS (RFC 7541 附录B) */
+static const unsigned int huffman_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+static const unsigned char huffman_lens[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/*
+    由编码表构造的 Huffman 解码树, 每个节点两个孩子,
+    孩子的值 >= 0 表示内部节点下标, < 0 表示叶子, 符号为 -(值 + 1)
+ */
+struct huffman_tree {
+    int child[513][2];
+    int count;
+
+    huffman_tree() : count(1) {
+        child[0][0] = child[0][1] = 0;
+        for (int sym = 0; sym < 257; ++sym) {
+            int node = 0;
+            for (int bit = huffman_lens[sym] - 1; bit >= 0; --bit) {
+                int b = (huffman_codes[sym] >> bit) & 1;
+                if (bit == 0) {
+                    child[node][b] = -(sym + 1);
+                }
+                else {
+                    if (child[node][b] == 0) {
+                        child[count][0] = child[count][1] = 0;
+                        child[node][b] = count++;
+                    }
+                    node = child[node][b];
+                }
+            }
+        }
+    }
+};
+
+static const huffman_tree &get_huffman_tree() {
+    static huffman_tree tree;
+    return tree;
+}
+
+static bool huffman_decode(const unsigned char *data, int len, std::string &out) {
+    const huffman_tree &tree = get_huffman_tree();
+    int node = 0;
+    int depth = 0;        // 当前未完成码字已读的位数
+    bool all_ones = true; // 未完成码字是否全为1, 合法的填充只能是 EOS 的前缀
+    for (int i = 0; i < len; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            int b = (data[i] >> bit) & 1;
+            int next = tree.child[node][b];
+            if (next < 0) {
+                int sym = -(next + 1);
+                if (sym == 256)  // 字符串中出现 EOS 是错误
+                    return false;
+                out += (char)sym;
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            }
+            else if (next == 0) {
+                return false;
+            }
+            else {
+                node = next;
+                ++depth;
+                all_ones = all_ones && b;
+            }
+        }
+    }
+    /* 填充不超过7位且全为1 */
+    return depth <= 7 && all_ones;
+}
+
+/* 解码前缀为 prefix_bits 位的整数 */
+static bool decode_integer(const unsigned char *&p, const unsigned char *end, int prefix_bits, unsigned int &value) {
+    if (p >= end)
+        return false;
+    unsigned int mask = (1u << prefix_bits) - 1;
+    value = *p++ & mask;
+    if (value < mask)
+        return true;
+
+    int shift = 0;
+    while (p < end) {
+        unsigned char b = *p++;
+        if (shift > 28)
+            return false;
+        value += (unsigned int)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool decode_string(const unsigned char *&p, const unsigned char *end, std::string &out) {
+    if (p >= end)
+        return false;
+    bool huffman = (*p & 0x80) != 0;
+    unsigned int len;
+    if (!decode_integer(p, end, 7, len) || len > (unsigned int)(end - p))
+        return false;
+
+    out.clear();
+    if (huffman) {
+        if (!huffman_decode(p, len, out))
+            return false;
+    }
+    else {
+        out.assign((const char *)p, len);
+    }
+    p += len;
+    return true;
+}
+
+hpack_decoder::hpack_decoder() : m_size(0), m_max_size(DEFAULT_TABLE_SIZE), m_limit(DEFAULT_TABLE_SIZE) {
+}
+
+bool hpack_decoder::get_entry(unsigned int index, std::string &name, std::string &value) const {
+    if (index == 0)
+        return false;
+    if (index <= STATIC_TABLE_SIZE) {
+        name = static_table[index - 1][0];
+        value = static_table[index - 1][1];
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if (index >= m_table.size())
+        return false;
+    name = m_table[index].first;
+    value = m_table[index].second;
+    return true;
+}
+
+void hpack_decoder::evict(unsigned int limit) {
+    while (m_size > limit && !m_table.empty()) {
+        m_size -= m_table.back().first.size() + m_table.back().second.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+void hpack_decoder::add_entry(const std::string &name, const std::string &value) {
+    unsigned int entry = name.size() + value.size() + 32;
+    /* 条目比整个表还大时, 清空动态表且不插入 */
+    if (entry > m_max_size) {
+        evict(0);
+        return;
+    }
+    evict(m_max_size - entry);
+    m_table.push_front(std::make_pair(name, value));
+    m_size += entry;
+}
+
+bool hpack_decoder::decode(const unsigned char *data, int len, header_list &headers) {
+    const unsigned char *p = data;
+    const unsigned char *end = data + len;
+    std::string name, value;
+    bool header_seen = false;
+
+    while (p < end) {
+        unsigned char b = *p;
+        if (b & 0x80) {
+            /* 索引表示 1xxxxxxx */
+            unsigned int index;
+            if (!decode_integer(p, end, 7, index) || !get_entry(index, name, value))
+                return false;
+            headers.push_back(std::make_pair(name, value));
+            header_seen = true;
+        }
+        else if ((b & 0xe0) == 0x20) {
+            /* 动态表大小更新 001xxxxx, 只能出现在头部块开头 */
+            unsigned int size;
+            if (header_seen || !decode_integer(p, end, 5, size) || size > m_limit)
+                return false;
+            m_max_size = size;
+            evict(m_max_size);
+        }
+        else {
+            /*
+                字面量表示:
+                    01xxxxxx 加入动态表
+                    0000xxxx 不加入动态表
+                    0001xxxx 永不加入动态表
+             */
+            bool indexing = (b & 0xc0) == 0x40;
+            unsigned int index;
+            if (!decode_integer(p, end, indexing ? 6 : 4, index))
+                return false;
+            if (index == 0) {
+                if (!decode_string(p, end, name))
+                    return false;
+            }
+            else if (!get_entry(index, name, value)) {
+                return false;
+            }
+            if (!decode_string(p, end, value))
+                return false;
+
+            if (indexing)
+                add_entry(name, value);
+            headers.push_back(std::make_pair(name, value));
+            header_seen = true;
+        }
+    }
+    return true;
+}
+
+void hpack_encoder::encode_integer(std::string &out, unsigned char first, int prefix_bits, unsigned int value) {
+    unsigned int mask = (1u << prefix_bits) - 1;
+    if (value < mask) {
+        out += (char)(first | value);
+        return;
+    }
+    out += (char)(first | mask);
+    value -= mask;
+    while (value >= 0x80) {
+        out += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+void hpack_encoder::encode_status(std::string &out, int status) {
+    /* 静态表中 :status 的下标 */
+    switch (status) {
+        case 200: out += (char)0x88; return;
+        case 204: out += (char)0x89; return;
+        case 206: out += (char)0x8a; return;
+        case 304: out += (char)0x8b; return;
+        case 400: out += (char)0x8c; return;
+        case 404: out += (char)0x8d; return;
+        case 500: out += (char)0x8e; return;
+        default: break;
+    }
+    char value[4];
+    value[0] = '0' + status / 100 % 10;
+    value[1] = '0' + status / 10 % 10;
+    value[2] = '0' + status % 10;
+    encode_header(out, HPACK_STATUS, value, 3);
+}
+
+void hpack_encoder::encode_header(std::string &out, int name_index, const char *value, int len) {
+    encode_integer(out, 0x00, 4, name_index);
+    encode_integer(out, 0x00, 7, len);
+    out.append(value, len);
+}
@@ -0,0 +1,57 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+
+/* 解码后的头部列表, 按出现顺序保存 name/value */
+typedef std::vector<std::pair<std::string, std::string> > header_list;
+
+/*************************************************************
+ * HPACK 头部压缩 (RFC 7541)
+ *
+ * 解码器维护对端编码器对应的动态表, 支持全部表示方式和 Huffman 编码;
+ * 编码器只用于响应头, 不向动态表插入条目, 对端解码器无需为我们保存状态
+ **************************************************************/
+class hpack_decoder {
+public:
+    static const int DEFAULT_TABLE_SIZE = 4096;  // SETTINGS_HEADER_TABLE_SIZE 默认值
+
+public:
+    hpack_decoder();
+
+    /* 解码一个完整的头部块, 失败返回false, 此时应按 COMPRESSION_ERROR 关闭连接 */
+    bool decode(const unsigned char *data, int len, header_list &headers);
+
+private:
+    bool get_entry(unsigned int index, std::string &name, std::string &value) const;
+    void add_entry(const std::string &name, const std::string &value);
+    void evict(unsigned int limit);
+
+private:
+    std::deque<std::pair<std::string, std::string> > m_table;  // 动态表, 新条目在前
+    unsigned int m_size;      // 动态表当前大小, 每条 name + value + 32
+    unsigned int m_max_size;  // 对端通过大小更新指令设置的上限
+    unsigned int m_limit;     // 我们在 SETTINGS 中允许的上限
+};
+
+class hpack_encoder {
+public:
+    /* 编码 :status, 常见状态码使用静态表索引 */
+    static void encode_status(std::string &out, int status);
+    /* 以"不索引的字面量"编码一个头部, name_index 为静态表中名字的下标 */
+    static void encode_header(std::string &out, int name_index, const char *value, int len);
+
+    static void encode_integer(std::string &out, unsigned char first, int prefix_bits, unsigned int value);
+};
+
+/* 响应中用到的静态表名字下标 */
+enum HPACK_STATIC_NAME {
+    HPACK_STATUS = 8,
+    HPACK_CONTENT_LENGTH = 28,
+    HPACK_CONTENT_TYPE = 31
+};
+
+#endif  // HPACK_H
@@ -14,36 +14,54 @@ const char *error_404_form  = "The requested file was not found on this server.\
 const char *error_500_title = "Internal Error";
 const char *error_500_form  = "There was an unusual problem serving the request file.\n";
 
-locker m_lock;
-std::map<std::string, std::string> users;
-
-void http_conn::initmysql_result(connection_pool *connPool) {
-    /* 先从连接池中取一个连接 */
-    MYSQL *mysql = NULL;
-    connectionRAII mysqlcon(&mysql, connPool);
-
-    /* 在user表中检索username, passwd数据，浏览器端输入 */
-    if (mysql_query(mysql, "SELECT username, passwd FROM user")) {
-        LOG_ERROR("SELECT error:%s\n", mysql_error(mysql));
+// 访问日志中的请求方法, 和 METHOD 的顺序相同
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+/* 预热线程的参数, 由线程释放 */
+struct prewarm_arg {
+    std::string path;
+    int close_log;
+};
+
+/* 按上次退出时保存的用户名逐个从存储后端查出放入缓存, 不影响启动和服务 */
+static void *prewarm_users(void *arg) {
+    prewarm_arg *a = (prewarm_arg *)arg;
+    int m_close_log = a->close_log;
+    user_store *store = user_store::get_instance();
+
+    user_backend *backend = user_backend::get_instance();
+    std::ifstream in(a->path.c_str());
+
+    size_t loaded = 0;
+    std::string name, password;
+    while (backend && loaded < store->capacity() && std::getline(in, name)) {
+        if (name.empty() || store->lookup(name, NULL) != user_store::MISS)
+            continue;
+        int ret = backend->find_user(name, &password);
+        if (ret < 0)
+            break;
+        if (ret > 0 && store->put(name, password))
+            ++loaded;
     }
+    LOG_INFO("user cache prewarmed %d users", (int)loaded);
+    delete a;
+    return NULL;
+}
 
-    //从表中检索完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    //返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
-
-    //返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
+void http_conn::init_user_cache(size_t cache_bytes, std::string hot_file, int close_log) {
+    user_store::get_instance()->init(cache_bytes);
+    if (hot_file.empty() || access(hot_file.c_str(), R_OK) != 0)
+        return;
 
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result)) {
-        std::string temp1(row[0]);
-        std::string temp2(row[1]);
-        users[temp1] = temp2;
+    prewarm_arg *arg = new prewarm_arg;
+    arg->path = hot_file;
+    arg->close_log = close_log;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, prewarm_users, arg) != 0) {
+        delete arg;
+        return;
     }
-
-    // 函数执行结束 mysqlcon会自动释放, 因为是局部变量
+    pthread_detach(tid);
 }
 
 /* 对文件描述符设置非阻塞 */
@@ -90,17 +108,26 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode) {
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
 
 /* 关闭连接，关闭一个连接，客户总量减一 */
 void http_conn::close_conn(bool real_close) {
     if (real_close && (m_sockfd != -1)) {
         printf("close %d\n", m_sockfd);
+        m_tls.close();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
     }
+    m_body.clear();
+    m_chunks.clear();
+    delete m_h2;
+    m_h2 = NULL;
+    if (m_sql_pending) {
+        sql_async::get_instance()->cancel(&m_sql);
+        m_sql_pending = false;
+    }
 }
  
 // 初始化连接,外部调用初始化套接字地址
@@ -110,8 +137,27 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
     m_sockfd = sockfd;
     m_address = addr;
 
+    // 上一个使用该描述符的连接可能由定时器直接关闭, 没有经过 close_conn
+    delete m_h2;
+    m_h2 = NULL;
+    if (m_sql_pending)
+        sql_async::get_instance()->cancel(&m_sql);
+    m_sql_pending = false;
+    m_sql_step = SQL_LOGIN;
+    m_sql.stmt = STMT_NONE;
+    m_sql.batch = false;
+    m_sql.done = sql_done;
+    m_sql.ctx = this;
+
     addfd(m_epollfd, sockfd, true, TRIGMode);  // m_TRIGMode
     ++m_user_count;
+    m_accept_usec = metrics::now_usec();
+
+    // 监听端口启用了TLS, 等待客户端握手; 创建会话失败时关闭写端, 由事件循环按对端关闭处理
+    if (tls_context::get_instance()->enabled() && !m_tls.open(sockfd)) {
+        LOG_ERROR("%s", "create tls session failed");
+        shutdown(sockfd, SHUT_RDWR);
+    }
 
     // 当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
@@ -131,16 +177,27 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 */
 void http_conn::init()
 {
-    mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
+    m_status = 0;
+    m_access_start = 0;
+    m_request_usec = 0;
+    m_parse_start = 0;
+    m_parse_usec = 0;
+    m_sql_usec = 0;
+    m_ready_usec = 0;
+    m_trace_id = 0;
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_chunked = false;
     m_host = 0;
+    m_h2c_upgrade = false;
+    m_h2_settings = 0;
+    m_string = 0;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
@@ -153,6 +210,10 @@ void http_conn::init()
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
+    m_body.clear();
+    m_chunks.clear();
+    m_producer = NULL;
+    m_content_type = NULL;
 }
 
 /* 
@@ -199,6 +260,12 @@ http_conn::LINE_STATUS http_conn::parse_line() {
  */ 
 bool http_conn::read_once()
 {
+    trace_span span(tracer::SPAN_READ, m_sockfd, tracer::on() ? trace_id() : 0);
+    if (m_h2)
+        return read_h2();
+    if (m_tls.active())
+        return read_tls();
+
     if (m_read_idx >= READ_BUFFER_SIZE) {
         return false;
     }
@@ -214,11 +281,16 @@ bool http_conn::read_once()
         if (bytes_read <= 0) {
             return false;
         }
+        metrics::add(metrics::BYTES_IN, bytes_read);
         return true;
     }
     // ET读数据
     else {
-        while (true) {
+        /*
+            读缓冲区满了就先停下, 由 process 把已收到的消息体交给 m_body_reader 腾出缓冲区,
+            重新注册 EPOLLIN 后套接字里剩下的数据会再次触发可读事件
+         */
+        while (m_read_idx < READ_BUFFER_SIZE) {
             bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
             if (bytes_read == -1) {
                 /* 非阻塞ET模式下，需要一次性将数据读完 */
@@ -230,11 +302,59 @@ bool http_conn::read_once()
                 return false;
             }
             m_read_idx += bytes_read;
+            metrics::add(metrics::BYTES_IN, bytes_read);
         }
         return true;
     }
 }
 
+/*
+    TLS 连接: 先推进握手, 握手完成后把解密的数据读入 m_read_buf。
+    已解密的数据留在会话里不会再触发可读事件, 所以LT模式下也要把会话中的明文读完
+ */
+bool http_conn::read_tls()
+{
+    if (m_tls.handshaking()) {
+        int ret = m_tls.handshake();
+        if (ret < 0)
+            return false;
+        // 握手未完成, 由 process 根据握手需要重新注册读/写事件
+        if (ret == 0)
+            return true;
+        LOG_DEBUG("tls handshake done, ktls send %d", m_tls.ktls_send());
+    }
+
+    while (m_read_idx < READ_BUFFER_SIZE) {
+        int bytes_read = sock_recv(m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
+        if (bytes_read == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        else if (bytes_read == 0) {
+            return false;
+        }
+        m_read_idx += bytes_read;
+        if (0 == m_TRIGMode && m_tls.pending() == 0)
+            break;
+    }
+    return true;
+}
+
+int http_conn::sock_recv(char *buf, int len) {
+    int n = m_tls.active() ? m_tls.recv(buf, len) : recv(m_sockfd, buf, len, 0);
+    if (n > 0)
+        metrics::add(metrics::BYTES_IN, n);
+    return n;
+}
+
+int http_conn::sock_writev(const struct iovec *iv, int count) {
+    trace_span span(tracer::SPAN_WRITEV, m_sockfd, m_trace_id);
+    if (m_tls.active())
+        return m_tls.writev(iv, count);
+    return writev(m_sockfd, iv, count);
+}
+
 /* 解析http请求行, 获得请求方法、目标url及http版本号 */
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     /*
@@ -300,9 +420,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
 
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
+    // 当url为/时显示判断界面, 由路由表处理
     
     // 请求行处理完毕，将主状态机转移处理请求头
     m_check_state = CHECK_STATE_HEADER;
@@ -333,10 +451,9 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 */
     // 判断是空行还是请求头
     if (text[0] == '\0') {
-        if (m_content_length != 0) { // 是POST
+        if (m_content_length != 0 || m_chunked) { // 是POST
             /* POST 需要跳转到消息体处理状态 */
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
+            return begin_content();
         }
         return GET_REQUEST;
     }
@@ -355,6 +472,27 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         text += strspn(text, " \t");
         m_content_length = atol(text);
     }
+    else if (strncasecmp(text, "Transfer-Encoding:", 18) == 0) {
+        /* 解析消息体传输编码, 只支持 chunked */
+        text += 18;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "chunked") == 0)
+            m_chunked = true;
+        else if (strcasecmp(text, "identity") != 0)
+            return BAD_REQUEST;
+    }
+    else if (strncasecmp(text, "Upgrade:", 8) == 0) {
+        /* 请求升级到明文HTTP/2 */
+        text += 8;
+        text += strspn(text, " \t");
+        if (strstr(text, "h2c"))
+            m_h2c_upgrade = true;
+    }
+    else if (strncasecmp(text, "HTTP2-Settings:", 15) == 0) {
+        text += 15;
+        text += strspn(text, " \t");
+        m_h2_settings = text;
+    }
     else if (strncasecmp(text, "Host:", 5) == 0) {
         /* 解析请求头部HOST字段 */
         text += 5;
@@ -362,46 +500,94 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         m_host = text;
     }
     else {  // error
-        LOG_INFO("oop!unknow header: %s", text);
+        LOG_DEBUG("oop!unknow header: %s", text);
     }
 
     return NO_REQUEST;
 }
 
+/*
+    请求头解析完毕, 进入消息体处理状态
+    消息体会边收边从读缓冲区移走, 请求行中的 URL 指向读缓冲区, 需要先保存下来
+ */
+http_conn::HTTP_CODE http_conn::begin_content() {
+    if (m_content_length < 0)
+        return BAD_REQUEST;
+
+    strncpy(m_url_buf, m_url, FILENAME_LEN - 1);
+    m_url_buf[FILENAME_LEN - 1] = '\0';
+    m_url = m_url_buf;
+    m_version = 0;
+    m_host = 0;
+
+    // chunked 优先于 Content-Length
+    if (m_chunked)
+        m_body_reader.init_chunked(&m_body);
+    else
+        m_body_reader.init_length(m_content_length, &m_body);
+
+    m_check_state = CHECK_STATE_CONTENT;
+    return NO_REQUEST;
+}
+
 //判断http请求是否被完整读入
-http_conn::HTTP_CODE http_conn::parse_content(char *text) {
+http_conn::HTTP_CODE http_conn::parse_content() {
     /*
-        仅用于解析POST请求，调用parse_content函数解析消息体
-        用于保存post请求消息体，为后面的登录和注册做准备
+        仅用于解析POST请求
+        读缓冲区中已有的消息体交给 m_body_reader 解码, 片段存入 m_body, 然后清空读缓冲区继续接收
+        消息体较小时留在内存, 用于后面的登录和注册
     */
+    int consumed = 0;
+    body_reader::STATUS status = m_body_reader.feed(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx, &consumed);
+    m_checked_idx += consumed;
 
-    if (m_read_idx >= (m_content_length + m_checked_idx)){  // 判断buffer中是否读取了消息体
-        text[m_content_length] = '\0';
-        //POST请求中最后为输入的用户名和密码
-        m_string = text;
-        return GET_REQUEST; // 用来break 396 while
+    if (status == body_reader::BODY_BAD)
+        return BAD_REQUEST;
+
+    if (status == body_reader::BODY_DONE) {
+        //POST请求中最后为输入的用户名和密码, 溢出到文件的大消息体不会是表单
+        m_string = (char *)m_body.c_str();
+        return GET_REQUEST;
     }
+
+    // 消息体未收完, 已消费的数据不再需要, 腾出整个读缓冲区
+    m_read_idx = m_checked_idx = m_start_line = 0;
     return NO_REQUEST;
 }
 
 http_conn::HTTP_CODE http_conn::process_read()
 {
     /*  process_read通过while循环，将主从状态机进行封装，对报文的每一行进行循环处理  */
+    trace_span span(tracer::SPAN_PARSE, m_sockfd, m_trace_id);
 
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char *text = 0;
 
-    
-    while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK)) {
-        
+    while (true) {
+        if (m_check_state == CHECK_STATE_CONTENT) { //解析消息体
+            /*
+                这里认为GET和POST请求报文的区别之一是有无消息体部分，GET请求没有消息体，当解析完空行之后，便完成了报文的解析。
+
+                但后续的登录和注册功能，为了避免将用户名和密码直接暴露在URL中，我们在项目中改用了POST请求，将用户名和密码添加在报文中作为消息体进行了封装。
+                消息体不按行解析, 直接消费读缓冲区中剩余的数据
+             */  
+            ret = parse_content();
+            if (ret == GET_REQUEST)
+                return do_request();  //完整解析POST请求后，跳转到报文响应函数
+            return ret;
+        }
+
+        if ((line_status = parse_line()) != LINE_OK)
+            break;
+
         text = get_line();   // 取剩下的数据
         /*
             m_start_line是每一个数据行在m_read_buf中的起始位置
             m_checked_idx表示从状态机在m_read_buf中读取的位置
          */
         m_start_line = m_checked_idx;
-        LOG_INFO("%s", text);
+        LOG_DEBUG("%s", text);
         switch (m_check_state) {
             case CHECK_STATE_REQUESTLINE: { // 解析请求行
                 ret = parse_request_line(text); // 解析http请求行，获得请求方法，目标url及http版本号
@@ -414,23 +600,13 @@ http_conn::HTTP_CODE http_conn::process_read()
                 if (ret == BAD_REQUEST)
                     return BAD_REQUEST;
                 else if (ret == GET_REQUEST) {
+                    // 没有消息体的请求才能升级, 带消息体时忽略 Upgrade
+                    if (m_h2c_upgrade && m_h2_settings)
+                        return UPGRADE_REQUEST;
                     return do_request();   //完整解析GET请求后，跳转到报文响应函数
                 }
                 break;
             }
-            case CHECK_STATE_CONTENT: { //解析消息体
-            /*
-                这里认为GET和POST请求报文的区别之一是有无消息体部分，GET请求没有消息体，当解析完空行之后，便完成了报文的解析。
-
-                但后续的登录和注册功能，为了避免将用户名和密码直接暴露在URL中，我们在项目中改用了POST请求，将用户名和密码添加在报文中作为消息体进行了封装。
-             */  
-                ret = parse_content(text);
-                if (ret == GET_REQUEST)
-                    return do_request();  //完整解析POST请求后，跳转到报文响应函数
-                // 解析完消息体即完成报文解析，避免再次进入循环，更新line_status
-                line_status = LINE_OPEN;
-                break;
-            }
             default:
                 return INTERNAL_ERROR;
         }
@@ -438,117 +614,250 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
+/*
+    路由表: 新增接口在这里加一行即可
+    /2、/3 是表单提交的 2CGISQL.cgi、3CGISQL.cgi, 按前缀匹配
+ */
+const http_conn::http_router::route http_conn::routes[] = {
+    {"/",  http_conn::http_router::EXACT,  &http_conn::serve_page,  "/judge.html"},     // 判断界面
+    {"/0", http_conn::http_router::EXACT,  &http_conn::serve_page,  "/register.html"},  // 注册界面
+    {"/1", http_conn::http_router::EXACT,  &http_conn::serve_page,  "/log.html"},       // 登录界面
+    {"/2", http_conn::http_router::PREFIX, &http_conn::do_login,    NULL},              // 登录检测
+    {"/3", http_conn::http_router::PREFIX, &http_conn::do_register, NULL},              // 注册检测
+    {"/5", http_conn::http_router::EXACT,  &http_conn::serve_page,  "/picture.html"},   // 请求图片
+    {"/6", http_conn::http_router::EXACT,  &http_conn::serve_page,  "/video.html"},     // 请求视频
+    {"/7", http_conn::http_router::EXACT,  &http_conn::serve_page,  "/fans.html"},      // 关注我
+    {"/metrics", http_conn::http_router::EXACT, &http_conn::serve_metrics, NULL},       // 运行指标
+};
+
+/* C++11 局部静态变量的初始化是线程安全的, 第一次请求时编译路由表 */
+const http_conn::http_router &http_conn::get_router() {
+    static http_router instance(routes, sizeof(routes) / sizeof(routes[0]));
+    return instance;
+}
+
 http_conn::HTTP_CODE http_conn::do_request() {
-    /* 将初始化的m_real_file赋值为网站根目录 */
-    strcpy(m_real_file, doc_root); 
+    trace_span span(tracer::SPAN_HANDLER, m_sockfd, m_trace_id);
+    long long start = metrics::now_usec();
+    if (m_parse_start > 0) {
+        metrics::record(metrics::PHASE_PARSE, m_parse_usec + start - m_parse_start);
+        m_parse_start = 0;
+    }
 
-    int len = strlen(doc_root);
-    //printf("m_url:%s\n", m_url);
-    
-    // 找到m_url中/的位置
-    const char *p = strrchr(m_url, '/');
-
-    //处理cgi,  实现登录和注册校验
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3')) {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        if (*(p + 1) == '3') {
-            /* 
-                如果是注册，先检测数据库中是否有重名的
-                没有重名的，进行增加数据
-             */
+    const http_router::route *r = get_router().dispatch(m_url);
+    // 没有匹配的路由，直接将url与网站目录拼接,这里的情况是welcome界面，请求服务器上的一个图片
+    HTTP_CODE ret = r ? (this->*(r->handler))(r->target) : serve_page(NULL);
+    metrics::record(metrics::PHASE_HANDLER, metrics::now_usec() - start);
+    return ret;
+}
 
-            /* 拼接出数据库查询命令 */
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end()) {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(std::pair<std::string, std::string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2') {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
+http_conn::HTTP_CODE http_conn::serve_page(const char *target) {
+    /* 网站根目录 + 请求资源, 超长部分截断 */
+    snprintf(m_real_file, FILENAME_LEN, "%s%s", doc_root, target ? target : m_url);
+    return map_file();
+}
+
+bool http_conn::parse_user_form(char *name, char *password, int size) {
+    //将用户名和密码提取出来
+    //user=123&passwd=123
+    if (!m_string || strncmp(m_string, "user=", 5) != 0)
+        return false;
+
+    const char *p = m_string + 5;
+    int i = 0;
+    for (; *p && *p != '&' && i < size - 1; ++p, ++i)
+        name[i] = *p;
+    name[i] = '\0';
+
+    if (strncmp(p, "&passwd=", 8) != 0)
+        return false;
+
+    p += 8;
+    for (i = 0; *p && i < size - 1; ++p, ++i)
+        password[i] = *p;
+    password[i] = '\0';
+    return true;
+}
+
+//如果是登录，直接判断
+//若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
+http_conn::HTTP_CODE http_conn::do_login(const char *) {
+    if (cgi != 1)
+        return serve_page(NULL);
+
+    if (!parse_user_form(m_form_name, m_form_password, sizeof(m_form_name)))
+        return serve_page("/logError.html");
+
+    // 缓存未命中时挂起请求, 不占用工作线程等待数据库
+    if (can_suspend() && user_store::get_instance()->lookup(m_form_name, NULL) == user_store::MISS)
+        return query_user(SQL_LOGIN);
+
+    std::string stored;
+    if (find_user(m_form_name, &stored) && stored == m_form_password)
+        return serve_page("/welcome.html");
+    return serve_page("/logError.html");
+}
+
+bool http_conn::find_user(const char *name, std::string *password) {
+    user_store *store = user_store::get_instance();
+    std::string value;
+    int ret = store->lookup(name, &value);
+    if (ret == user_store::MISS) {
+        trace_span span(tracer::SPAN_DB, m_sockfd, m_trace_id);
+        long long start = metrics::now_usec();
+        int found = user_backend::get_instance()->find_user(name, &value);
+        metrics::record(metrics::PHASE_DB, metrics::now_usec() - start);
+        if (found < 0) {
+            LOG_ERROR("find user %s error", name);
+            return false;
         }
+        if (found)
+            store->put(name, value);
+        else
+            store->put_absent(name);
+        ret = found ? user_store::FOUND : user_store::ABSENT;
     }
 
-    if (*(p + 1) == '0') { // 如果请求资源为 /0，表示跳转注册界面
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-        free(m_url_real);
+    if (ret != user_store::FOUND)
+        return false;
+    if (password)
+        *password = value;
+    return true;
+}
+
+http_conn::HTTP_CODE http_conn::do_register(const char *) {
+    if (cgi != 1)
+        return serve_page(NULL);
+
+    if (!parse_user_form(m_form_name, m_form_password, sizeof(m_form_name)))
+        return serve_page("/registerError.html");
+
+    /* 
+        如果是注册，先检测数据库中是否有重名的
+        没有重名的，进行增加数据
+     */
+    if (can_suspend() && user_store::get_instance()->lookup(m_form_name, NULL) == user_store::MISS)
+        return query_user(SQL_REGISTER_CHECK);
+    if (find_user(m_form_name, NULL))
+        return serve_page("/registerError.html");
+    return insert_user();
+}
+
+http_conn::HTTP_CODE http_conn::insert_user() {
+    /* 预处理语句, 用户名和密码作为参数传给数据库, 不拼接进SQL */
+    m_sql_step = SQL_REGISTER;
+    m_sql.stmt = STMT_INSERT_USER;
+    m_sql.batch = true;     // 注册高峰时和其他注册合并提交
+    m_sql.params[0] = m_form_name;
+    m_sql.params[1] = m_form_password;
+
+    /* HTTP/2 的流不能挂起, 没有启用异步查询时也同步执行 */
+    if (!can_suspend()) {
+        trace_span span(tracer::SPAN_DB, m_sockfd, m_trace_id);
+        long long start = metrics::now_usec();
+        unsigned int err = user_backend::get_instance()->add_user(m_sql.params[0], m_sql.params[1]);
+        metrics::record(metrics::PHASE_DB, metrics::now_usec() - start);
+        return register_done(err);
     }
-    else if (*(p + 1) == '1') { // 如果请求资源为/1，表示跳转登录界面
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
+    /* 挂起请求, 由 process 提交查询, 不占用工作线程等待数据库 */
+    return SQL_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::register_done(unsigned int err) {
+    if (err) {
+        LOG_ERROR("INSERT error:%u", err);
+        return serve_page("/registerError.html");
     }
-    else if (*(p + 1) == '5') {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
+    // 覆盖注册前检查重名时留下的负缓存
+    user_store::get_instance()->put(m_form_name, m_form_password);
+    return serve_page("/log.html");
+}
+
+http_conn::HTTP_CODE http_conn::query_user(SQL_STEP step) {
+    m_sql_step = step;
+    m_sql.stmt = STMT_SELECT_USER;
+    m_sql.batch = false;
+    m_sql.params[0] = m_form_name;
+    return SQL_REQUEST;
+}
+
+/* 主线程: 和 find_user 一样回填缓存, 注册时没有重名则接着提交 INSERT */
+http_conn::HTTP_CODE http_conn::query_done() {
+    const char *error_page = m_sql_step == SQL_LOGIN ? "/logError.html" : "/registerError.html";
+    if (m_sql.err) {
+        LOG_ERROR("SELECT error:%u", m_sql.err);
+        return serve_page(error_page);
     }
-    else if (*(p + 1) == '6') {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
 
-        free(m_url_real);
+    user_store *store = user_store::get_instance();
+    if (m_sql.found)
+        store->put(m_form_name, m_sql.value);
+    else
+        store->put_absent(m_form_name);
+
+    if (m_sql_step == SQL_LOGIN) {
+        if (m_sql.found && m_sql.value == m_form_password)
+            return serve_page("/welcome.html");
+        return serve_page(error_page);
     }
-    else if (*(p + 1) == '7') {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    if (m_sql.found)
+        return serve_page(error_page);
+    return insert_user();
+}
+
+bool http_conn::can_suspend() const {
+    return !m_h2 && sql_async::get_instance()->enabled();
+}
+
+void http_conn::submit_sql() {
+    m_sql_pending = true;
+    m_sql_usec = metrics::now_usec();
+    if (tracer::on())
+        m_sql_tsc = tracer::ticks();
+    sql_async::get_instance()->submit(&m_sql);
+}
 
-        free(m_url_real);
+void http_conn::sql_done(sql_task *task) {
+    ((http_conn *)task->ctx)->resume_sql();
+}
+
+/* 主线程: 查询完成, 生成响应并注册写事件, 和 process 的后半段相同 */
+void http_conn::resume_sql() {
+    m_sql_pending = false;
+    metrics::record(metrics::PHASE_DB, metrics::now_usec() - m_sql_usec);
+    if (tracer::on())
+        tracer::async_span(tracer::SPAN_DB, m_sockfd, m_trace_id, m_sql_tsc, tracer::ticks());
+    if (m_sql.result) {
+        mysql_free_result(m_sql.result);
+        m_sql.result = NULL;
     }
-    else    // //如果以上均不符合，直接将url与网站目录拼接,这里的情况是welcome界面，请求服务器上的一个图片
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
+    HTTP_CODE ret;
+    if (m_sql.err == sql_async::TIMEOUT) {
+        LOG_ERROR("query for user %s timed out", m_form_name);
+        ret = INTERNAL_ERROR;
+    }
+    else if (m_sql_step == SQL_REGISTER) {
+        ret = register_done(m_sql.err);
+    }
+    else {
+        ret = query_done();
+        if (ret == SQL_REQUEST) {
+            submit_sql();
+            return;
+        }
+    }
+    if (!process_write(ret)) {
+        close_conn();
+        return;
+    }
+    m_ready_usec = metrics::now_usec();
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+}
+
+http_conn::HTTP_CODE http_conn::map_file() {
     if (stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
 
@@ -560,18 +869,68 @@ http_conn::HTTP_CODE http_conn::do_request() {
 
     //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
     int fd = open(m_real_file, O_RDONLY);
+    // kTLS 发送时文件内容由内核直接从页缓存加密发送(sendfile), 保留描述符, 不需要映射
+    if (!m_h2 && m_tls.ktls_send()) {
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
 
     //表示请求文件存在，且可以访问
     return FILE_REQUEST;
 }
+
+/*
+    动态响应: 记录生成函数, 实际内容在 write_chunked 中随着套接字可写逐步生成
+ */
+http_conn::HTTP_CODE http_conn::serve_dynamic(producer gen, const char *content_type) {
+    m_producer = gen;
+    m_content_type = content_type;
+    return DYNAMIC_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::serve_metrics(const char *) {
+    return serve_dynamic(&http_conn::produce_metrics, "text/plain; version=0.0.4");
+}
+
+/* 抓取时才汇总各线程的计数, 内容只有几 KB, 一次生成 */
+bool http_conn::produce_metrics(chunk_writer &writer) {
+    std::string text;
+    metrics::get_instance()->render(text);
+    writer.append(text.data(), text.size());
+    return false;
+}
+
 void http_conn::unmap()
 {
     if (m_file_address) {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if (m_file_fd >= 0) {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+}
+
+void http_conn::request_done() {
+    metrics::add_status(m_status);
+    if (m_request_usec > 0)
+        metrics::record(metrics::PHASE_RESPONSE, metrics::now_usec() - m_request_usec);
+    if (m_access_start > 0)
+        access_log::get_instance()->write(m_access_start, method_names[m_method], m_url ? m_url : "-", m_address,
+                                          m_status, bytes_have_send);
+    m_access_start = -1;
+}
+
+void http_conn::count_sent(int bytes) {
+    if (bytes_have_send == 0 && m_ready_usec > 0) {
+        metrics::record(metrics::PHASE_FIRST_WRITE, metrics::now_usec() - m_ready_usec);
+        m_ready_usec = 0;
+    }
+    bytes_have_send += bytes;
+    metrics::add(metrics::BYTES_OUT, bytes);
 }
 
 bool http_conn::write()
@@ -582,16 +941,38 @@ bool http_conn::write()
  */
     int temp = 0;
 
+    /* TLS 握手因套接字写满中断, 可写后继续握手 */
+    if (m_tls.handshaking()) {
+        int ret = m_tls.handshake();
+        if (ret < 0)
+            return false;
+        modfd(m_epollfd, m_sockfd, (ret == 0 && m_tls.want_write()) ? EPOLLOUT : EPOLLIN, m_TRIGMode);
+        return true;
+    }
+
+    if (m_h2)
+        return write_h2();
+
+    /* 动态响应, 边生成边发送 */
+    if (m_producer)
+        return write_chunked();
+
     /* 若要发送的数据长度为0, 表示响应报文为空，一般不会出现这种情况 */
     if (bytes_to_send == 0) {
+        request_done();
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         init();
         return true;
     }
 
     while (1) {
-        // 将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        // 将响应报文的状态行、消息头、空行和响应正文发送给浏览器端; kTLS 下响应头发完后用 sendfile 发送文件
+        if (m_file_fd >= 0 && m_iv[0].iov_len == 0) {
+            trace_span span(tracer::SPAN_SENDFILE, m_sockfd, m_trace_id);
+            temp = m_tls.sendfile(m_file_fd, bytes_have_send - m_write_idx, bytes_to_send);
+        }
+        else
+            temp = sock_writev(m_iv, m_iv_count);
 
         if (temp < 0) {
             if (errno == EAGAIN) {
@@ -603,20 +984,23 @@ bool http_conn::write()
         }
 
         // 正常发送，temp为发送的字节数
-        bytes_have_send += temp; // 更新已发送字节
+        count_sent(temp); // 更新已发送字节
         bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len) {
+        if (bytes_have_send >= m_write_idx) {
             m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+            if (m_file_address) {
+                m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+                m_iv[1].iov_len = bytes_to_send;
+            }
         }
         else {
             m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            m_iv[0].iov_len = m_write_idx - bytes_have_send;
         }
 
         if (bytes_to_send <= 0) {
             unmap();
+            request_done();
             modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
 
             if (m_linger) {
@@ -629,6 +1013,49 @@ bool http_conn::write()
         }
     }
 }
+/*
+    chunked 响应的发送:
+    待发送的块低于水位时调用生成函数补充内容, 然后用 writev 把响应头和已生成的块一起发出,
+    套接字写满时注册 EPOLLOUT 等下次可写再继续
+ */
+bool http_conn::write_chunked()
+{
+    while (1) {
+        while (!m_chunks.finished() && m_chunks.pending() < chunk_writer::HIGH_WATER) {
+            if (!(this->*m_producer)(m_chunks))
+                m_chunks.finish();
+        }
+
+        struct iovec iv[chunk_writer::MAX_IOV];
+        int count = m_chunks.gather(iv, chunk_writer::MAX_IOV);
+        int temp = count > 0 ? sock_writev(iv, count) : 0;
+        if (temp < 0) {
+            if (errno == EAGAIN) {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                return true;
+            }
+            m_chunks.clear();
+            return false;
+        }
+        m_chunks.consume(temp);
+        count_sent(temp);
+
+        if (m_chunks.finished() && m_chunks.empty()) {
+            m_chunks.clear();
+            request_done();
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+
+            if (m_linger) {
+                init();
+                return true;
+            }
+            else {
+                return false;
+            }
+        }
+    }
+}
+
 bool http_conn::add_response(const char *format, ...) {
     if (m_write_idx >= WRITE_BUFFER_SIZE) // //如果写入内容超出m_write_buf大小则报错
         return false;
@@ -649,13 +1076,14 @@ bool http_conn::add_response(const char *format, ...) {
     // 清空可变参列表
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
+    LOG_DEBUG("request:%s", m_write_buf);
 
     return true;
 }
 
 /* 添加状态行 */
 bool http_conn::add_status_line(int status, const char *title) {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -670,9 +1098,14 @@ bool http_conn::add_content_length(int content_len) {
     return add_response("Content-Length:%d\r\n", content_len);
 }
 
-/* 添加文本类型，这里是html */
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+/* 添加文本类型，默认是html */
+bool http_conn::add_content_type(const char *type) {
+    return add_response("Content-Type:%s\r\n", type);
+}
+
+/* 动态响应不知道总长度, 用chunked编码代替Content-Length */
+bool http_conn::add_transfer_encoding() {
+    return add_response("Transfer-Encoding:%s\r\n", "chunked");
 }
 
 /* 添加连接状态，通知浏览器端是保持连接还是关闭 */
@@ -727,6 +1160,9 @@ bool http_conn::process_write(HTTP_CODE ret)
                 m_iv[1].iov_base = m_file_address;
                 m_iv[1].iov_len = m_file_stat.st_size;
                 m_iv_count = 2;
+                // kTLS: 文件没有映射, writev 只发响应头, 文件内容由 write 用 sendfile 发送
+                if (m_file_fd >= 0)
+                    m_iv_count = 1;
                 // 发送的全部数据为响应报文头部信息和文件大小
                 bytes_to_send = m_write_idx + m_file_stat.st_size;
                 return true;
@@ -737,6 +1173,14 @@ bool http_conn::process_write(HTTP_CODE ret)
                 if (!add_content(ok_string))
                     return false;
             }
+            break;
+        }
+        case DYNAMIC_REQUEST: { // 动态内容，200，响应头随第一块一起发送
+            if (!(add_status_line(200, ok_200_title) && add_content_type(m_content_type) &&
+                  add_transfer_encoding() && add_linger() && add_blank_line()))
+                return false;
+            m_chunks.set_head(m_write_buf, m_write_idx);
+            return true;
         }
         default:
             return false;
@@ -754,16 +1198,260 @@ void http_conn::process() {
      *  主状态机负责对该行数据进行解析，
      *  主状态机内部调用从状态机，从状态机驱动主状态机
      */
+    if (m_tls.handshaking()) {
+        modfd(m_epollfd, m_sockfd, m_tls.want_write() ? EPOLLOUT : EPOLLIN, m_TRIGMode);
+        return;
+    }
+
+    if (!m_h2) {
+        int preface = h2_preface();
+        if (preface < 0) {
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+            return;
+        }
+        if (preface > 0) {
+            m_h2 = new h2_session(h2_request, this);
+            m_h2->start();
+        }
+    }
+    if (m_h2) {
+        process_h2();
+        return;
+    }
+
+    // 请求的第一段数据到达, 决定这个请求是否记录访问日志
+    if (0 == m_access_start)
+        m_access_start = access_log::get_instance()->begin();
+
+    long long now = metrics::now_usec();
+    if (m_accept_usec > 0) {
+        metrics::record(metrics::PHASE_CONNECT, now - m_accept_usec);
+        m_accept_usec = 0;
+    }
+    if (0 == m_request_usec)
+        m_request_usec = now;
+    m_parse_start = now;
+
     HTTP_CODE read_ret = process_read();
+    // TLS 会话中可能还有已解密的数据, 它们不会再触发可读事件
+    while (read_ret == NO_REQUEST && m_tls.pending() > 0 && m_read_idx < READ_BUFFER_SIZE) {
+        if (!read_tls()) {
+            close_conn();
+            return;
+        }
+        read_ret = process_read();
+    }
     if (read_ret == NO_REQUEST) {
+        // 请求还不完整, 解析时间累计到下一次
+        m_parse_usec += metrics::now_usec() - m_parse_start;
+        m_parse_start = 0;
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
         return;
     }
+    if (read_ret == UPGRADE_REQUEST) {
+        start_h2c_upgrade();
+        if (m_h2)
+            return;
+        read_ret = do_request();
+    }
+    /*
+        请求挂起等待数据库: 不注册任何事件, 提交是本线程最后一次访问该连接,
+        之后由主线程在查询完成时调用 resume_sql
+     */
+    if (read_ret == SQL_REQUEST) {
+        submit_sql();
+        return;
+    }
     // 调用process_write完成报文响应
     bool write_ret = process_write(read_ret);
     if (!write_ret) {
         close_conn();
     }
+    m_ready_usec = metrics::now_usec();
     // 注册并监听写事件
     modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
 }
+
+/*
+    HTTP/2 客户端连接序言 PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n
+    只在连接的第一个请求开头检查, 此时读缓冲区里还没有解析过的数据
+ */
+int http_conn::h2_preface() {
+    static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    static const int len = sizeof(preface) - 1;
+
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_checked_idx != 0 || m_read_idx == 0)
+        return 0;
+    int n = m_read_idx < len ? m_read_idx : len;
+    if (memcmp(m_read_buf, preface, n) != 0)
+        return 0;
+    return n < len ? -1 : 1;
+}
+
+void http_conn::start_h2c_upgrade() {
+    m_h2 = new h2_session(h2_request, this);
+    if (!m_h2->start_upgrade(m_h2_settings, m_method == POST ? "POST" : "GET", m_url)) {
+        // HTTP2-Settings 非法, 按HTTP/1.1继续处理
+        delete m_h2;
+        m_h2 = NULL;
+        return;
+    }
+    LOG_DEBUG("%s", "upgrade to h2c");
+
+    // 请求之后已经收到的数据属于HTTP/2连接序言
+    m_h2->buffer(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+    m_read_idx = m_checked_idx = m_start_line = 0;
+    h2_rearm(m_h2->process());
+}
+
+void http_conn::process_h2() {
+    // 以 prior knowledge 开始时, 连接序言还在读缓冲区中
+    if (m_read_idx > 0) {
+        m_h2->buffer(m_read_buf, m_read_idx);
+        m_read_idx = m_checked_idx = m_start_line = 0;
+    }
+    // TLS 会话中剩余的明文不会再触发可读事件
+    if (m_tls.pending() > 0 && !read_h2()) {
+        close_conn();
+        return;
+    }
+    h2_rearm(m_h2->process());
+}
+
+void http_conn::h2_rearm(bool ok) {
+    if (m_h2->want_write()) {
+        modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+        return;
+    }
+    if (!ok || m_h2->closing()) {
+        close_conn();
+        return;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+}
+
+/* HTTP/2 帧可能比 m_read_buf 大, 收到的数据直接交给会话缓存 */
+bool http_conn::read_h2() {
+    char buf[4096];
+    while (true) {
+        int bytes_read = sock_recv(buf, sizeof(buf));
+        if (bytes_read == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            return false;
+        }
+        else if (bytes_read == 0) {
+            return false;
+        }
+        // 接收缓冲区超限, 会话已排队 GOAWAY, 不再读取
+        if (!m_h2->buffer(buf, bytes_read))
+            return true;
+        // LT模式只读一次, TLS 会话中已解密的数据要读完
+        if (0 == m_TRIGMode && m_tls.pending() == 0)
+            return true;
+    }
+}
+
+bool http_conn::write_h2() {
+    while (true) {
+        const char *data;
+        int len = m_h2->output(&data);
+        if (len == 0)
+            break;
+
+        struct iovec iv;
+        iv.iov_base = (void *)data;
+        iv.iov_len = len;
+        int temp = sock_writev(&iv, 1);
+        if (temp < 0) {
+            if (errno == EAGAIN) {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                return true;
+            }
+            return false;
+        }
+        m_h2->consume(temp);
+        count_sent(temp);
+    }
+    if (m_h2->closing())
+        return false;
+    modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
+    return true;
+}
+
+void http_conn::h2_request(void *ctx, h2_stream *stream) {
+    ((http_conn *)ctx)->handle_h2_stream(stream);
+}
+
+/*
+    HTTP/2 流上的请求: 把请求行和消息体换成流上的内容, 然后走和HTTP/1.1相同的 do_request,
+    再把结果(mmap的文件、动态内容或错误页)交给流, 由会话的帧调度器发送
+ */
+void http_conn::handle_h2_stream(h2_stream *stream) {
+    long long access_start = access_log::get_instance()->begin();
+    strncpy(m_url_buf, stream->path.c_str(), FILENAME_LEN - 1);
+    m_url_buf[FILENAME_LEN - 1] = '\0';
+    m_url = m_url_buf;
+    m_file_address = 0;
+    m_producer = NULL;
+    m_string = 0;
+    cgi = 0;
+
+    HTTP_CODE ret = BAD_REQUEST;
+    if (stream->method == "GET") {
+        m_method = GET;
+        if (m_url[0] == '/')
+            ret = do_request();
+    }
+    else if (stream->method == "POST") {
+        m_method = POST;
+        cgi = 1;
+        m_string = (char *)stream->body.c_str();
+        if (m_url[0] == '/')
+            ret = do_request();
+    }
+
+    switch (ret) {
+        case FILE_REQUEST: {
+            stream->status = 200;
+            if (m_file_stat.st_size != 0) {
+                // mmap 的文件交给流, 发送完毕后由流 munmap
+                stream->map_addr = m_file_address;
+                stream->map_len = m_file_stat.st_size;
+                m_file_address = 0;
+            }
+            else {
+                stream->data = "<html><body></body></html>";
+            }
+            break;
+        }
+        case DYNAMIC_REQUEST: {
+            // 帧调度器本身就是分段发送的, 直接生成全部内容
+            stream->status = 200;
+            stream->content_type = m_content_type;
+            m_chunks.clear();
+            while ((this->*m_producer)(m_chunks))
+                ;
+            m_chunks.drain(stream->data);
+            m_producer = NULL;
+            break;
+        }
+        case FORBIDDEN_REQUEST:
+            stream->status = 403;
+            stream->data = error_403_form;
+            break;
+        case BAD_REQUEST:
+        case NO_RESOURCE:
+            stream->status = 404;
+            stream->data = error_404_form;
+            break;
+        default:
+            stream->status = 500;
+            stream->data = error_500_form;
+            break;
+    }
+    metrics::add_status(stream->status);
+    // 流上的响应由帧调度器发送, 这里只记录处理耗时和响应体长度
+    access_log::get_instance()->write(access_start, stream->method.c_str(), stream->path.c_str(), m_address,
+                                      stream->status, stream->resp_len());
+}
@@ -20,13 +20,27 @@
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <atomic>
 
 #include "locker.h"
 #include "sql_connection_pool.h"
 #include "lst_timer.h"
 #include "log.h"
+#include "access_log.h"
+#include "metrics.h"
+#include "trace.h"
+#include "router.h"
+#include "body_reader.h"
+#include "chunk_writer.h"
+#include "h2_session.h"
+#include "tls_conn.h"
+#include "sql_async.h"
+#include "user_store.h"
+#include "user_backend.h"
 
 class http_conn {
+    friend struct http_bench;  // 微基准直接驱动解析状态机, 见 bench/micro_bench.cpp
+
 public:
     static const int FILENAME_LEN = 256;        // 要读取文件的路径 + 名称 m_read_file 长度
     static const int READ_BUFFER_SIZE = 256;    // 读缓冲区大小 m_read_buf 大小
@@ -52,9 +66,23 @@ public:
         NO_RESOURCE,          // 请求资源不存在, 跳转process_write完成响应报文
         FORBIDDEN_REQUEST,    // 请求资源禁止访问，没有读取权限, 跳转process_write完成响应报文
         FILE_REQUEST,         // 请求资源可以正常访问, 跳转process_write完成响应报文
+        DYNAMIC_REQUEST,      // 动态生成的响应, 由 m_producer 以chunked编码边生成边发送
+        UPGRADE_REQUEST,      // 请求通过 Upgrade: h2c 切换到HTTP/2
+        SQL_REQUEST,          // 请求挂起等待异步查询, 完成后由 sql_done 继续处理
         INTERNAL_ERROR,       // 服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
         CLOSED_CONNECTION
     };
+    enum SQL_STEP {  // 挂起的请求在等哪一步异步查询
+        SQL_LOGIN,            // 登录: 缓存未命中, 查密码
+        SQL_REGISTER_CHECK,   // 注册: 缓存未命中, 检查重名
+        SQL_REGISTER          // 注册: INSERT
+    };
+
+    /* 路由处理函数, 参数为路由表中配置的 target */
+    typedef HTTP_CODE (http_conn::*route_handler)(const char *target);
+    typedef router<route_handler> http_router;
+    /* 动态响应生成函数, 每次调用向 writer 写入一部分内容, 返回false表示已生成完毕 */
+    typedef bool (http_conn::*producer)(chunk_writer &writer);
 
 public:
     /* 初始化套接字地址, 函数内部会调用私有方法 init() */
@@ -72,11 +100,20 @@ public:
     sockaddr_in *get_address() {
         return &m_address;
     }
+    int get_sockfd() const {
+        return m_sockfd;
+    }
+    /* 追踪用的请求编号, 请求开始时分配, 响应发送完毕后清零 */
+    uint32_t trace_id() {
+        if (0 == m_trace_id)
+            m_trace_id = tracer::next_id();
+        return m_trace_id;
+    }
     /* 
-        同步线程初始化数据库读取表 
-        将数据库中已有的user信息读取到本地map中
+        初始化用户缓存, 不再在启动时读取全部用户;
+        hot_file 非空时由后台线程按其中的用户名预热
     */
-    void initmysql_result(connection_pool *connPool);
+    void init_user_cache(size_t cache_bytes, std::string hot_file, int close_log);
     int timer_flag;
     int improv;
     
@@ -91,11 +128,69 @@ private:
     HTTP_CODE parse_request_line(char *text);
     // 主状态机解析报文中的请求头数据
     HTTP_CODE parse_headers(char *text);
-    // 主状态机解析报文中的请求内容
-    HTTP_CODE parse_content(char *text);
+    // 请求头解析完毕, 准备接收消息体
+    HTTP_CODE begin_content();
+    // 主状态机解析报文中的请求内容, 增量消费读缓冲区中的消息体
+    HTTP_CODE parse_content();
     
-    // 生成响应报文
+    // 生成响应报文, 通过路由表分发到下面的处理函数
     HTTP_CODE do_request();
+    // 返回静态页面 target, 为NULL时直接使用 m_url
+    HTTP_CODE serve_page(const char *target);
+    // 登录校验 /2
+    HTTP_CODE do_login(const char *target);
+    // 注册校验 /3
+    HTTP_CODE do_register(const char *target);
+    // 注册: 写入 m_form_name/m_form_password, 可以挂起时返回 SQL_REQUEST
+    HTTP_CODE insert_user();
+    // 注册的 INSERT 执行完毕, err 为存储后端的错误码
+    HTTP_CODE register_done(unsigned int err);
+    // 缓存未命中, 挂起请求异步查询 m_form_name 的密码
+    HTTP_CODE query_user(SQL_STEP step);
+    // 异步查询用户完成, 回填缓存后继续登录或注册
+    HTTP_CODE query_done();
+    // 请求可以挂起等待异步查询: 不是 HTTP/2 的流, 且启用了异步查询
+    bool can_suspend() const;
+    // 提交 m_sql, 请求挂起
+    void submit_sql();
+    // 异步查询完成的回调, 在主线程中继续处理挂起的请求
+    static void sql_done(sql_task *task);
+    void resume_sql();
+    // 从POST消息体 user=xxx&passwd=xxx 中取出用户名和密码
+    bool parse_user_form(char *name, char *password, int size);
+    /* 查用户缓存, 未命中时查存储后端并回填 */
+    bool find_user(const char *name, std::string *password);
+    // 检查 m_real_file 并 mmap 到内存
+    HTTP_CODE map_file();
+    // 以chunked编码返回由 gen 动态生成的内容
+    HTTP_CODE serve_dynamic(producer gen, const char *content_type);
+    // 运行指标 /metrics
+    HTTP_CODE serve_metrics(const char *target);
+    bool produce_metrics(chunk_writer &writer);
+    // 生成并发送chunked响应
+    bool write_chunked();
+
+    /* HTTP/2: 检查读缓冲区开头是否为连接序言, 1 是, 0 不是, -1 还不完整 */
+    int h2_preface();
+    // 处理 Upgrade: h2c 请求
+    void start_h2c_upgrade();
+    // 处理HTTP/2连接上收到的帧
+    void process_h2();
+    // 根据会话状态重新注册读/写事件
+    void h2_rearm(bool ok);
+    bool read_h2();
+    bool write_h2();
+    /* TLS: 推进握手并把解密后的数据读入 m_read_buf */
+    bool read_tls();
+    // 明文连接直接调用 recv/writev, TLS 连接经过 m_tls 加解密, 返回值约定相同
+    int sock_recv(char *buf, int len);
+    int sock_writev(const struct iovec *iv, int count);
+    // 会话的请求处理函数, 复用HTTP/1.1的路由和处理函数
+    static void h2_request(void *ctx, h2_stream *stream);
+    void handle_h2_stream(h2_stream *stream);
+    // 全局路由表
+    static const http_router &get_router();
+    static const http_router::route routes[];
 
     /*
         * m_start_line 是已经解析的字符
@@ -113,22 +208,28 @@ private:
     LINE_STATUS parse_line();
     
     void unmap();
+    // 响应发送完毕: 按状态码计数, 被采样的请求写一条访问日志
+    void request_done();
+    // 写出 bytes 字节后更新计数, 第一次写出时记录 PHASE_FIRST_WRITE
+    void count_sent(int bytes);
 
     // 根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
     bool add_response(const char *format, ...);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
     bool add_headers(int content_length);
-    bool add_content_type();
+    bool add_content_type(const char *type = "text/html");
+    bool add_transfer_encoding();
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
 
 public:
     static int m_epollfd;  
-    static int m_user_count;  // 建立的TCP连接数量
-    MYSQL *mysql;
+    static std::atomic<int> m_user_count;  // 建立的TCP连接数量, 主线程和工作线程都会修改
     int m_state;  //读为0, 写为1
+    long long m_enqueue_usec;  // 放入线程池请求队列的时间
+    uint64_t m_enqueue_tsc;    // 同上, 开启追踪时记录(tracer::ticks)
 
 private:
     int m_sockfd;  // epoll例程
@@ -163,20 +264,50 @@ private:
     char *m_url;              // 请求行 - URL
     char *m_version;          // 请求行 - HTTP 1.1
     char *m_host;             // 服务器域名
+    bool m_h2c_upgrade;       // Upgrade: h2c
+    char *m_h2_settings;      // HTTP2-Settings
     int m_content_length;     // 请求头部内容长度
+    bool m_chunked;           // Transfer-Encoding: chunked
     bool m_linger;            // 长连接 / 短链接
 
     char *m_file_address;     // 读取服务器上的文件地址
+    int m_file_fd = -1;       // kTLS 时保留的文件描述符, 文件内容用 sendfile 发送
     struct stat m_file_stat;
     struct iovec m_iv[2];     // io向量机制iovec
     int m_iv_count;
     int cgi;                  // 是否启用的POST
     char *m_string;           // 存储请求头数据   账号 & 密码
+    char m_url_buf[FILENAME_LEN];  // 接收消息体前保存的 URL, 之后读缓冲区会被复用
+    request_body m_body;      // 消息体, 超过阈值溢出到临时文件
+    body_reader m_body_reader;  // 消息体增量解析
     int bytes_to_send;        // 剩余发送字节数
     int bytes_have_send;      // 已发送字节数
+    int m_status;             // 响应状态码
+    long long m_access_start; // 访问日志: 请求开始的时间(微秒), 0 还没开始, -1 不记录
+
+    /* 各阶段的起点(metrics::now_usec), 0 表示没有要记录的阶段 */
+    long long m_accept_usec;  // 接受连接, 记录 PHASE_CONNECT 后清零
+    long long m_request_usec; // 请求的第一段数据开始处理
+    long long m_parse_start;  // 本次 process_read 开始
+    long long m_parse_usec;   // 之前几次 process_read 用掉的时间
+    long long m_sql_usec;     // 提交异步查询
+    long long m_ready_usec;   // 响应就绪
+    uint32_t m_trace_id;      // 追踪: 当前请求的编号, 0 还没分配
+    uint64_t m_sql_tsc;       // 追踪: 提交异步查询
+    chunk_writer m_chunks;    // 动态响应的chunked写入器
+    producer m_producer;      // 动态响应生成函数, NULL 表示普通响应
+    const char *m_content_type;  // 动态响应的内容类型
     char *doc_root;
 
-    std::map<std::string, std::string> m_users;
+    h2_session *m_h2 = NULL;  // HTTP/2 会话, NULL 表示HTTP/1.1
+    tls_conn m_tls;           // TLS 会话, 未启用TLS时不生效
+
+    sql_task m_sql;           // 挂起请求的异步查询
+    bool m_sql_pending;       // 请求正在等待 m_sql 完成
+    SQL_STEP m_sql_step;      // m_sql 完成后继续哪一步
+    char m_form_name[100];    // 登录/注册表单中的用户, 挂起期间保留
+    char m_form_password[100];
+
     int m_TRIGMode; // LT / ET
     int m_close_log;
 
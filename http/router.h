@@ -0,0 +1,117 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string.h>
+#include <exception>
+#include <vector>
+
+/*************************************************************
+ * 路由表
+ *
+ * 启动时将 精确路由(EXACT) 和 前缀路由(PREFIX) 编译成一张 trie 状态转移表:
+ *   - 只为路由中出现过的字符分配字母表编号, 其余字符编号为0, 表示无转移
+ *   - 每个节点一行, 每行 (字母表大小 + 1) 个 int, 存下一个节点的下标
+ *   - 节点上记录以该节点结尾的精确路由和前缀路由
+ *
+ * dispatch 沿 URL 逐字节查表, O(路径长度), 不分配内存;
+ * 精确匹配优先, 否则返回走过的最长前缀路由。
+ * 新增接口只需要在路由数组中加一行, 不用再写 else if
+ **************************************************************/
+template <typename Handler>
+class router {
+public:
+    enum MATCH {
+        EXACT = 0,  // 整个路径完全相同
+        PREFIX      // 路径以 path 开头
+    };
+    struct route {
+        const char *path;     // 路由路径, 以 / 开头
+        MATCH match;          // 匹配方式
+        Handler handler;      // 处理函数
+        const char *target;   // 传给处理函数的参数, 如静态页面路径
+    };
+
+public:
+    router(const route *routes, int count);
+
+    /* 查找 path 对应的路由, 遇到 '?' 或 '\0' 结束; 没有匹配返回 NULL */
+    const route *dispatch(const char *path) const;
+
+private:
+    int child(int node, unsigned char c) const {
+        int cls = m_class[c];
+        if (cls == 0) return -1;
+        return m_next[node * m_width + cls];
+    }
+    int new_node();
+
+private:
+    const route *m_routes;
+    unsigned char m_class[256];  // 字符 -> 字母表编号, 0 表示不在任何路由中出现
+    int m_width;                 // 每个节点的转移数, 字母表大小 + 1
+    std::vector<int> m_next;     // 状态转移表, -1 表示无转移
+    std::vector<int> m_exact;    // 节点上的精确路由下标, -1 表示无
+    std::vector<int> m_prefix;   // 节点上的前缀路由下标, -1 表示无
+};
+
+template <typename Handler>
+router<Handler>::router(const route *routes, int count) : m_routes(routes) {
+    /* 先统计字母表, 确定每个节点的宽度 */
+    memset(m_class, 0, sizeof(m_class));
+    int classes = 0;
+    for (int i = 0; i < count; ++i) {
+        for (const unsigned char *p = (const unsigned char *)routes[i].path; *p; ++p) {
+            if (m_class[*p] == 0) {
+                if (classes == 255) throw std::exception();
+                m_class[*p] = ++classes;
+            }
+        }
+    }
+    m_width = classes + 1;
+
+    /* 再逐条插入 trie */
+    new_node();
+    for (int i = 0; i < count; ++i) {
+        int node = 0;
+        for (const unsigned char *p = (const unsigned char *)routes[i].path; *p; ++p) {
+            int next = child(node, *p);
+            if (next < 0) {
+                next = new_node();
+                m_next[node * m_width + m_class[*p]] = next;
+            }
+            node = next;
+        }
+        if (routes[i].match == EXACT)
+            m_exact[node] = i;
+        else
+            m_prefix[node] = i;
+    }
+}
+
+template <typename Handler>
+int router<Handler>::new_node() {
+    int node = m_exact.size();
+    m_next.resize(m_next.size() + m_width, -1);
+    m_exact.push_back(-1);
+    m_prefix.push_back(-1);
+    return node;
+}
+
+template <typename Handler>
+const typename router<Handler>::route *router<Handler>::dispatch(const char *path) const {
+    int node = 0;
+    int best = m_prefix[0];
+    const unsigned char *p = (const unsigned char *)path;
+    for (; *p && *p != '?'; ++p) {
+        node = child(node, *p);
+        if (node < 0)
+            return best < 0 ? NULL : &m_routes[best];
+        if (m_prefix[node] >= 0)
+            best = m_prefix[node];
+    }
+    if (m_exact[node] >= 0)
+        return &m_routes[m_exact[node]];
+    return best < 0 ? NULL : &m_routes[best];
+}
+
+#endif  // ROUTER_H
@@ -0,0 +1,252 @@
+#include <errno.h>
+#include <string.h>
+#include <openssl/err.h>
+#include "tls_conn.h"
+
+/* ALPN 服务端偏好顺序 */
+static const unsigned char alpn_protos[] = "\x02h2\x08http/1.1";
+
+static int select_alpn(SSL *, const unsigned char **out, unsigned char *outlen,
+                       const unsigned char *in, unsigned int inlen, void *) {
+    unsigned char *selected;
+    if (SSL_select_next_proto(&selected, outlen, alpn_protos, sizeof(alpn_protos) - 1,
+                              in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+tls_context::tls_context() : m_ctx(NULL) {
+}
+
+tls_context::~tls_context() {
+    if (m_ctx)
+        SSL_CTX_free(m_ctx);
+}
+
+tls_context *tls_context::get_instance() {
+    static tls_context instance;
+    return &instance;
+}
+
+bool tls_context::init(const char *cert_file, const char *key_file) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx)
+        return false;
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+#ifdef SSL_OP_ENABLE_KTLS
+    // 内核或 OpenSSL 不支持时握手照常完成, 只是继续在用户态加解密
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+    /*
+        非阻塞写可能只写出一部分, 重试时缓冲区地址会变(见 tls_conn::writev);
+        空闲连接释放读写缓冲区, 大量长连接时节省内存
+     */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+
+    /* 会话复用: 服务端缓存 + session ticket, ticket 密钥由 OpenSSL 随机生成 */
+    static const unsigned char sid_ctx[] = "tinywebserver";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT);
+    SSL_CTX_set_num_tickets(ctx, SESSION_TICKETS);
+
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        SSL_CTX_free(ctx);
+        return false;
+    }
+
+    if (m_ctx)
+        SSL_CTX_free(m_ctx);
+    m_ctx = ctx;
+    return true;
+}
+
+tls_conn::tls_conn() : m_ssl(NULL), m_established(false), m_want_write(false), m_ktls_send(false) {
+}
+
+tls_conn::~tls_conn() {
+    reset();
+}
+
+/* 只释放会话, 不再写套接字 */
+void tls_conn::reset() {
+    if (m_ssl) {
+        SSL_free(m_ssl);
+        m_ssl = NULL;
+    }
+    m_established = false;
+    m_want_write = false;
+    m_ktls_send = false;
+}
+
+bool tls_conn::open(int fd) {
+    /*
+        上一个使用该描述符的连接可能由定时器直接关闭, 没有经过 close;
+        此时描述符已属于新连接, 不能再发送 close_notify
+     */
+    reset();
+
+    m_ssl = SSL_new(tls_context::get_instance()->ctx());
+    if (!m_ssl)
+        return false;
+    if (SSL_set_fd(m_ssl, fd) != 1) {
+        SSL_free(m_ssl);
+        m_ssl = NULL;
+        return false;
+    }
+    SSL_set_accept_state(m_ssl);
+    return true;
+}
+
+void tls_conn::close() {
+    if (m_ssl) {
+        // 套接字是非阻塞的, close_notify 尽力发送, 不等对端回应
+        if (m_established)
+            SSL_shutdown(m_ssl);
+    }
+    reset();
+}
+
+/* 把 SSL_get_error 转换成 recv/writev 的约定 */
+int tls_conn::fail(int ret) {
+    int err = SSL_get_error(m_ssl, ret);
+    switch (err) {
+        case SSL_ERROR_WANT_READ:
+            m_want_write = false;
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_WANT_WRITE:
+            m_want_write = true;
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            // 对端发送了 close_notify
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            // errno 由底层系统调用设置, 对端直接断开时为0
+            if (errno == 0)
+                errno = ECONNRESET;
+            return -1;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+int tls_conn::handshake() {
+    if (m_established)
+        return 1;
+
+    ERR_clear_error();
+    int ret = SSL_do_handshake(m_ssl);
+    if (ret != 1) {
+        if (fail(ret) < 0 && errno == EAGAIN)
+            return 0;
+        return -1;
+    }
+
+    m_established = true;
+    m_want_write = false;
+#ifdef BIO_get_ktls_send
+    m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl)) > 0;
+#endif
+    return 1;
+}
+
+int tls_conn::recv(char *buf, int len) {
+    size_t n = 0;
+    ERR_clear_error();
+    int ret = SSL_read_ex(m_ssl, buf, len, &n);
+    if (ret != 1)
+        return fail(ret);
+    m_want_write = false;
+    return (int)n;
+}
+
+int tls_conn::writev(const struct iovec *iv, int count) {
+    char buf[RECORD_SIZE];
+    int total = 0;
+    int i = 0;
+    size_t off = 0;  // iv[i] 中已写出的字节数
+
+    while (i < count) {
+        if (off >= iv[i].iov_len) {
+            ++i;
+            off = 0;
+            continue;
+        }
+
+        const char *data;
+        size_t len;
+        if (iv[i].iov_len - off >= (size_t)RECORD_SIZE) {
+            // 足够一整条记录, 直接加密, 不拷贝
+            data = (const char *)iv[i].iov_base + off;
+            len = iv[i].iov_len - off;
+        }
+        else {
+            /*
+                从当前位置起拼满一条记录;
+                没写出时下次调用从同样的位置拼出同样的内容, 满足 OpenSSL 的重试要求
+             */
+            len = 0;
+            size_t o = off;
+            for (int j = i; j < count && len < (size_t)RECORD_SIZE; ++j, o = 0) {
+                size_t n = iv[j].iov_len - o;
+                if (n > RECORD_SIZE - len)
+                    n = RECORD_SIZE - len;
+                memcpy(buf + len, (const char *)iv[j].iov_base + o, n);
+                len += n;
+            }
+            data = buf;
+        }
+
+        size_t written = 0;
+        ERR_clear_error();
+        int ret = SSL_write_ex(m_ssl, data, len, &written);
+        if (ret != 1) {
+            if (total > 0)
+                return total;
+            return fail(ret);
+        }
+        m_want_write = false;
+        total += written;
+
+        /* 推进到下一段未写出的数据 */
+        while (written > 0 && i < count) {
+            size_t n = iv[i].iov_len - off;
+            if (written < n) {
+                off += written;
+                break;
+            }
+            written -= n;
+            ++i;
+            off = 0;
+        }
+    }
+    return total;
+}
+
+long tls_conn::sendfile(int fd, off_t offset, size_t len) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    ERR_clear_error();
+    ossl_ssize_t ret = SSL_sendfile(m_ssl, fd, offset, len, 0);
+    if (ret >= 0)
+        return (long)ret;
+    // SSL_sendfile 直接返回系统调用的结果, errno 已设置
+    if (errno == EAGAIN)
+        m_want_write = true;
+    return -1;
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
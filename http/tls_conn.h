@@ -0,0 +1,88 @@
+#ifndef TLS_CONN_H
+#define TLS_CONN_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <openssl/ssl.h>
+
+/*************************************************************
+ * TLS 全局配置
+ * 所有连接共用一个 SSL_CTX:
+ *   - 服务端会话缓存和 session ticket, 客户端重连时跳过完整握手
+ *   - 内核支持时开启 kTLS, 握手完成后加解密交给内核, 静态文件可以直接 sendfile
+ *   - ALPN 协商 h2 / http/1.1, 连接走哪个协议仍由客户端是否发送 HTTP/2 连接序言决定
+ **************************************************************/
+class tls_context {
+public:
+    static const int SESSION_CACHE_SIZE = 20480;  // 服务端会话缓存条数
+    static const int SESSION_TIMEOUT = 1800;      // 会话有效期(秒)
+    static const int SESSION_TICKETS = 2;         // TLS1.3 握手后下发的 ticket 数
+
+public:
+    static tls_context *get_instance();
+
+    /* 加载证书和私钥, 失败返回false */
+    bool init(const char *cert_file, const char *key_file);
+    bool enabled() const { return m_ctx != NULL; }
+    SSL_CTX *ctx() const { return m_ctx; }
+
+private:
+    tls_context();
+    ~tls_context();
+
+private:
+    SSL_CTX *m_ctx;
+};
+
+/*************************************************************
+ * 一条连接上的 TLS 会话
+ *
+ * 读写接口与 recv/writev 保持一致: 返回字节数, 出错返回-1,
+ * 需要等待套接字可读或可写时 errno 为 EAGAIN, 调用方原有的
+ * 非阻塞处理逻辑不需要改动
+ **************************************************************/
+class tls_conn {
+public:
+    static const int RECORD_SIZE = 16384;  // TLS 记录的最大明文长度
+
+public:
+    tls_conn();
+    ~tls_conn();
+
+    /* 在已接受的套接字上创建会话, 等待客户端握手 */
+    bool open(int fd);
+    /* 发送 close_notify 并释放会话 */
+    void close();
+
+    /* 是否启用了TLS */
+    bool active() const { return m_ssl != NULL; }
+    /* 握手是否还未完成 */
+    bool handshaking() const { return m_ssl != NULL && !m_established; }
+    /* 上一次操作因为套接字不可写而中断, 应等待 EPOLLOUT */
+    bool want_write() const { return m_want_write; }
+    /* 会话中已解密但还没读出的明文字节数 */
+    int pending() const { return m_ssl ? SSL_pending(m_ssl) : 0; }
+    /* 发送方向是否已交给内核(kTLS) */
+    bool ktls_send() const { return m_ktls_send; }
+
+    /* 推进握手, 1 完成, 0 需要等待套接字, -1 失败 */
+    int handshake();
+
+    int recv(char *buf, int len);
+    /* 相邻的小块合并成一条记录再加密, 避免响应头单独占一条记录 */
+    int writev(const struct iovec *iv, int count);
+    /* kTLS 发送方向已启用时由内核直接加密发送文件内容 */
+    long sendfile(int fd, off_t offset, size_t len);
+
+private:
+    void reset();
+    int fail(int ret);
+
+private:
+    SSL *m_ssl;
+    bool m_established;
+    bool m_want_write;
+    bool m_ktls_send;
+};
+
+#endif  // TLS_CONN_H
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include "user_store.h"
+
+user_store::user_store() : m_capacity(0) {
+    for (int i = 0; i < SHARD_COUNT; ++i) {
+        m_shards[i].index = NULL;
+        m_shards[i].mask = 0;
+        m_shards[i].entries = NULL;
+        m_shards[i].capacity = 0;
+        m_shards[i].count = 0;
+        m_shards[i].hand = 0;
+    }
+}
+
+user_store::~user_store() {
+    for (int i = 0; i < SHARD_COUNT; ++i) {
+        delete[] m_shards[i].index;
+        delete[] m_shards[i].entries;
+    }
+}
+
+user_store *user_store::get_instance() {
+    static user_store store;
+    return &store;
+}
+
+void user_store::init(size_t budget) {
+    /* 每个条目另外占两个索引位置, 装载因子不超过 1/2 */
+    size_t per_entry = sizeof(entry) + 2 * sizeof(std::atomic<int32_t>);
+    int per_shard = budget / per_entry / SHARD_COUNT;
+    if (per_shard < 16)
+        per_shard = 16;
+
+    uint32_t index_len = 1;
+    while (index_len < (uint32_t)per_shard * 2)
+        index_len <<= 1;
+
+    for (int i = 0; i < SHARD_COUNT; ++i) {
+        shard &s = m_shards[i];
+        s.index = new std::atomic<int32_t>[index_len];
+        for (uint32_t j = 0; j < index_len; ++j)
+            s.index[j].store(-1, std::memory_order_relaxed);
+        s.mask = index_len - 1;
+        s.entries = new entry[per_shard];
+        for (int j = 0; j < per_shard; ++j) {
+            s.entries[j].seq.store(0, std::memory_order_relaxed);
+            s.entries[j].ref.store(0, std::memory_order_relaxed);
+        }
+        s.capacity = per_shard;
+        s.count = 0;
+        s.hand = 0;
+    }
+    m_capacity = (size_t)per_shard * SHARD_COUNT;
+}
+
+/* FNV-1a, 高位选分片, 低位选索引位置 */
+uint64_t user_store::hash(std::string_view name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < name.size(); ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+bool user_store::match(const entry &e, uint64_t h, std::string_view name) {
+    return e.hash == h && e.name_len == name.size() && memcmp(e.data, name.data(), name.size()) == 0;
+}
+
+user_store::LOOKUP user_store::lookup(std::string_view name, std::string *password) const {
+    uint64_t h = hash(name);
+    const shard &s = shard_of(h);
+    if (!s.index)
+        return MISS;
+
+    for (uint32_t i = h & s.mask, n = 0; n <= s.mask; i = (i + 1) & s.mask, ++n) {
+        int32_t id = s.index[i].load(std::memory_order_acquire);
+        if (id < 0)
+            return MISS;
+
+        const entry &e = s.entries[id];
+        uint32_t seq = e.seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            return MISS;
+        if (!match(e, h, name))
+            continue;
+
+        bool absent = e.absent;
+        time_t expire = e.expire;
+        if (e.name_len + e.password_len > DATA_LEN)
+            return MISS;
+        if (!absent && password)
+            password->assign(e.data + e.name_len, e.password_len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // 读的过程中条目被改写或淘汰, 交给慢路径
+        if (e.seq.load(std::memory_order_relaxed) != seq)
+            return MISS;
+
+        if (absent && time(NULL) >= expire)
+            return MISS;
+        if (!e.ref.load(std::memory_order_relaxed))
+            e.ref.store(1, std::memory_order_relaxed);
+        return absent ? ABSENT : FOUND;
+    }
+    return MISS;
+}
+
+bool user_store::put(std::string_view name, std::string_view password) {
+    return store(name, password, false);
+}
+
+bool user_store::put_absent(std::string_view name) {
+    return store(name, std::string_view(), true);
+}
+
+bool user_store::store(std::string_view name, std::string_view password, bool absent) {
+    if (name.size() + password.size() > (size_t)DATA_LEN || name.size() > 255 || password.size() > 255)
+        return false;
+
+    uint64_t h = hash(name);
+    shard &s = shard_of(h);
+    if (!s.index)
+        return false;
+
+    s.lock.lock();
+    int pos = locate(s, h, name);
+    if (pos >= 0) {
+        // 已有的条目原地改写, 下标不变
+        entry &e = s.entries[s.index[pos].load(std::memory_order_relaxed)];
+        write(e, h, name, password, absent);
+        s.lock.unlock();
+        return true;
+    }
+
+    int id = s.count < s.capacity ? s.count++ : evict(s);
+    write(s.entries[id], h, name, password, absent);
+
+    uint32_t i = h & s.mask;
+    while (s.index[i].load(std::memory_order_relaxed) >= 0)
+        i = (i + 1) & s.mask;
+    s.index[i].store(id, std::memory_order_release);
+    s.lock.unlock();
+    return true;
+}
+
+int user_store::locate(const shard &s, uint64_t h, std::string_view name) const {
+    for (uint32_t i = h & s.mask;; i = (i + 1) & s.mask) {
+        int32_t id = s.index[i].load(std::memory_order_relaxed);
+        if (id < 0)
+            return -1;
+        if (match(s.entries[id], h, name))
+            return i;
+    }
+}
+
+/* 扫过的条目清除访问位, 第一个访问位已清除的被淘汰; 最多转两圈 */
+int user_store::evict(shard &s) {
+    while (true) {
+        int id = s.hand;
+        s.hand = (s.hand + 1) % s.capacity;
+        entry &e = s.entries[id];
+        if (e.ref.load(std::memory_order_relaxed)) {
+            e.ref.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        unlink(s, id);
+        return id;
+    }
+}
+
+/* 从索引中删除, 后面同一探测链上的下标往前移, 不留墓碑 */
+void user_store::unlink(shard &s, int id) {
+    uint32_t i = s.entries[id].hash & s.mask;
+    while (s.index[i].load(std::memory_order_relaxed) != id)
+        i = (i + 1) & s.mask;
+
+    uint32_t j = i;
+    while (true) {
+        j = (j + 1) & s.mask;
+        int32_t next = s.index[j].load(std::memory_order_relaxed);
+        if (next < 0)
+            break;
+        // next 的理想位置 k 不在 (i, j] 之间时可以前移到 i
+        uint32_t k = s.entries[next].hash & s.mask;
+        bool movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+        if (movable) {
+            s.index[i].store(next, std::memory_order_release);
+            i = j;
+        }
+    }
+    s.index[i].store(-1, std::memory_order_release);
+}
+
+void user_store::write(entry &e, uint64_t h, std::string_view name, std::string_view password, bool absent) {
+    uint32_t seq = e.seq.load(std::memory_order_relaxed);
+    e.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    e.hash = h;
+    e.absent = absent;
+    e.expire = absent ? time(NULL) + ABSENT_TTL : 0;
+    e.name_len = name.size();
+    e.password_len = password.size();
+    memcpy(e.data, name.data(), name.size());
+    memcpy(e.data + name.size(), password.data(), password.size());
+    e.ref.store(1, std::memory_order_relaxed);
+
+    e.seq.store(seq + 2, std::memory_order_release);
+}
+
+bool user_store::save(const char *path) const {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return false;
+
+    for (int i = 0; i < SHARD_COUNT; ++i) {
+        const shard &s = m_shards[i];
+        s.lock.lock();
+        for (int j = 0; j < s.count; ++j) {
+            const entry &e = s.entries[j];
+            if (!e.absent)
+                fprintf(fp, "%.*s\n", (int)e.name_len, e.data);
+        }
+        s.lock.unlock();
+    }
+    return fclose(fp) == 0;
+}
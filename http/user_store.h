@@ -0,0 +1,98 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include "locker.h"
+
+/*************************************************************
+ * 用户名 -> 密码 的缓存, 读多写少, 内存有上限
+ *
+ *   - 启动时为空, 未命中时由调用者查库后用 put / put_absent 回填;
+ *     数据库里没有的用户也缓存一段时间(负缓存), 挡住反复查不存在的用户
+ *   - 按用户名哈希分成 SHARD_COUNT 个分片, 写入只锁所在分片;
+ *     每个分片的条目数组和索引在 init 时按内存预算一次分配, 之后不再增长
+ *   - 条目满了以后按 CLOCK 淘汰: 命中时置访问位, 指针扫过时清除,
+ *     扫到访问位已清除的条目就淘汰它
+ *   - 读不加锁: 条目带版本号(seqlock), 读完版本号变了就当作未命中;
+ *     读者碰上淘汰或改写, 最多多查一次数据库
+ **************************************************************/
+class user_store {
+public:
+    static const int SHARD_BITS = 6;
+    static const int SHARD_COUNT = 1 << SHARD_BITS;
+    static const int DATA_LEN = 232;       // 用户名 + 密码的最大长度, 条目共 256 字节
+    static const int ABSENT_TTL = 30;      // 负缓存的有效期(秒)
+    static const size_t DEFAULT_BUDGET = 64 << 20;
+
+    enum LOOKUP {
+        MISS = -1,   // 缓存中没有, 需要查库
+        ABSENT = 0,  // 数据库中没有这个用户
+        FOUND = 1
+    };
+
+public:
+    user_store();
+    ~user_store();
+
+    static user_store *get_instance();
+
+    /* 按内存预算(字节)分配条目, 必须在使用前调用一次 */
+    void init(size_t budget);
+
+    /* 任意线程并发调用, 不加锁; FOUND 时取出密码 */
+    LOOKUP lookup(std::string_view name, std::string *password) const;
+
+    /* 回填查库结果或新注册的用户, 覆盖同名的负缓存; 过长的不缓存 */
+    bool put(std::string_view name, std::string_view password);
+    bool put_absent(std::string_view name);
+
+    /* 最多缓存的条目数 */
+    size_t capacity() const { return m_capacity; }
+
+    /* 把缓存中的用户名逐行写入文件, 下次启动时用来预热 */
+    bool save(const char *path) const;
+
+private:
+    struct entry {
+        std::atomic<uint32_t> seq;   // 奇数表示正在修改
+        mutable std::atomic<uint8_t> ref;  // CLOCK 访问位
+        uint8_t absent;
+        uint8_t name_len;
+        uint8_t password_len;
+        uint64_t hash;
+        time_t expire;               // 负缓存的过期时刻
+        char data[DATA_LEN];         // 用户名后面接着密码
+    };
+    /* 独占缓存行, 不同分片的写互不干扰 */
+    struct alignas(64) shard {
+        std::atomic<int32_t> *index; // 开放寻址, 存条目下标, -1 表示空
+        uint32_t mask;               // 索引长度 - 1
+        entry *entries;
+        int capacity;
+        int count;                   // 以下成员只在持有 lock 时访问
+        int hand;                    // CLOCK 指针
+        mutable locker lock;
+    };
+
+    static uint64_t hash(std::string_view name);
+    static bool match(const entry &e, uint64_t h, std::string_view name);
+    const shard &shard_of(uint64_t h) const { return m_shards[h >> (64 - SHARD_BITS)]; }
+    shard &shard_of(uint64_t h) { return m_shards[h >> (64 - SHARD_BITS)]; }
+
+    bool store(std::string_view name, std::string_view password, bool absent);
+    /* 以下在持有分片锁时调用 */
+    int locate(const shard &s, uint64_t h, std::string_view name) const;
+    int evict(shard &s);
+    void unlink(shard &s, int id);
+    void write(entry &e, uint64_t h, std::string_view name, std::string_view password, bool absent);
+
+private:
+    shard m_shards[SHARD_COUNT];
+    size_t m_capacity;
+};
+
+#endif  // USER_STORE_H
@@ -0,0 +1,205 @@
+#ifndef LF_QUEUE_H
+#define LF_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <utility>
+
+/*************************************************************
+ * 有界无锁队列
+ *
+ *   - 环形数组, 每个槽带一个序号(Vyukov): 生产者 CAS 抢到位置后写入数据,
+ *     再发布序号; 消费者看到序号就绪才读取. 入队出队都不加锁
+ *   - MultiConsumer 为 false 时是多生产者单消费者(mpsc_queue), 出队不需要 CAS
+ *   - 元素只移动不拷贝, 可以放 unique_ptr 之类的类型
+ *   - try_push / try_pop 从不阻塞; pop 在队列为空时用 futex 睡眠,
+ *     只有确实有消费者在睡眠时生产者才多一次 futex 系统调用
+ *   - close 之后 push 失败, pop 取完剩余元素后返回 false
+ **************************************************************/
+template <typename T, bool MultiConsumer = true>
+class lf_queue {
+public:
+    static const int SPIN = 16;  // pop 睡眠前重试的次数
+
+public:
+    /* 容量向上取整到2的幂 */
+    explicit lf_queue(size_t capacity);
+    ~lf_queue();
+
+    lf_queue(const lf_queue &) = delete;
+    lf_queue &operator=(const lf_queue &) = delete;
+
+    /* 队列满或已关闭时返回 false, value 不变 */
+    bool try_push(T &&value);
+    bool try_pop(T &value);
+    /* 最多取出 n 个, 返回实际个数, 不阻塞 */
+    size_t pop_n(T *values, size_t n);
+    /* 队列为空时睡眠等待, 关闭且取空后返回 false */
+    bool pop(T &value);
+
+    /* 唤醒所有等待的消费者 */
+    void close();
+    bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+    /* 并发修改时只是近似值 */
+    size_t size() const;
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct alignas(64) cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    void wake(int count);
+
+private:
+    cell *m_cells;
+    size_t m_mask;
+    /* 入队和出队位置放在不同的缓存行 */
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<uint32_t> m_event;   // futex 字: 有新元素时加一
+    std::atomic<int> m_waiters;                  // 正在睡眠或准备睡眠的消费者数
+    std::atomic<bool> m_closed;
+};
+
+template <typename T>
+using mpmc_queue = lf_queue<T, true>;
+template <typename T>
+using mpsc_queue = lf_queue<T, false>;
+
+template <typename T, bool MultiConsumer>
+lf_queue<T, MultiConsumer>::lf_queue(size_t capacity) : m_tail(0), m_head(0), m_event(0), m_waiters(0), m_closed(false) {
+    size_t n = 2;
+    while (n < capacity)
+        n <<= 1;
+    m_cells = new cell[n];
+    for (size_t i = 0; i < n; ++i)
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    m_mask = n - 1;
+}
+
+template <typename T, bool MultiConsumer>
+lf_queue<T, MultiConsumer>::~lf_queue() {
+    delete[] m_cells;
+}
+
+template <typename T, bool MultiConsumer>
+bool lf_queue<T, MultiConsumer>::try_push(T &&value) {
+    if (m_closed.load(std::memory_order_relaxed))
+        return false;
+
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    cell *c;
+    while (true) {
+        c = &m_cells[pos & m_mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;  // 满了
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+    c->data = std::move(value);
+    c->seq.store(pos + 1, std::memory_order_release);
+
+    // 和 pop 中的 m_waiters 增加配对, 保证不会漏掉唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed) > 0)
+        wake(1);
+    return true;
+}
+
+template <typename T, bool MultiConsumer>
+bool lf_queue<T, MultiConsumer>::try_pop(T &value) {
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    cell *c;
+    while (true) {
+        c = &m_cells[pos & m_mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (!MultiConsumer) {
+                m_head.store(pos + 1, std::memory_order_relaxed);
+                break;
+            }
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;  // 空
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    value = std::move(c->data);
+    c->seq.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T, bool MultiConsumer>
+size_t lf_queue<T, MultiConsumer>::pop_n(T *values, size_t n) {
+    size_t i = 0;
+    while (i < n && try_pop(values[i]))
+        ++i;
+    return i;
+}
+
+template <typename T, bool MultiConsumer>
+bool lf_queue<T, MultiConsumer>::pop(T &value) {
+    while (true) {
+        /* 先让出几次 CPU 再睡眠, 生产者连续入队时不必每个元素都走一次 futex */
+        for (int i = 0; i < SPIN; ++i) {
+            if (try_pop(value))
+                return true;
+            sched_yield();
+        }
+        uint32_t key = m_event.load(std::memory_order_acquire);
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // 登记之后再查一次, 登记之前入队的元素在这里能看到
+        if (try_pop(value)) {
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (closed()) {
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+            return try_pop(value);
+        }
+        // key 已经变化时立即返回
+        syscall(SYS_futex, &m_event, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+template <typename T, bool MultiConsumer>
+void lf_queue<T, MultiConsumer>::close() {
+    m_closed.store(true, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wake(INT_MAX);
+}
+
+template <typename T, bool MultiConsumer>
+void lf_queue<T, MultiConsumer>::wake(int count) {
+    m_event.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &m_event, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+template <typename T, bool MultiConsumer>
+size_t lf_queue<T, MultiConsumer>::size() const {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t head = m_head.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif  // LF_QUEUE_H
@@ -22,6 +22,9 @@ public:
     bool post() {  // 信号量 V
         return sem_post(&m_sem) == 0;
     }
+    bool trywait() {  // 非阻塞 P, 信号量为0时立即返回false
+        return sem_trywait(&m_sem) == 0;
+    }
 
 private:
     sem_t m_sem; // 信号量
@@ -0,0 +1,135 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "access_log.h"
+
+namespace {
+
+thread_local unsigned int t_seq = 0;   // 本线程开始过的请求数, 用于采样
+
+long long now_usec() {
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+}  // namespace
+
+access_log *access_log::get_instance() {
+    static access_log instance;
+    return &instance;
+}
+
+void *access_log::flush_thread(void *) {
+    return access_log::get_instance()->run();
+}
+
+access_log::access_log()
+    : m_sample(0), m_binary(false), m_started(false), m_fp(NULL), m_file_buf(NULL), m_dropped(0), m_dropped_total(0),
+      m_stop(false) {
+    m_clock.sec = -1;
+}
+
+access_log::~access_log() {
+    if (m_started) {
+        m_stop = true;
+        pthread_join(m_tid, NULL);
+    }
+    if (m_fp)
+        fclose(m_fp);
+    delete[] m_file_buf;
+}
+
+bool access_log::init(const char *file_name, int sample, bool binary) {
+    if (sample <= 0)
+        return true;
+
+    m_fp = fopen(file_name, "a");
+    if (!m_fp)
+        return false;
+    m_binary = binary;
+    m_file_buf = new char[FILE_BUF_SIZE];
+    setvbuf(m_fp, m_file_buf, _IOFBF, FILE_BUF_SIZE);
+    if (m_binary)
+        fwrite(ACCESS_MAGIC, 1, strlen(ACCESS_MAGIC), m_fp);
+
+    if (pthread_create(&m_tid, NULL, flush_thread, NULL) != 0)
+        return false;
+    m_started = true;
+    // 后台线程就绪后才开始采样
+    m_sample = sample;
+    return true;
+}
+
+long long access_log::begin() {
+    if (m_sample <= 0 || ++t_seq % m_sample != 0)
+        return -1;
+    return now_usec();
+}
+
+void access_log::write(long long start, const char *method, const char *path, const sockaddr_in &addr, int status,
+                       unsigned long long bytes) {
+    if (start < 0 || !m_started)
+        return;
+    long long latency = now_usec() - start;
+
+    log_ring *ring = m_rings.local();
+    access_record *rec = (access_record *)ring->reserve(sizeof(access_record));
+    if (!rec) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_dropped_total.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t path_len = path ? strnlen(path, 0xffff) : 0;
+    rec->status = status;
+    rec->path_len = path_len;
+    rec->addr = addr.sin_addr.s_addr;
+    rec->port = ntohs(addr.sin_port);
+    rec->reserved = 0;
+    rec->start = start;
+    rec->bytes = bytes;
+    rec->latency = latency < 0 ? 0 : latency > 0xffffffffLL ? 0xffffffffu : latency;
+    rec->reserved2 = 0;
+    strncpy(rec->method, method ? method : "-", sizeof(rec->method));
+    // 缓冲区里是之前的记录, 路径之后的部分清零, 二进制日志中不留旧内容
+    size_t copy = path_len < sizeof(rec->path) ? path_len : sizeof(rec->path);
+    if (copy > 0)
+        memcpy(rec->path, path, copy);
+    memset(rec->path + copy, 0, sizeof(rec->path) - copy);
+    ring->commit();
+}
+
+void *access_log::run() {
+    while (!m_stop.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            /* 空闲时才把缓冲的内容交给内核, 负载高时攒满 FILE_BUF_SIZE 再写 */
+            fflush(m_fp);
+            usleep(IDLE_USEC);
+        }
+    }
+    drain();
+    fflush(m_fp);
+    return NULL;
+}
+
+size_t access_log::drain() {
+    size_t total = m_rings.drain([this](const char *rec) {
+        write_record((const access_record *)rec);
+        return (size_t)1;
+    });
+
+    // 二进制文件只有定长记录, 丢弃数只在文本中注明
+    long long dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0 && !m_binary)
+        fprintf(m_fp, "# access ring full, dropped %lld records\n", dropped);
+    return total;
+}
+
+void access_log::write_record(const access_record *rec) {
+    if (m_binary) {
+        fwrite_unlocked(rec, 1, sizeof(access_record), m_fp);
+        return;
+    }
+    int n = access_format_record(rec, m_line, sizeof(m_line), &m_clock);
+    fwrite_unlocked(m_line, 1, n, m_fp);
+}
@@ -0,0 +1,69 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <atomic>
+#include <vector>
+#include "locker.h"
+#include "log_ring.h"
+#include "log_format.h"
+
+/*************************************************************
+ * 访问日志
+ *
+ * 和运行日志分开, 每个请求一条定长的 access_record(见 log_format.h):
+ *   - 采样: sample 为 N 时每个线程每 N 个请求记录一个, 0 关闭;
+ *     没被采样的请求连时间都不取
+ *   - 写入方式和异步运行日志相同: 每个线程一个 log_ring, 不加锁;
+ *     后台线程攒成大块写入文件, 缓冲区满时丢弃并计数
+ *   - binary 为 true 时原样写入记录, 用 log_decode 查看
+ * 文件不切分.
+ **************************************************************/
+class access_log {
+public:
+    static const int IDLE_USEC = 1000;         // 后台线程没有记录可写时的休眠时间
+    static const int FILE_BUF_SIZE = 1 << 20;  // 文件的写缓冲
+
+public:
+    static access_log *get_instance();
+    static void *flush_thread(void *args);
+
+    bool init(const char *file_name, int sample, bool binary);
+
+    /* 请求开始时调用: 这个请求被采样时返回当前时间(微秒), 否则返回 -1 */
+    long long begin();
+    /* 请求结束时调用, start 为 begin 的返回值 */
+    void write(long long start, const char *method, const char *path, const sockaddr_in &addr, int status,
+               unsigned long long bytes);
+
+    /* 缓冲区满时丢弃的记录总数 */
+    long long dropped() const { return m_dropped_total.load(std::memory_order_relaxed); }
+
+private:
+    access_log();
+    ~access_log();
+
+    void *run();
+    /* 取出所有缓冲区中的记录写入文件, 返回条数 */
+    size_t drain();
+    void write_record(const access_record *rec);
+
+private:
+    int m_sample;
+    bool m_binary;
+    bool m_started;
+    FILE *m_fp;
+    char *m_file_buf;
+    char m_line[256];                        // 后台线程格式化一行的缓冲区
+    log_clock m_clock;
+
+    log_ring_set<access_log> m_rings;        // 各线程的缓冲区
+    std::atomic<long long> m_dropped;        // 还没写进文件的丢弃数
+    std::atomic<long long> m_dropped_total;
+    std::atomic<bool> m_stop;
+    pthread_t m_tid;
+};
+
+#endif  // ACCESS_LOG_H
@@ -1,50 +1,80 @@
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <stdarg.h>
 #include <pthread.h>
+#include <string>
 #include "log.h"
 
+namespace {
+
+thread_local log_clock t_clock = {-1, {0}, 0};
+thread_local std::string t_line;   // 同步模式下格式化一行日志的缓冲区
+
+}  // namespace
+
+std::atomic<int> Log::m_level(0);
+
+Log* Log::get_instance() {
+    static Log instance;
+    return &instance;
+}
+
+void* Log::flush_log_thread(void* args) {
+    return Log::get_instance()->async_write_log();
+}
+
 Log::Log() {
     m_count = 0;
     m_is_async = false;
+    m_fp = NULL;
+    m_path[0] = '\0';
+    m_file_buf = NULL;
+    m_binary = false;
+    m_clock.sec = -1;
+    m_line = NULL;
+    m_dropped = 0;
+    m_dropped_total = 0;
+    m_stop = false;
+    dir_name[0] = '\0';
+    log_name[0] = '\0';
 }
 
 Log::~Log() {
+    if (m_is_async) {
+        m_stop = true;
+        pthread_join(m_tid, NULL);
+    }
     if(m_fp != NULL) {
         fclose(m_fp);
     }
+    m_rotator.stop();
+    delete[] m_file_buf;
+    delete[] m_line;
 }
 
-bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size) {
+bool Log::init(const char *file_name, int close_log, int log_buf_size, int split_lines, int max_queue_size, bool binary,
+               bool compress) {
 /*
  *  通过单例模式获取唯一的日志类，调用init方法，初始化生成日志文件，
  *  服务器启动按当前时刻创建日志，前缀为时间，后缀为自定义log文件名，并记录创建日志的时间day和行数count。
 
- *  异步需要设置阻塞队列的长度，同步不需要设置
- *  写入方式通过初始化时是否设置队列大小（表示在队列中可以放几条数据）来判断，若队列大小为0，则为同步，否则为异步。
+ *  写入方式通过初始化时是否设置队列大小来判断，若队列大小为0，则为同步，否则为异步。
+ *  异步模式下每个线程的缓冲区固定为 log_ring::SIZE 字节, max_queue_size 只用来选择模式
+ *  二进制日志只能异步写入, binary 为 true 时忽略 max_queue_size
+ *  compress 为 true 时切分下来的文件在后台压缩成 .gz
  */
-    // 如果设置了max_queue_size, 则设置异步
-    if(max_queue_size >= 1) {
-        m_is_async = true; // 异步写入
-        m_log_queue = new block_queue<std::string>(max_queue_size);  // 创建并设置阻塞队列长度
-        pthread_t tid;
-        /* 创建用于写日志到文件的线程 */
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
-    }
-
     m_close_log = close_log;
 
-    /* 输出内容的长度 */
+    /* 一行日志的最大长度 */
     m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
 
     m_split_lines = split_lines;
 
     time_t t = time(NULL);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
     const char *p = strrchr(file_name, '/'); // 从后往前找到第一个/的位置
     char log_full_name[256] = {0};
@@ -53,7 +83,7 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
         若输入的文件名没有/，则直接将时间+文件名作为日志名
     */
     if (p == NULL) {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
     } else {
         /*
             将/的位置向后移动一个位置，然后复制到logname中
@@ -62,130 +92,233 @@ bool Log::init(const char *file_name, int close_log, int log_buf_size, int split
          */
         strcpy(log_name, p + 1);
         strncpy(dir_name, file_name, p - file_name + 1);
-
-        /* 后面的参数跟format有关 */
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+        dir_name[p - file_name + 1] = '\0';
     }
+    make_path(log_full_name, sizeof(log_full_name), my_tm, 0);
 
     m_today = my_tm.tm_mday;
-    
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL) {
+
+    // 如果设置了max_queue_size, 则设置异步
+    if(max_queue_size >= 1 || binary) {
+        m_is_async = true;
+        m_binary = binary;
+        m_file_buf = new char[FILE_BUF_SIZE];
+        m_line = new char[m_log_buf_size + 64];
+    }
+
+    m_rotator.start(compress);
+    if (!open_file(log_full_name)) {
+        m_is_async = false;
         return false;
     }
 
+    if (m_is_async) {
+        /* 创建用于写日志到文件的线程 */
+        if (pthread_create(&m_tid, NULL, flush_log_thread, NULL) != 0) {
+            m_is_async = false;
+            return false;
+        }
+    }
+
     return true;
 }
 
-void* Log:: async_write_log() {
-    std::string single_log;
-    // 从阻塞队列中取出一个日志string，写入文件
-    while (m_log_queue->pop(single_log)) {
-        m_mutex.lock();
-        fputs(single_log.c_str(), m_fp);
-        m_mutex.unlock();
+void* Log::async_write_log() {
+    while (!m_stop.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            /* 没有新日志时才把缓冲的内容交给内核, 负载高时攒满 FILE_BUF_SIZE 再写 */
+            if (m_fp)
+                fflush(m_fp);
+            usleep(IDLE_USEC);
+        }
     }
+    drain();
+    if (m_fp)
+        fflush(m_fp);
+    return NULL;
 }
 
-void Log::write_log(int level, const char *format, ...) {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
-
-    /* 日志分级 */
-    switch (level)  {
-        case 0:
-            strcpy(s, "[debug]:");
-            break;
-        case 1:
-            strcpy(s, "[info]:");
-            break;
-        case 2:
-            strcpy(s, "[warn]:");
-            break;
-        case 3:
-            strcpy(s, "[erro]:");
-            break;
-        default:
-            strcpy(s, "[info]:");
-            break;
-    }
+size_t Log::drain() {
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
-    /* 写 Log */
-    m_mutex.lock();
-    ++m_count;  // 更新现有行数
+    size_t total = m_rings.drain([&](const char *rec) {
+        write_record((const log_record *)rec, my_tm);
+        return (size_t)((const log_record *)rec)->size;
+    });
 
+    long long dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        static const char *format = "log ring full, dropped %lld lines";
+        alignas(8) char buf[sizeof(log_record) + 16];
+        log_record *rec = (log_record *)buf;
+        rec->size = sizeof(buf);
+        rec->type = LOG_TEXT;
+        rec->level = 2;
+        rec->argc = 1;
+        rec->usec = 0;
+        rec->sec = t;
+        rec->format = (uintptr_t)format;
+        log_arg_put((char *)(rec + 1), dropped);
+        write_record(rec, my_tm);
+        total += rec->size;
+    }
+    return total;
+}
+
+void Log::write_record(const log_record *rec, const struct tm &my_tm) {
+    ++m_count;
     /* 日志不是今天 或 写入的日志行数是最大行的倍数 */
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) {  // everyday log, m_split_lines为最大行数
-        char new_log[256] = {0};
-        fflush(m_fp);
-        /* 阻塞队列里的数据呢 ? */
-        fclose(m_fp);
-        char tail[16] = {0};
-        /* 格式化日志名中的时间部分 */
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-        /* 如果是时间不是今天,则创建今天的日志，更新m_today和m_count */
-        if (m_today != my_tm.tm_mday) {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        }
-        else {
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");
+    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0)
+        rotate(my_tm);
+    if (!m_fp)
+        return;
+
+    if (!m_binary) {
+        int n = log_format_record(rec, (const char *)(uintptr_t)rec->format, m_line, m_log_buf_size + 64, &m_clock);
+        fwrite_unlocked(m_line, 1, n, m_fp);
+        return;
     }
- 
-    m_mutex.unlock();
 
-    va_list valst;
-    va_start(valst, format);
+    /* 格式串在本文件中第一次出现, 先写一条编号记录 */
+    std::unordered_map<uint64_t, uint64_t>::iterator it = m_format_ids.find(rec->format);
+    if (it == m_format_ids.end()) {
+        const char *format = (const char *)(uintptr_t)rec->format;
+        size_t len = strlen(format) + 1;
+        log_record def;
+        memset(&def, 0, sizeof(def));
+        def.size = (sizeof(def) + len + 7) & ~(size_t)7;
+        def.type = LOG_FORMAT;
+        def.format = m_format_ids.size();
+        static const char zeros[8] = {0};
+        fwrite_unlocked(&def, 1, sizeof(def), m_fp);
+        fwrite_unlocked(format, 1, len, m_fp);
+        fwrite_unlocked(zeros, 1, def.size - sizeof(def) - len, m_fp);
+        it = m_format_ids.insert(std::make_pair(rec->format, def.format)).first;
+    }
+    log_record head = *rec;
+    head.format = it->second;
+    fwrite_unlocked(&head, 1, sizeof(head), m_fp);
+    fwrite_unlocked(rec + 1, 1, rec->size - sizeof(head), m_fp);
+}
 
-    std::string log_str;
-    m_mutex.lock();
+bool Log::open_file(const char *path) {
+    m_fp = m_rotator.take(path);
+    if (!m_fp)
+        m_fp = fopen(path, "a");
+    if (!m_fp)
+        return false;
+    snprintf(m_path, sizeof(m_path), "%s", path);
+    if (m_is_async)
+        setvbuf(m_fp, m_file_buf, _IOFBF, FILE_BUF_SIZE);
+    if (m_binary) {
+        // 每个文件的格式串编号从头开始
+        m_format_ids.clear();
+        fwrite(LOG_MAGIC, 1, strlen(LOG_MAGIC), m_fp);
+    }
+    prepare_next();
+    return true;
+}
 
-    /*
-        写入内容格式：时间 + 内容
-        时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
-     */ 
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    /* 内容格式化，用于向字符串中打印数据、数据格式用户自定义，返回写入到字符数组str中的字符个数(不包含终止符) */
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-    m_mutex.unlock();
+void Log::make_path(char *path, int len, const struct tm &my_tm, long long index) {
+    char tail[16] = {0};
+    /* 格式化日志名中的时间部分 */
+    snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
+    if (index == 0)
+        snprintf(path, len, "%s%s%s", dir_name, tail, log_name);
+    else
+        snprintf(path, len, "%s%s%s.%lld", dir_name, tail, log_name, index);
+}
 
-    /*
-        若m_is_async为true表示异步, 默认为同步
-        若异步,则将日志信息加入阻塞队列, 同步则加锁向文件中写
-     */ 
-    if (m_is_async && !m_log_queue->full()) {
-        m_log_queue->push(log_str);
+void Log::prepare_next() {
+    time_t t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    char path[256];
+    std::string next[2];
+    make_path(path, sizeof(path), my_tm, m_count / m_split_lines + 1);
+    next[0] = path;
+    // 取明天中午, 避开夏令时切换
+    my_tm.tm_mday += 1;
+    my_tm.tm_hour = 12;
+    t = mktime(&my_tm);
+    localtime_r(&t, &my_tm);
+    make_path(path, sizeof(path), my_tm, 0);
+    next[1] = path;
+    m_rotator.prepare(next, 2);
+}
+
+void Log::rotate(const struct tm &my_tm) {
+    char new_log[256] = {0};
+    if (m_fp) {
+        /* 异步模式下所有文件共用 m_file_buf, 交出去之前先写完; 后台线程做这件事, 不影响写日志的线程 */
+        if (m_is_async)
+            fflush(m_fp);
+        m_rotator.retire(m_fp, m_path);
+        m_fp = NULL;
+    }
+    /* 如果是时间不是今天,则创建今天的日志，更新m_today和m_count */
+    if (m_today != my_tm.tm_mday) {
+        m_today = my_tm.tm_mday;
+        m_count = 0;
+        make_path(new_log, sizeof(new_log), my_tm, 0);
     }
     else {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        make_path(new_log, sizeof(new_log), my_tm, m_count / m_split_lines);
     }
+    open_file(new_log);
+}
 
+void Log::write_text(int level, const char *format, ...) {
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+
+    std::string &line = t_line;
+    if ((int)line.size() < m_log_buf_size + 64)
+        line.resize(m_log_buf_size + 64);
+    char *buf = &line[0];
+
+    /*
+        写入内容格式：时间 + 内容
+        时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
+     */
+    int n = log_format_prefix(buf, 64, now.tv_sec, now.tv_usec, level, &t_clock);
+
+    va_list valst;
+    va_start(valst, format);
+    /* 内容格式化，超出 m_log_buf_size 的部分截断 */
+    int m = vsnprintf(buf + n, m_log_buf_size, format, valst);
     va_end(valst);
+    if (m < 0)
+        m = 0;
+    if (m > m_log_buf_size - 1)
+        m = m_log_buf_size - 1;
+    buf[n + m] = '\n';
+    buf[n + m + 1] = '\0';
+
+    time_t t = now.tv_sec;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    m_mutex.lock();
+    ++m_count;  // 更新现有行数
+    /* 日志不是今天 或 写入的日志行数是最大行的倍数 */
+    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0)
+        rotate(my_tm);
+    if (m_fp)
+        fputs(buf, m_fp);
+    m_mutex.unlock();
 }
 
 void Log::flush(void) {
+    /* 异步模式下文件只由后台线程写, 空闲时它自己刷新 */
+    if (m_is_async)
+        return;
     m_mutex.lock();
     // 强制刷新写入流缓冲区
-    fflush(m_fp);
+    if (m_fp)
+        fflush(m_fp);
     m_mutex.unlock();
-
-/*
-存在问题: 
-    这里应该先将阻塞队列里的内容全部写入文件, 再直接将缓冲区内容写入文件 
-*/
 }
-
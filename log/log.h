@@ -6,7 +6,14 @@
 #include <string>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <sys/time.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include "locker.h"
+#include "log_ring.h"
+#include "log_format.h"
+#include "log_rotator.h"
 
 /* 
     单例模式:
@@ -19,24 +26,66 @@
  */
 
 
+/*
+    异步模式:
+
+    每个写日志的线程第一次写日志时创建自己的环形缓冲区(log_ring)并登记到 m_rings,
+    之后只把格式串指针和参数原样放入缓冲区(见 log_format.h), 不格式化, 不加锁, 也不做任何系统调用;
+    后台线程轮流取出各个缓冲区中的记录, 格式化后攒成大块写入文件, 按天和行数切分文件也只在后台线程进行.
+    缓冲区满时丢弃这一行并计数, 写日志的线程永远不会因为磁盘慢而阻塞.
+    binary 为 true 时后台线程不格式化, 直接写二进制记录, 用 log_decode 查看.
+
+    同步模式(max_queue_size 为0)每行加一次锁直接写入文件.
+
+    格式串必须是字符串常量: 异步模式下只记录它的地址.
+ */
 class Log {  
+public:
+    static const int IDLE_USEC = 1000;       // 后台线程没有日志可写时的休眠时间
+    static const int FILE_BUF_SIZE = 1 << 20; // 异步模式下文件的写缓冲
+
 public:
     /* C++ 11开始, 使用局部变量懒汉不用加锁 */
     static Log* get_instance();
     static void* flush_log_thread(void* args);
 
     /* 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列 */
-    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
-    
-    void write_log(int level, const char *format, ...);
+    bool init(const char *file_name, int close_log, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0,
+              bool binary = false, bool compress = false);
 
+    template <typename... Args>
+    void write_log(int level, const char *format, Args... args);
+
+    /* 同步模式下刷新文件缓冲; 异步模式下由后台线程负责, 直接返回 */
     void flush(void);
 
+    /* 运行时的日志级别阈值, 低于它的日志在求值参数之前就被跳过 */
+    static bool enabled(int level) { return level >= m_level.load(std::memory_order_relaxed); }
+    static int level() { return m_level.load(std::memory_order_relaxed); }
+    static void set_level(int level) { m_level.store(level, std::memory_order_relaxed); }
+
+    /* 异步模式下缓冲区满时丢弃的日志总行数 */
+    long long dropped() const { return m_dropped_total.load(std::memory_order_relaxed); }
+
 private:
     Log();
     virtual ~Log();
 
     void* async_write_log();
+    /* 同步模式: 当场格式化并写入文件 */
+    void write_text(int level, const char *format, ...);
+    /* 取出所有缓冲区中的日志写入文件, 返回写入的字节数 */
+    size_t drain();
+    /* 写入一条记录, 需要时先切分文件 */
+    void write_record(const log_record *rec, const struct tm &my_tm);
+    /* 按天或按行数切换日志文件, 旧文件交给 m_rotator 关闭和压缩 */
+    void rotate(const struct tm &my_tm);
+    /* 打开日志文件(优先取预开好的), 二进制模式下写入文件头 */
+    bool open_file(const char *path);
+    /* 日期为 my_tm 的第 index 个日志文件名, 0 不带序号 */
+    void make_path(char *path, int len, const struct tm &my_tm, long long index);
+    /* 让 m_rotator 预开明天的文件和按行数切分的下一个文件 */
+    void prepare_next();
 
 private:
     char dir_name[128];                      // 路径名
@@ -46,28 +95,70 @@ private:
     long long m_count;                       // 日志行数记录
     int m_today;                             // 因为按天分类,记录当前时间是那一天
     FILE *m_fp;                              // 打开log的文件指针
-    char *m_buf;        
-    block_queue<std::string> *m_log_queue;   // 阻塞队列
+    char m_path[256];                        // 当前日志文件名
+    log_rotator m_rotator;                   // 预开新文件, 关闭和压缩切分下来的文件
     bool m_is_async;                         // 是否同步标志位 true: 异步
-    locker m_mutex;
+    locker m_mutex;                          // 同步模式下保护文件
     int m_close_log;                         // 关闭日志
-
-
+    static std::atomic<int> m_level;         // 运行时的级别阈值, 0 debug 1 info 2 warn 3 error
+
+    /* 异步模式 */
+    log_ring_set<Log> m_rings;               // 各线程的缓冲区
+    std::atomic<long long> m_dropped;        // 缓冲区满时丢弃、还没在日志中注明的行数
+    std::atomic<long long> m_dropped_total;
+    std::atomic<bool> m_stop;
+    pthread_t m_tid;
+    char *m_file_buf;
+    bool m_binary;                           // 写二进制记录
+    std::unordered_map<uint64_t, uint64_t> m_format_ids;  // 二进制模式: 格式串地址 -> 当前文件中的编号
+    log_clock m_clock;                       // 后台线程格式化时间用
+    char *m_line;                            // 后台线程格式化一行的缓冲区
 };
 
-Log* Log::get_instance() {
-    static Log instance;
-    return &instance;
+template <typename... Args>
+void Log::write_log(int level, const char *format, Args... args) {
+    if (!m_is_async) {
+        write_text(level, format, args...);
+        return;
+    }
+
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    size_t len = sizeof(log_record) + (0 + ... + log_arg_size(args));
+    log_ring *ring = m_rings.local();
+    log_record *rec = (log_record *)ring->reserve(len);
+    if (!rec) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_dropped_total.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    rec->type = LOG_TEXT;
+    rec->level = level;
+    rec->argc = sizeof...(args);
+    rec->usec = now.tv_usec;
+    rec->sec = now.tv_sec;
+    rec->format = (uintptr_t)format;
+    char *p = (char *)(rec + 1);
+    ((p = log_arg_put(p, args)), ...);
+    (void)p;
+    ring->commit();
 }
 
-void* Log::flush_log_thread(void* args) {
-    Log::get_instance()->async_write_log();
-} 
+/*
+    日志级别过滤:
+    - 编译期: 低于 LOG_MIN_LEVEL 的调用条件恒为假, 连同参数一起被编译器删除(make LOG_MIN_LEVEL=1)
+    - 运行期: Log::set_level 设置阈值, 判断在参数求值之前, 关闭的日志只多一次比较
+ */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+#define LOG_BASE(level, format, ...) if((level) >= LOG_MIN_LEVEL && Log::enabled(level) && 0 == m_close_log) {Log::get_instance()->write_log(level, format, ##__VA_ARGS__); Log::get_instance()->flush();}
 
-#define LOG_DEBUG(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(0, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_INFO(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(1, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_WARN(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(2, format, ##__VA_ARGS__); Log::get_instance()->flush();}
-#define LOG_ERROR(format, ...) if(0 == m_close_log) {Log::get_instance()->write_log(3, format, ##__VA_ARGS__); Log::get_instance()->flush();}
+#define LOG_DEBUG(format, ...) LOG_BASE(0, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(1, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(2, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(3, format, ##__VA_ARGS__)
 
 
-#endif  // LOG_H
\ No newline at end of file
+#endif  // LOG_H
@@ -0,0 +1,113 @@
+/*
+    二进制日志解码
+    ./log_decode 日志文件...
+    逐条还原成和文本日志相同的格式, 输出到标准输出;
+    以 ACCESS_MAGIC 开头的二进制访问日志同样还原成文本访问日志的格式
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "log_format.h"
+
+static const uint32_t MAX_RECORD = 1 << 20;
+
+/* 访问日志: 文件头之后都是定长记录, 重启后追加的文件头跳过即可 */
+static bool decode_access(FILE *fp, const char *path) {
+    access_record rec;
+    char line[256];
+    log_clock clock = {-1, {0}, 0};
+    const size_t magic_len = strlen(ACCESS_MAGIC);
+
+    while (true) {
+        if (fread(&rec, 1, magic_len, fp) != magic_len)
+            break;
+        if (memcmp(&rec, ACCESS_MAGIC, magic_len) == 0)
+            continue;
+        if (fread((char *)&rec + magic_len, 1, sizeof(rec) - magic_len, fp) != sizeof(rec) - magic_len) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+        if (rec.size != sizeof(rec)) {
+            fprintf(stderr, "%s: bad record size %u\n", path, rec.size);
+            fclose(fp);
+            return false;
+        }
+        int n = access_format_record(&rec, line, sizeof(line), &clock);
+        fwrite(line, 1, n, stdout);
+    }
+    fclose(fp);
+    return true;
+}
+
+static bool decode(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+
+    char magic[8];
+    size_t got = fread(magic, 1, sizeof(magic), fp);
+    rewind(fp);
+    if (got == strlen(ACCESS_MAGIC) && memcmp(magic, ACCESS_MAGIC, got) == 0)
+        return decode_access(fp, path);
+
+    std::vector<std::string> formats;
+    std::vector<char> buf(MAX_RECORD);
+    std::vector<char> line(MAX_RECORD);
+    log_clock clock = {-1, {0}, 0};
+    const size_t magic_len = strlen(LOG_MAGIC);
+    bool ok = true;
+
+    while (true) {
+        /* 同一天重启后会在文件中间再写一次文件头, 格式串编号重新开始 */
+        if (fread(&buf[0], 1, magic_len, fp) != magic_len)
+            break;
+        if (memcmp(&buf[0], LOG_MAGIC, magic_len) == 0) {
+            formats.clear();
+            continue;
+        }
+        if (fread(&buf[magic_len], 1, sizeof(log_record) - magic_len, fp) != sizeof(log_record) - magic_len) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+        log_record *rec = (log_record *)&buf[0];
+        if (rec->size < sizeof(log_record) || rec->size > MAX_RECORD) {
+            fprintf(stderr, "%s: bad record size %u\n", path, rec->size);
+            ok = false;
+            break;
+        }
+        size_t rest = rec->size - sizeof(log_record);
+        if (fread(&buf[sizeof(log_record)], 1, rest, fp) != rest) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+
+        if (rec->type == LOG_FORMAT) {
+            if (rec->format >= formats.size())
+                formats.resize(rec->format + 1);
+            formats[rec->format] = std::string(&buf[sizeof(log_record)], strnlen(&buf[sizeof(log_record)], rest));
+        } else if (rec->type == LOG_TEXT) {
+            const char *format = rec->format < formats.size() ? formats[rec->format].c_str() : NULL;
+            int n = log_format_record(rec, format, &line[0], line.size(), &clock);
+            fwrite(&line[0], 1, n, stdout);
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s log_file...\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!decode(argv[i]))
+            ret = 1;
+    }
+    return ret;
+}
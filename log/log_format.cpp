@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include "log_format.h"
+
+namespace {
+
+/* 解码后的一个参数 */
+struct log_arg {
+    int kind;
+    int width;
+    int64_t i;
+    uint64_t u;
+    double d;
+    const char *s;
+};
+
+const char *read_arg(const char *p, const char *end, log_arg *arg) {
+    if (end - p < 2)
+        return NULL;
+    arg->kind = p[0];
+    arg->width = (unsigned char)p[1];
+    if (arg->kind == LOG_ARG_STR) {
+        uint16_t len;
+        if (end - p < 4)
+            return NULL;
+        memcpy(&len, p + 2, 2);
+        if (end - p < 4 + len + 1)
+            return NULL;
+        arg->s = p + 4;
+        return p + 4 + len + 1;
+    }
+    if (end - p < 10)
+        return NULL;
+    memcpy(&arg->u, p + 2, 8);
+    memcpy(&arg->i, p + 2, 8);
+    memcpy(&arg->d, p + 2, 8);
+    return p + 10;
+}
+
+/* 按参数的实际宽度截断, 和原来的 printf 对 %x/%u 的输出保持一致 */
+uint64_t truncate(uint64_t u, int width) {
+    return width > 0 && width < 8 ? u & ((1ULL << (width * 8)) - 1) : u;
+}
+
+/*
+    输出一个转换: spec 为去掉长度修饰符的 "%[flags][width][.precision]",
+    conv 为转换符
+ */
+int format_arg(char *out, int len, const char *spec, char conv, const log_arg &arg) {
+    char f[48];
+    switch (arg.kind) {
+        case LOG_ARG_STR:
+            snprintf(f, sizeof(f), "%s%c", conv == 's' ? spec : "%", 's');
+            return snprintf(out, len, f, arg.s);
+        case LOG_ARG_DOUBLE:
+            if (strchr("fFeEgGaA", conv)) {
+                snprintf(f, sizeof(f), "%s%c", spec, conv);
+                return snprintf(out, len, f, arg.d);
+            }
+            return snprintf(out, len, "%g", arg.d);
+        case LOG_ARG_PTR:
+            return snprintf(out, len, "%p", (void *)(uintptr_t)arg.u);
+        case LOG_ARG_INT:
+        case LOG_ARG_UINT:
+            if (conv == 'c') {
+                snprintf(f, sizeof(f), "%sc", spec);
+                return snprintf(out, len, f, (int)arg.i);
+            }
+            if (strchr("uoxX", conv)) {
+                snprintf(f, sizeof(f), "%sll%c", spec, conv);
+                return snprintf(out, len, f, (unsigned long long)truncate(arg.u, arg.width));
+            }
+            if (conv == 'p')
+                return snprintf(out, len, "%p", (void *)(uintptr_t)arg.u);
+            if (arg.kind == LOG_ARG_UINT) {
+                snprintf(f, sizeof(f), "%sllu", strchr("di", conv) ? spec : "%");
+                return snprintf(out, len, f, (unsigned long long)arg.u);
+            }
+            snprintf(f, sizeof(f), "%slld", strchr("di", conv) ? spec : "%");
+            return snprintf(out, len, f, (long long)arg.i);
+        default:
+            return 0;
+    }
+}
+
+/* 这一秒的 "YYYY-MM-DD HH:MM:SS", 秒数不变时直接用缓存 */
+const char *clock_text(log_clock *clock, time_t sec) {
+    if (clock->sec != sec) {
+        struct tm my_tm;
+        localtime_r(&sec, &my_tm);
+        clock->sec = sec;
+        clock->len = snprintf(clock->text, sizeof(clock->text), "%d-%02d-%02d %02d:%02d:%02d",
+                              my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                              my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+    }
+    return clock->text;
+}
+
+}  // namespace
+
+const char *log_level_tag(int level) {
+    /* 日志分级 */
+    switch (level) {
+        case 0:
+            return "[debug]:";
+        case 2:
+            return "[warn]:";
+        case 3:
+            return "[erro]:";
+        default:
+            return "[info]:";
+    }
+}
+
+int log_format_prefix(char *out, int len, time_t sec, long usec, int level, log_clock *clock) {
+    return snprintf(out, len, "%s.%06ld %s ", clock_text(clock, sec), usec, log_level_tag(level));
+}
+
+int log_format_record(const log_record *rec, const char *format, char *out, int len, log_clock *clock) {
+    if (len < 2)
+        return 0;
+    // 留出换行的位置
+    int cap = len - 1;
+    int n = log_format_prefix(out, cap, rec->sec, rec->usec, rec->level, clock);
+    if (n >= cap)
+        n = cap - 1;
+
+    const char *p = (const char *)(rec + 1);
+    const char *end = (const char *)rec + rec->size;
+    int argc = rec->argc;
+
+    const char *f = format ? format : "(unknown format)";
+    while (*f && n < cap - 1) {
+        if (*f != '%') {
+            const char *next = strchr(f, '%');
+            int run = next ? next - f : strlen(f);
+            if (run > cap - 1 - n)
+                run = cap - 1 - n;
+            memcpy(out + n, f, run);
+            n += run;
+            f += run;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[n++] = '%';
+            f += 2;
+            continue;
+        }
+
+        /* 解析 %[flags][width][.precision][length]conv, 去掉长度修饰符 */
+        const char *start = f++;
+        char spec[32];
+        int s = 0;
+        spec[s++] = '%';
+        while (*f && strchr("-+ #0", *f) && s < 24)
+            spec[s++] = *f++;
+        while (*f >= '0' && *f <= '9' && s < 24)
+            spec[s++] = *f++;
+        if (*f == '.') {
+            spec[s++] = *f++;
+            while (*f >= '0' && *f <= '9' && s < 24)
+                spec[s++] = *f++;
+        }
+        spec[s] = '\0';
+        while (*f && strchr("hlLqjzt", *f))
+            ++f;
+        char conv = *f;
+        if (!conv || conv == '*' || conv == 'n') {
+            // 不支持的转换原样输出
+            int run = (conv ? f + 1 : f) - start;
+            if (run > cap - 1 - n)
+                run = cap - 1 - n;
+            memcpy(out + n, start, run);
+            n += run;
+            f = conv ? f + 1 : f;
+            continue;
+        }
+        ++f;
+
+        log_arg arg;
+        if (argc <= 0 || !(p = read_arg(p, end, &arg))) {
+            // 参数不够, 保留转换符
+            int run = f - start;
+            if (run > cap - 1 - n)
+                run = cap - 1 - n;
+            memcpy(out + n, start, run);
+            n += run;
+            argc = 0;
+            p = end;
+            continue;
+        }
+        --argc;
+        int m = format_arg(out + n, cap - n, spec, conv, arg);
+        if (m > 0)
+            n += m < cap - n ? m : cap - 1 - n;
+    }
+    out[n++] = '\n';
+    return n;
+}
+
+int access_format_record(const access_record *rec, char *out, int len, log_clock *clock) {
+    if (len < 2)
+        return 0;
+    char ip[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    addr.s_addr = rec->addr;
+    if (!inet_ntop(AF_INET, &addr, ip, sizeof(ip)))
+        strcpy(ip, "-");
+    int path_len = rec->path_len < sizeof(rec->path) ? rec->path_len : sizeof(rec->path);
+
+    int n = snprintf(out, len - 1, "%s.%06ld %s:%u %.*s %.*s %u %llu %u", clock_text(clock, rec->start / 1000000),
+                     (long)(rec->start % 1000000), ip, (unsigned)rec->port, (int)strnlen(rec->method, sizeof(rec->method)),
+                     rec->method, path_len, rec->path, (unsigned)rec->status, (unsigned long long)rec->bytes,
+                     (unsigned)rec->latency);
+    if (n < 0)
+        n = 0;
+    if (n > len - 2)
+        n = len - 2;
+    out[n++] = '\n';
+    return n;
+}
@@ -0,0 +1,152 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+
+/*************************************************************
+ * 延迟格式化的日志记录
+ *
+ * 写日志的线程只记下格式串指针和参数的原始字节, 不调用 vsnprintf;
+ * 后台线程把记录格式化成文本写入日志, 或者原样写入二进制日志,
+ * 由 log_decode 离线还原成文本.
+ *
+ * 记录布局(8字节对齐):
+ *   log_record 头 | 参数1 | 参数2 | ...
+ * 参数:
+ *   整数/浮点/指针: kind(1) width(1) 值(8)
+ *   字符串:         kind(1) 0(1) len(2) 内容(len) '\0'
+ *
+ * 二进制日志文件以 LOG_MAGIC 开头, 之后是一串记录; 格式串第一次出现时
+ * 先写一条 LOG_FORMAT 记录给出编号和内容, 之后的 LOG_TEXT 记录的 format
+ * 字段存编号. 每个文件(包括切分出的新文件)的编号独立, 可以单独解码.
+ * 字节序和本机相同.
+ **************************************************************/
+
+#define LOG_MAGIC "TWSBLOG1"
+
+enum LOG_RECORD_TYPE {
+    LOG_TEXT = 1,    // 一行日志
+    LOG_FORMAT = 2   // 只出现在二进制日志文件中: 格式串编号 -> 内容
+};
+
+enum LOG_ARG_KIND {
+    LOG_ARG_INT = 1,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_PTR,
+    LOG_ARG_STR
+};
+
+struct log_record {
+    uint32_t size;       // 整条记录的长度, 含头部和对齐填充
+    uint8_t type;
+    uint8_t level;
+    uint8_t argc;
+    uint8_t reserved;
+    uint32_t usec;
+    uint32_t reserved2;
+    int64_t sec;
+    uint64_t format;     // 内存中是格式串指针, 文件中是编号
+};
+
+static const int LOG_STR_MAX = 4096;   // 单个字符串参数最多记录的长度
+
+/* 每个参数编码后的长度 */
+template <typename T>
+inline size_t log_arg_size(T v) {
+    if constexpr (std::is_same<T, const char *>::value || std::is_same<T, char *>::value)
+        return 4 + (v ? strnlen(v, LOG_STR_MAX) : 6) + 1;
+    else {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                      "log arguments must be numbers, pointers or C strings");
+        return 10;
+    }
+}
+
+/* 把一个参数写到 p, 返回写完后的位置 */
+template <typename T>
+inline char *log_arg_put(char *p, T v) {
+    if constexpr (std::is_same<T, const char *>::value || std::is_same<T, char *>::value) {
+        const char *s = v ? v : "(null)";
+        uint16_t len = strnlen(s, LOG_STR_MAX);
+        p[0] = LOG_ARG_STR;
+        p[1] = 0;
+        memcpy(p + 2, &len, 2);
+        memcpy(p + 4, s, len);
+        p[4 + len] = '\0';
+        return p + 4 + len + 1;
+    } else {
+        p[1] = sizeof(T);
+        if constexpr (std::is_floating_point<T>::value) {
+            double d = v;
+            p[0] = LOG_ARG_DOUBLE;
+            memcpy(p + 2, &d, 8);
+        } else if constexpr (std::is_pointer<T>::value) {
+            uint64_t u = (uintptr_t)v;
+            p[0] = LOG_ARG_PTR;
+            memcpy(p + 2, &u, 8);
+        } else if constexpr (std::is_signed<T>::value || std::is_enum<T>::value) {
+            int64_t i = (int64_t)v;
+            p[0] = LOG_ARG_INT;
+            memcpy(p + 2, &i, 8);
+        } else {
+            uint64_t u = (uint64_t)v;
+            p[0] = LOG_ARG_UINT;
+            memcpy(p + 2, &u, 8);
+        }
+        return p + 10;
+    }
+}
+
+/* 后台线程缓存当前这一秒格式化好的时间 */
+struct log_clock {
+    time_t sec;
+    char text[24];   // "YYYY-MM-DD HH:MM:SS"
+    int len;
+};
+
+const char *log_level_tag(int level);
+
+/* 格式化 "时间 级别 " 前缀, 返回长度 */
+int log_format_prefix(char *out, int len, time_t sec, long usec, int level, log_clock *clock);
+
+/*
+    把一条 LOG_TEXT 记录格式化成一行文本(以 '\n' 结尾, 不含 '\0'), 返回长度.
+    format 为记录对应的格式串; 参数和格式串的转换符对不上时按参数的实际类型输出
+ */
+int log_format_record(const log_record *rec, const char *format, char *out, int len, log_clock *clock);
+
+/*************************************************************
+ * 访问日志记录
+ *
+ * 每个请求一条定长记录, 由 access_log 写入单独的文件:
+ * 文本模式每条记录一行; 二进制模式文件以 ACCESS_MAGIC 开头,
+ * 之后是原样的记录, 用 log_decode 查看. 字节序和本机相同.
+ **************************************************************/
+
+#define ACCESS_MAGIC "TWSACC01"
+
+struct access_record {
+    uint32_t size;       // 记录长度, 即 sizeof(access_record)
+    uint16_t status;     // 响应状态码
+    uint16_t path_len;
+    uint32_t addr;       // 客户端 IPv4 地址, 网络字节序
+    uint16_t port;       // 客户端端口
+    uint16_t reserved;
+    int64_t start;       // 请求开始的时间(微秒)
+    uint64_t bytes;      // 发送的字节数
+    uint32_t latency;    // 请求开始到响应发送完毕(微秒)
+    uint32_t reserved2;
+    char method[8];      // 不一定以 '\0' 结尾
+    char path[80];       // 超出的部分截断, 长度见 path_len
+};
+
+static_assert(sizeof(access_record) == 128, "access_record must stay fixed size");
+
+/* 格式化成 "时间 客户端 方法 路径 状态码 字节数 耗时" 一行(以 '\n' 结尾, 不含 '\0'), 返回长度 */
+int access_format_record(const access_record *rec, char *out, int len, log_clock *clock);
+
+#endif  // LOG_FORMAT_H
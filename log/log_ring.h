@@ -0,0 +1,176 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include "locker.h"
+
+/*************************************************************
+ * 单生产者单消费者的日志环形缓冲区
+ *
+ *   - 每个写日志的线程独占一个, 是唯一的生产者; 后台写文件线程是唯一的消费者
+ *   - 读写位置只增不减, 取模得到下标; 两端各自只写自己的位置, 不加锁
+ *   - 存放的是长度不定的记录, 每条记录开头的 4 字节是它的长度(8字节对齐);
+ *     一条记录总是连续存放, 剩余空间到缓冲区末尾放不下时, 在当前位置
+ *     写长度 0 表示跳到开头
+ *   - 缓冲区满了生产者不等待, reserve 返回 NULL, 由调用者丢弃这条记录
+ **************************************************************/
+class log_ring {
+public:
+    static const uint32_t SIZE = 1 << 18;  // 必须是2的幂
+    static const uint32_t MAX_RECORD = SIZE / 4;
+
+public:
+    log_ring() : m_head(0), m_tail(0), m_cached_head(0), m_pending(0), m_closed(false) {}
+
+    /* 生产者: 申请一条 len 字节的记录, 开头已经填好长度; 写完后 commit */
+    char *reserve(uint32_t len) {
+        len = (len + 7) & ~7u;
+        if (len < sizeof(uint32_t) || len > MAX_RECORD)
+            return NULL;
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        uint32_t pos = tail & (SIZE - 1);
+        uint32_t pad = pos + len > SIZE ? SIZE - pos : 0;
+
+        if (tail + pad + len - m_cached_head > SIZE) {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail + pad + len - m_cached_head > SIZE)
+                return NULL;
+        }
+        if (pad) {
+            put_len(pos, 0);
+            pos = 0;
+        }
+        put_len(pos, len);
+        m_pending = pad + len;
+        return m_buf + pos;
+    }
+    void commit() {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + m_pending, std::memory_order_release);
+    }
+
+    /* 消费者: 下一条记录, NULL 表示没有 */
+    const char *front() {
+        while (true) {
+            uint64_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+                return NULL;
+            uint32_t pos = head & (SIZE - 1);
+            if (get_len(pos) == 0) {
+                // 跳到开头
+                m_head.store(head + SIZE - pos, std::memory_order_release);
+                continue;
+            }
+            return m_buf + pos;
+        }
+    }
+    void pop() {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        m_head.store(head + get_len(head & (SIZE - 1)), std::memory_order_release);
+    }
+
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    /* 线程退出时标记, 消费者取完剩余数据后释放 */
+    void close() { m_closed.store(true, std::memory_order_release); }
+    bool closed() const { return m_closed.load(std::memory_order_acquire); }
+
+private:
+    void put_len(uint32_t pos, uint32_t len) { memcpy(m_buf + pos, &len, sizeof(len)); }
+    uint32_t get_len(uint32_t pos) const {
+        uint32_t len;
+        memcpy(&len, m_buf + pos, sizeof(len));
+        return len;
+    }
+
+private:
+    /* 读写位置放在不同的缓存行, 两端互不干扰 */
+    alignas(64) std::atomic<uint64_t> m_head;  // 消费者读到的位置
+    alignas(64) std::atomic<uint64_t> m_tail;  // 生产者写到的位置
+    uint64_t m_cached_head;                    // 生产者上次看到的 m_head, 减少跨核读取
+    uint32_t m_pending;                        // reserve 之后 commit 要前进的长度
+    std::atomic<bool> m_closed;
+    alignas(64) char m_buf[SIZE];
+};
+
+/*************************************************************
+ * 每个线程一个 log_ring 的登记表, 运行日志和访问日志共用
+ *
+ *   - 线程第一次调用 local 时创建自己的缓冲区并登记, 之后只读 thread_local
+ *   - 线程退出时标记缓冲区, 后台线程 drain 取完剩余记录后注销并释放
+ *   - Owner 只用来区分不同日志各自的 thread_local, 互不影响
+ **************************************************************/
+template <typename Owner>
+class log_ring_set {
+public:
+    /* 在后台线程结束之后析构: 还在运行的线程可能继续写自己的缓冲区, 只释放已退出线程的 */
+    ~log_ring_set() {
+        for (size_t i = 0; i < m_rings.size(); ++i) {
+            if (m_rings[i]->closed())
+                delete m_rings[i];
+        }
+    }
+
+    /* 当前线程的缓冲区, 第一次调用时创建 */
+    log_ring *local() {
+        if (!t_holder.ring) {
+            t_holder.ring = new log_ring;
+            m_lock.lock();
+            m_rings.push_back(t_holder.ring);
+            m_lock.unlock();
+        }
+        return t_holder.ring;
+    }
+
+    /* 后台线程: 依次把每条记录交给 consume, 返回 consume 返回值之和; 释放已退出线程的缓冲区 */
+    template <typename F>
+    size_t drain(F consume) {
+        m_lock.lock();
+        std::vector<log_ring *> rings(m_rings);
+        m_lock.unlock();
+
+        size_t total = 0;
+        for (size_t i = 0; i < rings.size(); ++i) {
+            log_ring *ring = rings[i];
+            // 先看退出标记再看是否为空, 标记之前写入的记录一定能取到
+            bool closed = ring->closed();
+            const char *rec;
+            while ((rec = ring->front()) != NULL) {
+                total += consume(rec);
+                ring->pop();
+            }
+            if (closed) {
+                m_lock.lock();
+                for (size_t j = 0; j < m_rings.size(); ++j) {
+                    if (m_rings[j] == ring) {
+                        m_rings.erase(m_rings.begin() + j);
+                        break;
+                    }
+                }
+                m_lock.unlock();
+                delete ring;
+            }
+        }
+        return total;
+    }
+
+private:
+    /* 线程退出时标记缓冲区 */
+    struct holder {
+        log_ring *ring = NULL;
+        ~holder() {
+            if (ring)
+                ring->close();
+        }
+    };
+
+    inline static thread_local holder t_holder;
+    locker m_lock;                     // 只在线程登记缓冲区时和后台线程取列表时使用
+    std::vector<log_ring *> m_rings;
+};
+
+#endif  // LOG_RING_H
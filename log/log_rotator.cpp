@@ -0,0 +1,174 @@
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include "log_rotator.h"
+
+log_rotator::log_rotator() : m_compress(false), m_started(false), m_stop(false), m_wanted_count(0) {
+    for (int i = 0; i < MAX_PREPARED; ++i)
+        m_prepared[i].fp = NULL;
+}
+
+log_rotator::~log_rotator() {
+    stop();
+}
+
+bool log_rotator::start(bool compress) {
+    m_compress = compress;
+    if (pthread_create(&m_tid, NULL, worker, this) != 0)
+        return false;
+    m_started = true;
+    return true;
+}
+
+void log_rotator::stop() {
+    if (!m_started)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_cond.signal();
+    m_lock.unlock();
+    pthread_join(m_tid, NULL);
+    m_started = false;
+
+    for (int i = 0; i < MAX_PREPARED; ++i) {
+        if (m_prepared[i].fp)
+            close_prepared(m_prepared[i]);
+    }
+}
+
+void log_rotator::prepare(const std::string *paths, int count) {
+    m_lock.lock();
+    m_wanted_count = count < MAX_PREPARED ? count : MAX_PREPARED;
+    for (int i = 0; i < m_wanted_count; ++i)
+        m_wanted[i] = paths[i];
+    m_cond.signal();
+    m_lock.unlock();
+}
+
+FILE *log_rotator::take(const char *path) {
+    FILE *fp = NULL;
+    m_lock.lock();
+    for (int i = 0; i < MAX_PREPARED; ++i) {
+        if (m_prepared[i].fp && m_prepared[i].path == path) {
+            fp = m_prepared[i].fp;
+            m_prepared[i].fp = NULL;
+            break;
+        }
+    }
+    m_lock.unlock();
+    return fp;
+}
+
+void log_rotator::retire(FILE *fp, const char *path) {
+    retired r;
+    r.fp = fp;
+    r.path = path;
+    m_lock.lock();
+    if (!m_started) {
+        m_lock.unlock();
+        close_retired(r);
+        return;
+    }
+    m_retired.push_back(r);
+    m_cond.signal();
+    m_lock.unlock();
+}
+
+void *log_rotator::worker(void *arg) {
+    // 只影响本线程
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    ((log_rotator *)arg)->run();
+    return NULL;
+}
+
+void log_rotator::run() {
+    m_lock.lock();
+    while (true) {
+        /* 关掉不再需要的预开文件, 打开缺少的; fopen 很快, 持锁完成 */
+        for (int i = 0; i < MAX_PREPARED; ++i) {
+            prepared &p = m_prepared[i];
+            if (!p.fp)
+                continue;
+            bool wanted = false;
+            for (int j = 0; j < m_wanted_count; ++j)
+                wanted = wanted || m_wanted[j] == p.path;
+            if (!wanted)
+                close_prepared(p);
+        }
+        for (int j = 0; j < m_wanted_count && !m_stop; ++j) {
+            int slot = -1;
+            bool opened = false;
+            for (int i = 0; i < MAX_PREPARED; ++i) {
+                if (m_prepared[i].fp && m_prepared[i].path == m_wanted[j])
+                    opened = true;
+                else if (!m_prepared[i].fp && slot < 0)
+                    slot = i;
+            }
+            if (opened || slot < 0)
+                continue;
+            FILE *fp = fopen(m_wanted[j].c_str(), "a");
+            if (fp) {
+                m_prepared[slot].path = m_wanted[j];
+                m_prepared[slot].fp = fp;
+            }
+        }
+
+        if (!m_retired.empty()) {
+            retired r = m_retired.front();
+            m_retired.pop_front();
+            m_lock.unlock();
+            close_retired(r);
+            m_lock.lock();
+            continue;
+        }
+        if (m_stop)
+            break;
+        m_cond.wait(m_lock.get());
+    }
+    m_lock.unlock();
+}
+
+/* 没用上的文件如果是预开时新建的(仍为空)就删掉 */
+void log_rotator::close_prepared(prepared &p) {
+    struct stat st;
+    bool empty = fstat(fileno(p.fp), &st) == 0 && st.st_size == 0;
+    fclose(p.fp);
+    if (empty)
+        unlink(p.path.c_str());
+    p.fp = NULL;
+}
+
+void log_rotator::close_retired(const retired &r) {
+    fclose(r.fp);
+    if (m_compress && gzip_file(r.path))
+        unlink(r.path.c_str());
+}
+
+/* 追加到 path.gz, 同一个文件名重复切分时成为多段 gzip, gunzip 可以直接解开 */
+bool log_rotator::gzip_file(const std::string &path) {
+    FILE *in = fopen(path.c_str(), "rb");
+    if (!in)
+        return false;
+    std::string gz_path = path + ".gz";
+    gzFile out = gzopen(gz_path.c_str(), "ab6");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+
+    bool ok = true;
+    char *buf = new char[COPY_SIZE];
+    size_t n;
+    while ((n = fread(buf, 1, COPY_SIZE, in)) > 0) {
+        if (gzwrite(out, buf, n) != (int)n) {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && !ferror(in);
+    delete[] buf;
+    fclose(in);
+    return gzclose(out) == Z_OK && ok;
+}
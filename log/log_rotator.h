@@ -0,0 +1,69 @@
+#ifndef LOG_ROTATOR_H
+#define LOG_ROTATOR_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <list>
+#include <string>
+#include "locker.h"
+
+/*************************************************************
+ * 日志切分的后台线程
+ *
+ * 切分文件时写日志的一方只交换 FILE 指针, 文件 I/O 都在这里完成:
+ *   - prepare: 提前打开下一个可能用到的文件(明天的, 以及按行数切分的下一个),
+ *     切分时用 take 直接取走; 没准备好时调用者自己 fopen
+ *   - retire: 切分下来的旧文件在这里 fclose, compress 时再压缩成 .gz 并删除原文件
+ * 线程以最低优先级运行, 压缩不和工作线程抢 CPU
+ **************************************************************/
+class log_rotator {
+public:
+    static const int MAX_PREPARED = 2;
+    static const int COPY_SIZE = 64 << 10;
+
+public:
+    log_rotator();
+    ~log_rotator();
+
+    bool start(bool compress);
+    /* 处理完所有切分下来的文件后退出, 没用上的预开文件为空时删除 */
+    void stop();
+
+    /* 需要预先打开的文件, 替换上一次的设置 */
+    void prepare(const std::string *paths, int count);
+    /* 取走已经打开的 path, 没有返回 NULL */
+    FILE *take(const char *path);
+    /* 交给后台关闭, 调用者不能再使用 fp */
+    void retire(FILE *fp, const char *path);
+
+private:
+    struct prepared {
+        std::string path;
+        FILE *fp;
+    };
+    struct retired {
+        FILE *fp;
+        std::string path;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    void close_prepared(prepared &p);
+    /* 以下在后台线程中调用, 不持有锁 */
+    void close_retired(const retired &r);
+    bool gzip_file(const std::string &path);
+
+private:
+    bool m_compress;
+    bool m_started;
+    bool m_stop;
+    pthread_t m_tid;
+    locker m_lock;
+    cond m_cond;
+    std::string m_wanted[MAX_PREPARED];   // 需要预开的文件
+    int m_wanted_count;
+    prepared m_prepared[MAX_PREPARED];    // 已经打开的文件, fp 为 NULL 表示空位
+    std::list<retired> m_retired;
+};
+
+#endif  // LOG_ROTATOR_H
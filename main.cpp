@@ -16,7 +16,10 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.tls, config.tls_cert, config.tls_key,
+                config.user_cache, config.user_hot_file, config.storage, config.storage_file,
+                config.log_level, config.log_compress, config.access_sample, config.mock_db,
+                config.trace_file);
     
 
     //日志
@@ -0,0 +1,80 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*************************************************************
+ * 对数分桶的直方图(HDR 风格)
+ *
+ *   - 小于 16 的值每个一个桶; 之后每个 2 的幂区间等分成 8 个桶,
+ *     相对误差不超过 12.5%, 最大到 2^40, 共 BUCKETS 个桶
+ *   - 这里只有分桶规则和合并后的统计, 分线程记录由 metrics 完成
+ **************************************************************/
+struct histogram {
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t buckets[BUCKETS];
+
+    histogram() { clear(); }
+    void clear() { memset(this, 0, sizeof(*this)); }
+
+    static int bucket(uint64_t v) {
+        if (v < (uint64_t)SUB_COUNT * 2)
+            return v;
+        if (v >> MAX_BITS)
+            return BUCKETS - 1;
+        int msb = 63 - __builtin_clzll(v);
+        return (msb - SUB_BITS) * SUB_COUNT + (v >> (msb - SUB_BITS));
+    }
+    /* 桶内最大的值 */
+    static uint64_t upper(int index) {
+        if (index < SUB_COUNT * 2)
+            return index;
+        int shift = index / SUB_COUNT - 1;
+        uint64_t m = index % SUB_COUNT + SUB_COUNT;
+        return ((m + 1) << shift) - 1;
+    }
+
+    void record(uint64_t v) {
+        ++buckets[bucket(v)];
+        ++count;
+        sum += v;
+    }
+    void add(const histogram &other) {
+        count += other.count;
+        sum += other.sum;
+        for (int i = 0; i < BUCKETS; ++i)
+            buckets[i] += other.buckets[i];
+    }
+
+    /* q 分位数(0~1), 取所在桶的上界; 没有数据时为 0 */
+    uint64_t quantile(double q) const {
+        if (count == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * count);
+        if (rank >= count)
+            rank = count - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i];
+            if (seen > rank)
+                return upper(i);
+        }
+        return upper(BUCKETS - 1);
+    }
+    uint64_t max() const {
+        for (int i = BUCKETS - 1; i >= 0; --i) {
+            if (buckets[i])
+                return upper(i);
+        }
+        return 0;
+    }
+};
+
+#endif  // HISTOGRAM_H
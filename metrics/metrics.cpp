@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <string.h>
+#include "metrics.h"
+
+namespace {
+
+struct counter_def {
+    const char *name;
+    const char *help;
+};
+
+// 和 metrics::COUNTER 的顺序相同
+const counter_def counter_defs[metrics::COUNTER_COUNT] = {
+    {"tws_accepts_total", "Accepted connections."},
+    {"tws_rejects_total", "Connections refused because the server was full."},
+    {"tws_responses_total{code=\"1xx\"}", "Responses sent, by status class."},
+    {"tws_responses_total{code=\"2xx\"}", NULL},
+    {"tws_responses_total{code=\"3xx\"}", NULL},
+    {"tws_responses_total{code=\"4xx\"}", NULL},
+    {"tws_responses_total{code=\"5xx\"}", NULL},
+    {"tws_received_bytes_total", "Bytes read from clients."},
+    {"tws_sent_bytes_total", "Bytes written to clients."},
+    {"tws_timer_expirations_total", "Connections closed by the idle timer."},
+};
+
+// 和 metrics::PHASE 的顺序相同
+const char *phase_names[metrics::PHASE_COUNT] = {
+    "connect", "queue", "parse", "handler", "db", "first_write", "response", "timer_tick",
+};
+
+const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+/* 指标名去掉标签的部分 */
+std::string base_name(const std::string &name) {
+    return name.substr(0, name.find('{'));
+}
+
+/* 同名指标只在第一次出现时输出 HELP 和 TYPE */
+void append_metric(std::string &out, std::string &last, const std::string &name, const char *help, const char *type,
+                   long long value) {
+    char buf[64];
+    std::string base = base_name(name);
+    if (base != last) {
+        out += "# HELP " + base + " " + (help ? help : "") + "\n";
+        out += "# TYPE " + base + " " + type + "\n";
+        last = base;
+    }
+    snprintf(buf, sizeof(buf), " %lld\n", value);
+    out += name;
+    out += buf;
+}
+
+}  // namespace
+
+thread_local metrics::holder metrics::t_holder = {NULL};
+
+metrics *metrics::get_instance() {
+    static metrics instance;
+    return &instance;
+}
+
+metrics::metrics() {
+    memset(m_retired, 0, sizeof(m_retired));
+}
+
+metrics::~metrics() {}
+
+metrics::holder::~holder() {
+    if (s)
+        metrics::get_instance()->retire(s);
+}
+
+metrics::shard *metrics::thread_shard() {
+    shard *s = new shard;
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+        s->value[i].store(0, std::memory_order_relaxed);
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        s->hist_sum[i].store(0, std::memory_order_relaxed);
+        for (int j = 0; j < histogram::BUCKETS; ++j)
+            s->hist[i][j].store(0, std::memory_order_relaxed);
+    }
+    m_lock.lock();
+    m_shards.push_back(s);
+    m_lock.unlock();
+    t_shard = s;
+    t_holder.s = s;
+    return s;
+}
+
+void metrics::retire(shard *s) {
+    m_lock.lock();
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+        m_retired[i] += s->value[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        histogram &h = m_retired_hist[i];
+        h.sum += s->hist_sum[i].load(std::memory_order_relaxed);
+        for (int j = 0; j < histogram::BUCKETS; ++j) {
+            long long n = s->hist[i][j].load(std::memory_order_relaxed);
+            h.buckets[j] += n;
+            h.count += n;
+        }
+    }
+    for (size_t i = 0; i < m_shards.size(); ++i) {
+        if (m_shards[i] == s) {
+            m_shards.erase(m_shards.begin() + i);
+            break;
+        }
+    }
+    m_lock.unlock();
+    t_shard = NULL;
+    delete s;
+}
+
+void metrics::add_sampler(const char *name, const char *help, const char *type, sampler fn, void *ctx) {
+    sampled m;
+    m.name = name;
+    m.help = help ? help : "";
+    m.type = type;
+    m.fn = fn;
+    m.ctx = ctx;
+    m_lock.lock();
+    m_samplers.push_back(m);
+    m_lock.unlock();
+}
+
+void metrics::render(std::string &out) {
+    long long total[COUNTER_COUNT];
+    std::string last;
+
+    m_lock.lock();
+    memcpy(total, m_retired, sizeof(total));
+    for (size_t i = 0; i < m_shards.size(); ++i) {
+        for (int j = 0; j < COUNTER_COUNT; ++j)
+            total[j] += m_shards[i]->value[j].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+        append_metric(out, last, counter_defs[i].name, counter_defs[i].help, "counter", total[i]);
+
+    /* 直方图在抓取时才合并, 以分位数输出 */
+    histogram *hist = new histogram[PHASE_COUNT];
+    merge(hist);
+    out += "# HELP tws_latency_us Request phase latency in microseconds.\n";
+    out += "# TYPE tws_latency_us summary\n";
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        char buf[128];
+        for (size_t j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j) {
+            snprintf(buf, sizeof(buf), "tws_latency_us{phase=\"%s\",quantile=\"%g\"} %llu\n", phase_names[i],
+                     quantiles[j], (unsigned long long)hist[i].quantile(quantiles[j]));
+            out += buf;
+        }
+        snprintf(buf, sizeof(buf), "tws_latency_us_sum{phase=\"%s\"} %llu\n", phase_names[i],
+                 (unsigned long long)hist[i].sum);
+        out += buf;
+        snprintf(buf, sizeof(buf), "tws_latency_us_count{phase=\"%s\"} %llu\n", phase_names[i],
+                 (unsigned long long)hist[i].count);
+        out += buf;
+    }
+    delete[] hist;
+    last = "tws_latency_us";
+    for (size_t i = 0; i < m_samplers.size(); ++i) {
+        const sampled &m = m_samplers[i];
+        append_metric(out, last, m.name, m.help.c_str(), m.type.c_str(), m.fn(m.ctx));
+    }
+    m_lock.unlock();
+}
+
+void metrics::merge(histogram *out) {
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        out[i] = m_retired_hist[i];
+        for (size_t k = 0; k < m_shards.size(); ++k) {
+            shard *s = m_shards[k];
+            out[i].sum += s->hist_sum[i].load(std::memory_order_relaxed);
+            for (int j = 0; j < histogram::BUCKETS; ++j) {
+                long long n = s->hist[i][j].load(std::memory_order_relaxed);
+                out[i].buckets[j] += n;
+                out[i].count += n;
+            }
+        }
+    }
+}
+
+void metrics::latency_report(std::vector<std::string> &lines) {
+    histogram *hist = new histogram[PHASE_COUNT];
+    m_lock.lock();
+    merge(hist);
+    m_lock.unlock();
+
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        const histogram &h = hist[i];
+        char buf[256];
+        snprintf(buf, sizeof(buf), "latency %-11s count %llu avg %llu p50 %llu p90 %llu p99 %llu p999 %llu max %llu us",
+                 phase_names[i], (unsigned long long)h.count, (unsigned long long)(h.count ? h.sum / h.count : 0),
+                 (unsigned long long)h.quantile(0.5), (unsigned long long)h.quantile(0.9),
+                 (unsigned long long)h.quantile(0.99), (unsigned long long)h.quantile(0.999),
+                 (unsigned long long)h.max());
+        lines.push_back(buf);
+    }
+    delete[] hist;
+}
@@ -0,0 +1,137 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "locker.h"
+#include "histogram.h"
+
+/*************************************************************
+ * 运行指标
+ *
+ *   - 计数器按线程分片: 每个线程第一次记录时创建自己的一组(shard),
+ *     整组按缓存行对齐, 只由本线程写; 记录时不加锁, 也没有原子读改写
+ *   - 请求各阶段的耗时记录在同样按线程分片的对数直方图中(见 histogram.h),
+ *     /metrics 中以分位数输出, SIGUSR1 时写入日志
+ *   - 抓取 /metrics 时才把所有线程的值加起来, 线程退出时它的值并入 m_retired
+ *   - 连接数、队列长度、连接池占用这类别处已经维护好的数值,
+ *     注册采样函数, 抓取时读取
+ *   - 输出 Prometheus 文本格式
+ **************************************************************/
+class metrics {
+public:
+    enum COUNTER {
+        ACCEPTS = 0,        // 接受的连接
+        REJECTS,            // 连接数已满被拒绝的连接
+        RESPONSES_1XX,      // 按状态码分类的响应数, 顺序不能变, 见 add_status
+        RESPONSES_2XX,
+        RESPONSES_3XX,
+        RESPONSES_4XX,
+        RESPONSES_5XX,
+        BYTES_IN,           // 从客户端读到的字节数
+        BYTES_OUT,          // 发送给客户端的字节数
+        TIMER_EXPIRED,      // 超时关闭的连接
+        COUNTER_COUNT
+    };
+
+    /* 请求生命周期中的阶段, 单位微秒 */
+    enum PHASE {
+        PHASE_CONNECT = 0,  // 接受连接到处理第一个请求的第一段数据
+        PHASE_QUEUE,        // 在线程池请求队列中等待
+        PHASE_PARSE,        // 解析请求(process_read), 不含处理函数
+        PHASE_HANDLER,      // 处理函数(do_request)
+        PHASE_DB,           // 查询用户存储, 异步查询从提交到完成
+        PHASE_FIRST_WRITE,  // 响应就绪到第一次写出数据
+        PHASE_RESPONSE,     // 请求的第一段数据到响应发送完毕
+        PHASE_TIMER_TICK,   // 不属于请求: 主线程处理一次定时器到期(timer_heap::tick)
+        PHASE_COUNT
+    };
+
+    /* 采样函数, 抓取时调用 */
+    typedef long long (*sampler)(void *ctx);
+
+public:
+    static metrics *get_instance();
+
+    /* 热路径: 只写本线程的分片 */
+    static void add(int id, long long value = 1) {
+        shard *s = t_shard ? t_shard : get_instance()->thread_shard();
+        bump(s->value[id], value);
+    }
+    static void record(int phase, long long usec) {
+        if (usec < 0)
+            usec = 0;
+        shard *s = t_shard ? t_shard : get_instance()->thread_shard();
+        bump(s->hist[phase][histogram::bucket(usec)], 1);
+        bump(s->hist_sum[phase], usec);
+    }
+    /* 阶段计时用的单调时钟(微秒) */
+    static long long now_usec() {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+    }
+    static void add_status(int status) {
+        if (status >= 100 && status < 600)
+            add(RESPONSES_1XX + status / 100 - 1);
+    }
+
+    /*
+        注册采样指标, name 可以带标签, 如 tws_log_dropped_total{log="access"};
+        同名(不计标签)的指标要连续注册, 共用第一个的 help 和 type
+     */
+    void add_sampler(const char *name, const char *help, const char *type, sampler fn, void *ctx);
+
+    /* 汇总所有线程的分片和采样值, 追加到 out */
+    void render(std::string &out);
+    /* 各阶段耗时的汇总, 每个阶段一行 */
+    void latency_report(std::vector<std::string> &lines);
+
+private:
+    struct alignas(64) shard {
+        std::atomic<long long> value[COUNTER_COUNT];
+        std::atomic<long long> hist_sum[PHASE_COUNT];
+        std::atomic<long long> hist[PHASE_COUNT][histogram::BUCKETS];
+    };
+    struct sampled {
+        std::string name;
+        std::string help;
+        std::string type;
+        sampler fn;
+        void *ctx;
+    };
+
+    metrics();
+    ~metrics();
+
+    /* 线程退出时把分片交还 */
+    struct holder {
+        shard *s;
+        ~holder();
+    };
+
+    /* 只有本线程写, 不需要原子的读改写 */
+    static void bump(std::atomic<long long> &a, long long value) {
+        a.store(a.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    /* 当前线程的分片, 第一次调用时创建 */
+    shard *thread_shard();
+    void retire(shard *s);
+    /* 合并所有线程的直方图, 调用时持有 m_lock */
+    void merge(histogram *out);
+
+private:
+    inline static thread_local shard *t_shard = NULL;
+    static thread_local holder t_holder;
+
+    locker m_lock;                     // 只在线程登记/退出、注册采样函数和抓取时使用
+    std::vector<shard *> m_shards;
+    long long m_retired[COUNTER_COUNT];  // 已退出线程的累计值
+    histogram m_retired_hist[PHASE_COUNT];
+    std::vector<sampled> m_samplers;
+};
+
+#endif  // METRICS_H
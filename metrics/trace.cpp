@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+namespace {
+
+// 和 tracer::SPAN 的顺序相同
+const char *span_names[tracer::SPAN_COUNT] = {
+    "accept", "read_once", "queue", "process_read", "do_request", "db", "writev", "sendfile",
+};
+
+long long mono_nsec() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+struct event {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t info;
+};
+
+}  // namespace
+
+tracer *tracer::get_instance() {
+    static tracer instance;
+    return &instance;
+}
+
+tracer::tracer() : m_start_ticks(0), m_start_nsec(0) {}
+
+tracer::~tracer() {}
+
+void tracer::init(const std::string &path) {
+    m_path = path;
+    m_start_nsec = mono_nsec();
+    m_start_ticks = ticks();
+    m_on = true;
+}
+
+void tracer::thread_name(const char *name) {
+    if (!m_on)
+        return;
+    ring *r = t_ring ? t_ring : get_instance()->thread_ring();
+    snprintf(r->name, sizeof(r->name), "%s", name);
+}
+
+tracer::ring *tracer::thread_ring() {
+    ring *r = new ring;
+    r->next.store(0, std::memory_order_relaxed);
+    r->tid = (int)syscall(SYS_gettid);
+    snprintf(r->name, sizeof(r->name), "thread");
+    t_ring = r;
+
+    m_lock.lock();
+    m_rings.push_back(r);
+    m_lock.unlock();
+    return r;
+}
+
+int tracer::dump(std::string &file) {
+    if (!m_on)
+        return -1;
+
+    time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char suffix[32];
+    strftime(suffix, sizeof(suffix), "_%Y%m%d_%H%M%S.json", &tm);
+    file = m_path + suffix;
+
+    FILE *fp = fopen(file.c_str(), "w");
+    if (!fp)
+        return -1;
+
+    // 开启以来 TSC 走过的数和单调时钟对比, 得到每微秒的 TSC 数
+    long long nsec = mono_nsec() - m_start_nsec;
+    double per_usec = nsec > 0 ? (double)(ticks() - m_start_ticks) * 1000 / nsec : 1;
+    int pid = getpid();
+
+    m_lock.lock();
+    std::vector<ring *> rings = m_rings;
+    m_lock.unlock();
+
+    int count = 0;
+    std::vector<event> events;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"webserver\"}}", pid);
+    for (size_t i = 0; i < rings.size(); ++i) {
+        ring *r = rings[i];
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid,
+                r->tid, r->name);
+
+        // 先复制出来再检查: 复制期间被覆盖的记录, 以及正在写的那一条, 都丢掉
+        uint64_t end = r->next.load(std::memory_order_acquire);
+        uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+        events.resize(end - begin);
+        for (uint64_t n = begin; n < end; ++n) {
+            record &rec = r->rec[n & (RING_SIZE - 1)];
+            events[n - begin].begin = rec.begin.load(std::memory_order_relaxed);
+            events[n - begin].end = rec.end.load(std::memory_order_relaxed);
+            events[n - begin].info = rec.info.load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t now = r->next.load(std::memory_order_relaxed);
+        uint64_t valid = now + 1 > RING_SIZE ? now + 1 - RING_SIZE : 0;
+
+        for (uint64_t n = begin > valid ? begin : valid; n < end; ++n) {
+            const event &e = events[n - begin];
+            int name = e.info & 0x7f;
+            bool async = e.info & 0x80;
+            int fd = (e.info >> 8) & 0xffffff;
+            uint32_t id = e.info >> 32;
+            if (name >= SPAN_COUNT)
+                continue;
+            double ts = ((double)e.begin - (double)m_start_ticks) / per_usec;
+            double dur = e.end > e.begin ? (double)(e.end - e.begin) / per_usec : 0;
+
+            if (async) {
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"b\",\"id\":%u,\"pid\":%d,\"tid\":%d,"
+                        "\"ts\":%.3f,\"args\":{\"fd\":%d,\"req\":%u}}",
+                        span_names[name], id, pid, r->tid, ts, fd, id);
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"e\",\"id\":%u,\"pid\":%d,\"tid\":%d,"
+                        "\"ts\":%.3f}",
+                        span_names[name], id, pid, r->tid, ts + dur);
+            } else {
+                fprintf(fp,
+                        ",\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"fd\":%d,\"req\":%u}}",
+                        span_names[name], pid, r->tid, ts, dur, fd, id);
+            }
+            ++count;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0)
+        return -1;
+    return count;
+}
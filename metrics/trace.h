@@ -0,0 +1,142 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "locker.h"
+
+/*************************************************************
+ * 逐请求追踪(默认关闭, -X 指定输出文件时开启)
+ *
+ *   - 记录请求经过的各段: accept、read_once、排队、process_read、do_request、
+ *     数据库查询、每次 writev/sendfile, 每段一条记录(开始和结束时间、fd、请求编号)
+ *   - 每个线程第一次记录时创建自己的环形缓冲区, 只由本线程写, 写满后覆盖最旧的记录;
+ *     导出时不停下写入的线程, 可能被覆盖的记录丢掉不输出
+ *   - 时间取 TSC(rdtsc), 导出时用开启时和导出时的单调时钟换算成微秒;
+ *     要求 TSC 在各个核上同步(constant_tsc/nonstop_tsc), 不是 x86 时用单调时钟
+ *   - 开始和结束在不同线程的段(排队、异步查询)输出为异步事件, 按请求编号归到一行
+ *   - SIGUSR1 时导出为 Chrome trace-event JSON, 用 chrome://tracing 或 ui.perfetto.dev 打开
+ *   - 关闭时每个记录点只多读一次 m_on
+ **************************************************************/
+class tracer {
+public:
+    enum SPAN {
+        SPAN_ACCEPT = 0,    // 主线程: accept 和连接初始化
+        SPAN_READ,          // read_once
+        SPAN_QUEUE,         // 在线程池请求队列中等待, 异步
+        SPAN_PARSE,         // process_read, 包含 do_request
+        SPAN_HANDLER,       // do_request
+        SPAN_DB,            // 同步查询用户存储, 或异步查询从提交到完成(异步)
+        SPAN_WRITEV,        // 每次 writev
+        SPAN_SENDFILE,      // 每次 sendfile
+        SPAN_COUNT
+    };
+
+    static const uint32_t RING_SIZE = 1 << 16;  // 每个线程保留的记录数, 必须是2的幂
+
+public:
+    static tracer *get_instance();
+
+    /* 开启追踪, 在创建其他线程之前调用; path 是导出文件名的前缀 */
+    void init(const std::string &path);
+    static bool on() { return m_on; }
+
+    /* 当前线程在导出文件中显示的名字, 不调用时显示为 thread */
+    static void thread_name(const char *name);
+
+    static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+    }
+
+    /* 一个请求的编号, 同一个请求各段的记录用它关联 */
+    static uint32_t next_id() { return m_next_id.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+    /* 记录一段, 开始和结束都在本线程 */
+    static void span(int name, int fd, uint32_t id, uint64_t begin, uint64_t end) {
+        put(name, fd, id, begin, end, false);
+    }
+    /* 记录一段, 开始在别的线程 */
+    static void async_span(int name, int fd, uint32_t id, uint64_t begin, uint64_t end) {
+        put(name, fd, id, begin, end, true);
+    }
+
+    /* 写出所有线程的记录, 返回写出的段数, 失败返回 -1; file 为实际写入的文件名 */
+    int dump(std::string &file);
+
+private:
+    /* 各字段分开写, 导出线程读到的可能是写了一半的记录, 由 ring::next 判断丢掉 */
+    struct record {
+        std::atomic<uint64_t> begin;
+        std::atomic<uint64_t> end;
+        std::atomic<uint64_t> info;  // 请求编号 << 32 | fd << 8 | 异步标记 << 7 | 段
+    };
+    struct ring {
+        std::atomic<uint64_t> next;  // 下一条记录的序号, 只增不减
+        int tid;
+        char name[16];
+        record rec[RING_SIZE];
+    };
+
+    tracer();
+    ~tracer();
+
+    static void put(int name, int fd, uint32_t id, uint64_t begin, uint64_t end, bool async) {
+        if (!m_on)
+            return;
+        ring *r = t_ring ? t_ring : get_instance()->thread_ring();
+        uint64_t n = r->next.load(std::memory_order_relaxed);
+        record &rec = r->rec[n & (RING_SIZE - 1)];
+        // 和 dump 中的 acquire 配对: 导出线程读到这条的新内容时, 一定也能看到 next 已经是 n
+        std::atomic_thread_fence(std::memory_order_release);
+        rec.begin.store(begin, std::memory_order_relaxed);
+        rec.end.store(end, std::memory_order_relaxed);
+        rec.info.store((uint64_t)id << 32 | (uint64_t)(fd & 0xffffff) << 8 | (async ? 0x80 : 0) | name,
+                       std::memory_order_relaxed);
+        r->next.store(n + 1, std::memory_order_release);
+    }
+
+    /* 当前线程的环形缓冲区, 第一次调用时创建 */
+    ring *thread_ring();
+
+private:
+    inline static bool m_on = false;
+    inline static std::atomic<uint32_t> m_next_id{0};
+    inline static thread_local ring *t_ring = NULL;
+
+    std::string m_path;
+    uint64_t m_start_ticks;     // 开启时的 TSC 和单调时钟, 导出时换算时间
+    long long m_start_nsec;
+    locker m_lock;              // 只在线程登记和导出时使用
+    std::vector<ring *> m_rings;  // 线程退出后也保留, 它的记录照常导出
+};
+
+/* 在作用域内记录一段, 没有开启追踪时不取时间 */
+class trace_span {
+public:
+    trace_span(int name, int fd, uint32_t id)
+        : m_name(name), m_fd(fd), m_id(id), m_begin(tracer::on() ? tracer::ticks() : 0) {}
+    ~trace_span() {
+        if (m_begin)
+            tracer::span(m_name, m_fd, m_id, m_begin, tracer::ticks());
+    }
+
+private:
+    int m_name;
+    int m_fd;
+    uint32_t m_id;
+    uint64_t m_begin;
+};
+
+#endif  // TRACE_H
@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "file_backend.h"
+
+file_backend::file_backend() : m_fd(-1), m_sync(true), m_size(0) {
+    pthread_mutex_init(&m_append_lock, NULL);
+    pthread_rwlock_init(&m_lock, NULL);
+}
+
+file_backend::~file_backend() {
+    if (m_fd >= 0)
+        close(m_fd);
+    pthread_mutex_destroy(&m_append_lock);
+    pthread_rwlock_destroy(&m_lock);
+}
+
+bool file_backend::open(const char *path, bool sync) {
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (m_fd < 0)
+        return false;
+    m_sync = sync;
+    if (!load()) {
+        int err = errno;
+        close(m_fd);
+        m_fd = -1;
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+/* Fletcher-16 */
+uint16_t file_backend::checksum(const std::string &name, const std::string &password) {
+    uint16_t a = 0, b = 0;
+    const std::string *parts[2] = {&name, &password};
+    for (int p = 0; p < 2; ++p) {
+        for (size_t i = 0; i < parts[p]->size(); ++i) {
+            a = (a + (unsigned char)(*parts[p])[i]) % 255;
+            b = (b + a) % 255;
+        }
+    }
+    return (b << 8) | a;
+}
+
+bool file_backend::load() {
+    struct stat st;
+    if (fstat(m_fd, &st) < 0)
+        return false;
+
+    std::string data(st.st_size, '\0');
+    size_t got = 0;
+    while (got < data.size()) {
+        ssize_t n = pread(m_fd, &data[got], data.size() - got, got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        got += n;
+    }
+
+    size_t pos = 0;
+    while (pos + sizeof(record_header) <= data.size()) {
+        record_header hdr;
+        memcpy(&hdr, &data[pos], sizeof(hdr));
+        size_t end = pos + sizeof(hdr) + hdr.name_len + hdr.password_len;
+        if (end > data.size())
+            break;
+
+        std::string name(data, pos + sizeof(hdr), hdr.name_len);
+        std::string password(data, pos + sizeof(hdr) + hdr.name_len, hdr.password_len);
+        if (checksum(name, password) != hdr.check) {
+            // 只有最后一条可能是崩溃时没写完的; 后面还有数据说明文件中间损坏, 不能截掉
+            if (end < data.size()) {
+                errno = EBADMSG;
+                return false;
+            }
+            break;
+        }
+        m_users[name] = password;
+        pos = end;
+    }
+
+    /*
+        剩下的是没写完的最后一条: 不到一条记录的最大长度. 更长说明某条记录的
+        长度字段坏了, 后面的记录无法定位, 同样不截断
+     */
+    if (data.size() - pos > sizeof(record_header) + 2 * 255) {
+        errno = EBADMSG;
+        return false;
+    }
+    m_size = pos;
+    if (pos < data.size() && ftruncate(m_fd, pos) < 0)
+        return false;
+    return true;
+}
+
+int file_backend::find_user(const std::string &name, std::string *password) {
+    pthread_rwlock_rdlock(&m_lock);
+    std::unordered_map<std::string, std::string>::iterator it = m_users.find(name);
+    bool found = it != m_users.end();
+    if (found && password)
+        *password = it->second;
+    pthread_rwlock_unlock(&m_lock);
+    return found ? 1 : 0;
+}
+
+unsigned int file_backend::add_user(const std::string &name, const std::string &password) {
+    if (name.size() > 255 || password.size() > 255)
+        return EINVAL;
+
+    record_header hdr;
+    hdr.name_len = name.size();
+    hdr.password_len = password.size();
+    hdr.check = checksum(name, password);
+    std::string record((const char *)&hdr, sizeof(hdr));
+    record += name;
+    record += password;
+
+    /* 只有持有追加锁的线程会插入 m_users, 重名检查到插入之间不会有别的新增 */
+    pthread_mutex_lock(&m_append_lock);
+    if (m_fd < 0) {
+        pthread_mutex_unlock(&m_append_lock);
+        return EBADF;
+    }
+    pthread_rwlock_rdlock(&m_lock);
+    bool exists = m_users.count(name) > 0;
+    pthread_rwlock_unlock(&m_lock);
+    if (exists) {
+        pthread_mutex_unlock(&m_append_lock);
+        return DUPLICATE;
+    }
+
+    // 在失败的调用之后立刻取 errno, 之后的 ftruncate 会覆盖它
+    unsigned int err = 0;
+    ssize_t n = write(m_fd, record.data(), record.size());
+    if (n != (ssize_t)record.size())
+        err = n < 0 ? errno : EIO;
+    else if (m_sync && fdatasync(m_fd) < 0)
+        err = errno;
+    if (err) {
+        // 去掉写了一半的记录, 文件仍以完整记录结尾
+        if (ftruncate(m_fd, m_size) < 0)
+            err = errno;
+        pthread_mutex_unlock(&m_append_lock);
+        return err;
+    }
+    m_size += record.size();
+
+    pthread_rwlock_wrlock(&m_lock);
+    m_users[name] = password;
+    pthread_rwlock_unlock(&m_lock);
+    pthread_mutex_unlock(&m_append_lock);
+    return 0;
+}
+
+size_t file_backend::size() {
+    pthread_rwlock_rdlock(&m_lock);
+    size_t n = m_users.size();
+    pthread_rwlock_unlock(&m_lock);
+    return n;
+}
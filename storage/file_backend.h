@@ -0,0 +1,49 @@
+#ifndef FILE_BACKEND_H
+#define FILE_BACKEND_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include "user_backend.h"
+
+/*************************************************************
+ * 本地文件存储
+ *
+ * 数据文件只追加, 每个用户一条记录: 头部(用户名长度, 密码长度, 校验和)
+ * 后接用户名和密码. 启动时顺序读一遍建立内存索引, 末尾写了一半的
+ * 记录(崩溃时)被截掉; 中间的记录校验失败时打开失败, 不改动文件. 查询只查内存, 新增时先写文件再更新索引;
+ * 写文件和落盘只持有追加锁, 等 fdatasync 时不挡住查询
+ **************************************************************/
+class file_backend : public user_backend {
+public:
+    file_backend();
+    ~file_backend();
+
+    /* 打开数据文件, 不存在时创建; sync 为 true 时每次新增都落盘; 文件中间损坏时返回 false */
+    bool open(const char *path, bool sync = true);
+
+    int find_user(const std::string &name, std::string *password);
+    unsigned int add_user(const std::string &name, const std::string &password);
+    size_t size();
+
+private:
+    struct record_header {
+        uint8_t name_len;
+        uint8_t password_len;
+        uint16_t check;  // 用户名和密码的校验和
+    };
+
+    static uint16_t checksum(const std::string &name, const std::string &password);
+    bool load();
+
+private:
+    int m_fd;
+    bool m_sync;
+    off_t m_size;  // 最后一条完整记录的结尾, 由 m_append_lock 保护
+    pthread_mutex_t m_append_lock;  // 串行化新增: 重名检查、写文件、落盘
+    pthread_rwlock_t m_lock;        // 保护 m_users, 写锁只在插入索引时持有
+    std::unordered_map<std::string, std::string> m_users;
+};
+
+#endif  // FILE_BACKEND_H
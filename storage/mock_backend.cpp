@@ -0,0 +1,83 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mock_backend.h"
+
+mock_backend::mock_backend(int pool_size)
+    : m_pool_size(pool_size > 0 ? pool_size : 1), m_latency(1000), m_jitter(0), m_free(m_pool_size), m_used(0) {
+    pthread_rwlock_init(&m_lock, NULL);
+}
+
+mock_backend::~mock_backend() {
+    pthread_rwlock_destroy(&m_lock);
+}
+
+bool mock_backend::init(const char *spec) {
+    // 整个串都必须是逗号分隔的数字, 拼错时不能只用解析出的前半部分压测
+    long values[3] = {0, 0, 10000};
+    const char *p = spec;
+    for (int i = 0;; ++i) {
+        char *end;
+        errno = 0;
+        values[i] = strtol(p, &end, 10);
+        if (end == p || errno != 0)
+            return false;
+        if (*end == '\0')
+            break;
+        if (*end != ',' || i == 2)
+            return false;
+        p = end + 1;
+    }
+    long latency = values[0], jitter = values[1], users = values[2];
+    if (latency < 0 || jitter < 0 || jitter > latency || users < 0)
+        return false;
+    m_latency = latency;
+    m_jitter = jitter;
+
+    char name[32];
+    for (long i = 0; i < users; ++i) {
+        snprintf(name, sizeof(name), "user%ld", i);
+        m_users[name] = PASSWORD;
+    }
+    return true;
+}
+
+void mock_backend::begin_query() {
+    m_free.wait();
+    m_used.fetch_add(1, std::memory_order_relaxed);
+
+    long usec = m_latency;
+    if (m_jitter > 0) {
+        thread_local unsigned int seed = (unsigned int)pthread_self();
+        usec += rand_r(&seed) % (2 * m_jitter + 1) - m_jitter;
+    }
+    if (usec > 0)
+        usleep(usec);
+}
+
+void mock_backend::end_query() {
+    m_used.fetch_sub(1, std::memory_order_relaxed);
+    m_free.post();
+}
+
+int mock_backend::find_user(const std::string &name, std::string *password) {
+    begin_query();
+    pthread_rwlock_rdlock(&m_lock);
+    std::unordered_map<std::string, std::string>::iterator it = m_users.find(name);
+    bool found = it != m_users.end();
+    if (found && password)
+        *password = it->second;
+    pthread_rwlock_unlock(&m_lock);
+    end_query();
+    return found ? 1 : 0;
+}
+
+unsigned int mock_backend::add_user(const std::string &name, const std::string &password) {
+    begin_query();
+    pthread_rwlock_wrlock(&m_lock);
+    bool inserted = m_users.emplace(name, password).second;
+    pthread_rwlock_unlock(&m_lock);
+    end_query();
+    return inserted ? 0 : DUPLICATE;
+}
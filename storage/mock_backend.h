@@ -0,0 +1,52 @@
+#ifndef MOCK_BACKEND_H
+#define MOCK_BACKEND_H
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "locker.h"
+#include "user_backend.h"
+
+/*************************************************************
+ * 模拟数据库, 用于在没有 MySQL 的机器上压测登录和注册
+ *
+ *   - 和 connection_pool 一样最多 pool_size 个连接(-s), 每次查询先占一个,
+ *     连接用完时工作线程阻塞等待
+ *   - 占住连接后休眠 latency ± jitter 微秒模拟查询, 再读写内存中的用户表
+ *   - 启动时预置 users 个用户 user0 .. user{users-1}, 密码都是 PASSWORD
+ * 调大 latency 模拟数据库变慢, 观察线程数(-t)和连接数(-s)如何相互影响
+ **************************************************************/
+class mock_backend : public user_backend {
+public:
+    static constexpr const char *PASSWORD = "mock";
+
+public:
+    explicit mock_backend(int pool_size);
+    ~mock_backend();
+
+    /* spec 为 "latency[,jitter[,users]]", 单位微秒, 如 "2000,500,10000"; 格式不对时返回 false */
+    bool init(const char *spec);
+
+    int find_user(const std::string &name, std::string *password);
+    unsigned int add_user(const std::string &name, const std::string &password);
+
+    int used() const { return m_used.load(std::memory_order_relaxed); }
+    int max_conn() const { return m_pool_size; }
+
+private:
+    /* 占一个连接并等待模拟的查询耗时, 返回后调用者持有连接 */
+    void begin_query();
+    void end_query();
+
+private:
+    int m_pool_size;
+    long m_latency;
+    long m_jitter;
+    sem m_free;                  // 空闲连接数
+    std::atomic<int> m_used;
+    pthread_rwlock_t m_lock;
+    std::unordered_map<std::string, std::string> m_users;
+};
+
+#endif  // MOCK_BACKEND_H
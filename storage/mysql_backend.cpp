@@ -0,0 +1,29 @@
+#include "mysql_backend.h"
+#include "sql_stmt.h"
+
+int mysql_backend::find_user(const std::string &name, std::string *password) {
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+    stmt_cache *stmts = m_pool->GetStatements(mysql);
+    if (!stmts)
+        return -1;
+
+    std::string value;
+    bool found = false;
+    if (stmt_execute(mysql, stmts, STMT_SELECT_USER, &name, &value, &found) != 0)
+        return -1;
+    if (found && password)
+        *password = value;
+    return found ? 1 : 0;
+}
+
+unsigned int mysql_backend::add_user(const std::string &name, const std::string &password) {
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+    stmt_cache *stmts = m_pool->GetStatements(mysql);
+    if (!stmts)
+        return 2000;  // CR_UNKNOWN_ERROR
+
+    std::string params[2] = {name, password};
+    return stmt_execute(mysql, stmts, STMT_INSERT_USER, params);
+}
@@ -0,0 +1,19 @@
+#ifndef MYSQL_BACKEND_H
+#define MYSQL_BACKEND_H
+
+#include "user_backend.h"
+#include "sql_connection_pool.h"
+
+/* MySQL user 表, 每次调用从连接池取一个连接, 用完立即归还 */
+class mysql_backend : public user_backend {
+public:
+    explicit mysql_backend(connection_pool *pool) : m_pool(pool) {}
+
+    int find_user(const std::string &name, std::string *password);
+    unsigned int add_user(const std::string &name, const std::string &password);
+
+private:
+    connection_pool *m_pool;
+};
+
+#endif  // MYSQL_BACKEND_H
@@ -0,0 +1,38 @@
+#ifndef USER_BACKEND_H
+#define USER_BACKEND_H
+
+#include <string>
+
+/*************************************************************
+ * 用户数据的存储后端
+ *
+ * 登录和注册只通过这个接口读写用户, 不再直接使用 MYSQL*:
+ *   - mysql_backend: 原来的 MySQL user 表, 经连接池和预处理语句访问
+ *   - file_backend:  本地追加写文件 + 内存索引, 不需要数据库,
+ *                    用于单机部署和在本机压测
+ * 接口在工作线程中同步调用, 实现需要线程安全
+ **************************************************************/
+class user_backend {
+public:
+    static const unsigned int DUPLICATE = 1062;  // 用户名已存在, 和 MySQL 的 ER_DUP_ENTRY 相同
+
+public:
+    virtual ~user_backend() {}
+
+    /* 查询用户, 返回 1 存在, 0 不存在, -1 出错 */
+    virtual int find_user(const std::string &name, std::string *password) = 0;
+    /* 新增用户, 返回0或错误码 */
+    virtual unsigned int add_user(const std::string &name, const std::string &password) = 0;
+
+    /* 当前使用的后端, 启动时设置一次 */
+    static user_backend *get_instance() { return *slot(); }
+    static void set_instance(user_backend *backend) { *slot() = backend; }
+
+private:
+    static user_backend **slot() {
+        static user_backend *backend = NULL;
+        return &backend;
+    }
+};
+
+#endif  // USER_BACKEND_H
@@ -0,0 +1,56 @@
+#!/bin/bash
+# 异步查询(-B 0): 服务器通过 MYSQL_UNIX_PORT 连到 tests/mock_mysqld
+#   - 登录和注册的缓存未命中走异步查询, 结果和同步时相同
+#   - 数据库卡住时挂起的请求在 QUERY_TIMEOUT 加一个定时周期内返回 500, 恢复后照常服务
+
+PORT=${PORT:-9121}
+SOCK=$(mktemp -u /tmp/check_mysqld.XXXXXX)
+OUT=$(mktemp /tmp/check_out.XXXXXX)
+MOCK=
+SERVER=
+trap 'kill $SERVER $MOCK 2>/dev/null; wait $SERVER $MOCK 2>/dev/null; rm -f $SOCK $OUT' EXIT
+
+# 请求 $1, 消息体 $2, 状态码必须是 $3; 为 200 时响应必须和 root/$4 相同
+expect() {
+    code=$(curl -s -m 20 -o $OUT -w '%{http_code}' --data-binary "$2" http://127.0.0.1:$PORT$1)
+    if [ "$code" != "$3" ] || { [ "$3" = 200 ] && ! cmp -s $OUT root/$4; }; then
+        echo "POST $1 $2 got $code, want $3 ${4:+root/$4}" >&2
+        return 1
+    fi
+}
+
+./tests/mock_mysqld -u $SOCK alice:pw &
+MOCK=$!
+for i in $(seq 50); do
+    [ -S $SOCK ] && break
+    sleep 0.1
+done
+
+MYSQL_UNIX_PORT=$SOCK ./server -p $PORT -B 0 -c 1 -A 0 -s 2 >/dev/null 2>&1 &
+SERVER=$!
+for i in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+    sleep 0.1
+done
+
+expect /2CGISQL.cgi "user=alice&passwd=pw" 200 welcome.html || exit 1
+expect /2CGISQL.cgi "user=alice&passwd=no" 200 logError.html || exit 1
+expect /2CGISQL.cgi "user=nobody&passwd=pw" 200 logError.html || exit 1
+expect /3CGISQL.cgi "user=bob&passwd=b1" 200 log.html || exit 1
+expect /3CGISQL.cgi "user=bob&passwd=b2" 200 registerError.html || exit 1
+expect /2CGISQL.cgi "user=bob&passwd=b1" 200 welcome.html || exit 1
+
+# 卡住数据库, 查一个不在缓存里的用户
+kill -USR1 $MOCK
+start=$SECONDS
+expect /2CGISQL.cgi "user=stuck&passwd=pw" 500 || exit 1
+if [ $((SECONDS - start)) -gt 15 ]; then
+    echo "timeout took $((SECONDS - start))s" >&2
+    exit 1
+fi
+
+# 恢复后重连, 同一个用户这次能查到结果
+kill -USR1 $MOCK
+expect /3CGISQL.cgi "user=stuck&passwd=s1" 200 log.html || exit 1
+expect /2CGISQL.cgi "user=stuck&passwd=s1" 200 welcome.html || exit 1
+exit 0
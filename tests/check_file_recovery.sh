@@ -0,0 +1,73 @@
+#!/bin/bash
+# 本地文件存储(-B 1)的恢复:
+#   - 末尾写了一半的记录在启动时截掉, 之前的用户都还在
+#   - 中间的记录损坏时拒绝启动, 文件保持原样
+
+PORT=${PORT:-9123}
+DB=$(mktemp /tmp/check_users.XXXXXX)
+OUT=$(mktemp /tmp/check_out.XXXXXX)
+SERVER=
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -f $DB $DB.orig $OUT' EXIT
+
+start() {
+    ./server -p $PORT -B 1 -F $DB -c 1 -A 0 >/dev/null 2>&1 &
+    SERVER=$!
+    for i in $(seq 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && return 0
+        kill -0 $SERVER 2>/dev/null || return 1
+        sleep 0.1
+    done
+    return 1
+}
+
+stop() {
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+    SERVER=
+}
+
+# 请求 $1, 消息体 $2, 响应必须和 root/$3 相同
+expect() {
+    code=$(curl -s -m 5 -o $OUT -w '%{http_code}' --data-binary "$2" http://127.0.0.1:$PORT$1)
+    if [ "$code" != 200 ] || ! cmp -s $OUT root/$3; then
+        echo "POST $1 $2 got $code, want root/$3" >&2
+        return 1
+    fi
+}
+
+# 每条记录: 4 字节头 + 用户名 + 密码, 这里每条 4 + 2 + 4 = 10 字节
+start || { echo "server did not start" >&2; exit 1; }
+for u in u1 u2 u3; do
+    expect /3CGISQL.cgi "user=$u&passwd=${u}pw" log.html || exit 1
+done
+stop
+size=$(stat -c %s $DB)
+if [ "$size" != 30 ]; then
+    echo "storage is $size bytes, want 30" >&2
+    exit 1
+fi
+
+# 末尾只写了头和一个字节
+printf '\002\003\000\000u' >>$DB
+start || { echo "server did not start with a torn last record" >&2; exit 1; }
+expect /2CGISQL.cgi "user=u3&passwd=u3pw" welcome.html || exit 1
+stop
+if [ "$(stat -c %s $DB)" != 30 ]; then
+    echo "torn record not trimmed: $(stat -c %s $DB) bytes" >&2
+    exit 1
+fi
+
+# 改掉第一条记录密码的一个字节, 后面两条完好
+printf 'X' | dd of=$DB bs=1 seek=6 conv=notrunc 2>/dev/null
+cp $DB $DB.orig
+if start; then
+    echo "server started on a corrupted storage file" >&2
+    exit 1
+fi
+wait $SERVER 2>/dev/null
+SERVER=
+if ! cmp -s $DB $DB.orig; then
+    echo "corrupted storage file was modified" >&2
+    exit 1
+fi
+exit 0
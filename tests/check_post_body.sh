@@ -0,0 +1,36 @@
+#!/bin/bash
+# 大于读缓冲区(256字节)的 POST 消息体: LT(-m 0) 和 ET(-m 3) 下都要收完整个消息体再响应
+# 注册和登录用同一个约 4KB 的消息体, 登录成功说明注册时消息体没有丢
+
+PORT=${PORT:-9120}
+DB=$(mktemp /tmp/check_users.XXXXXX)
+OUT=$(mktemp /tmp/check_out.XXXXXX)
+SERVER=
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -f $DB $OUT' EXIT
+
+# 请求 $1, 消息体 $2, 响应必须和 root/$3 相同
+expect() {
+    code=$(curl -s -m 5 -o $OUT -w '%{http_code}' --data-binary "$2" http://127.0.0.1:$PORT$1)
+    if [ "$code" != 200 ] || ! cmp -s $OUT root/$3; then
+        echo "mode $mode: POST $1 (${#2} bytes) got $code, want root/$3" >&2
+        return 1
+    fi
+}
+
+pad=$(head -c 4000 /dev/zero | tr '\0' x)
+for mode in 0 3; do
+    ./server -p $PORT -B 1 -F $DB -c 1 -A 0 -m $mode >/dev/null 2>&1 &
+    SERVER=$!
+    for i in $(seq 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+        sleep 0.1
+    done
+
+    body="user=big$mode$RANDOM&passwd=pw&pad=$pad"
+    expect /3CGISQL.cgi "$body" log.html || exit 1
+    expect /2CGISQL.cgi "$body" welcome.html || exit 1
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+done
+exit 0
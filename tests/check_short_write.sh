@@ -0,0 +1,33 @@
+#!/bin/bash
+# 短写: 每次 writev 只写出一小段(tests/short_write.so), 响应头和文件分多次发送,
+# 长连接上连续请求的每个响应都必须和文件完全相同
+
+PORT=${PORT:-9122}
+OUT=$(mktemp /tmp/check_out.XXXXXX)
+SERVER=
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null; rm -f $OUT $OUT.*' EXIT
+
+for mode in 0 3; do
+    SHORT_WRITE=13 LD_PRELOAD=./tests/short_write.so ./server -p $PORT -c 1 -A 0 -B 1 -F $OUT.db -m $mode \
+        >/dev/null 2>&1 &
+    SERVER=$!
+    for i in $(seq 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+        sleep 0.1
+    done
+
+    # 一个连接上依次请求, 第二个响应在第一个之后复用连接
+    if ! curl -s -m 60 --limit-rate 200k -o $OUT.1 http://127.0.0.1:$PORT/frame.jpg \
+            -o $OUT.2 http://127.0.0.1:$PORT/judge.html -o $OUT.3 http://127.0.0.1:$PORT/frame.jpg; then
+        echo "mode $mode: request failed" >&2
+        exit 1
+    fi
+    if ! cmp -s $OUT.1 root/frame.jpg || ! cmp -s $OUT.2 root/judge.html || ! cmp -s $OUT.3 root/frame.jpg; then
+        echo "mode $mode: response body differs" >&2
+        exit 1
+    fi
+
+    kill $SERVER
+    wait $SERVER 2>/dev/null
+done
+exit 0
@@ -0,0 +1,557 @@
+/*
+    测试用的模拟 MySQL 服务器, 只实现服务器用到的那部分协议
+    ./mock_mysqld [选项] [用户名:密码]...
+      -u 路径      监听的 unix 套接字, 服务器连接 localhost 时用
+                   MYSQL_UNIX_PORT 环境变量指过来
+      -p 端口      同时监听 127.0.0.1 上的 TCP 端口, 默认不监听
+      -l 毫秒      每次执行预处理语句前的延迟, 默认 0
+    命令行上的用户预先放进 user 表, 表只在内存里, 退出即丢失
+
+    支持的命令:
+      - 握手: mysql_native_password, 不校验用户名和密码, 不支持 SSL
+      - COM_QUERY: 一律返回 OK, 够组提交的 START TRANSACTION / COMMIT 用
+      - COM_STMT_PREPARE / EXECUTE / CLOSE / RESET: 只认 sql_stmt.h 中的
+        INSERT INTO user 和 SELECT passwd FROM user, 重名时返回 1062
+      - COM_PING / COM_INIT_DB / COM_QUIT
+
+    收到 SIGUSR1 时切换卡住状态: 卡住时查询和预处理语句都不响应, 直到再次
+    收到 SIGUSR1; ping 和新连接照常响应, 模拟数据库卡在慢查询上
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+/* 协议常量, 见 MySQL 源码 include/mysql_com.h */
+enum {
+    COM_QUIT = 0x01,
+    COM_INIT_DB = 0x02,
+    COM_QUERY = 0x03,
+    COM_PING = 0x0e,
+    COM_STMT_PREPARE = 0x16,
+    COM_STMT_EXECUTE = 0x17,
+    COM_STMT_CLOSE = 0x19,
+    COM_STMT_RESET = 0x1a,
+};
+
+enum {
+    CLIENT_LONG_PASSWORD = 1,
+    CLIENT_LONG_FLAG = 4,
+    CLIENT_CONNECT_WITH_DB = 8,
+    CLIENT_PROTOCOL_41 = 512,
+    CLIENT_TRANSACTIONS = 8192,
+    CLIENT_SECURE_CONNECTION = 32768,
+    CLIENT_MULTI_RESULTS = 1 << 17,
+    CLIENT_PS_MULTI_RESULTS = 1 << 18,
+    CLIENT_PLUGIN_AUTH = 1 << 19,
+};
+
+const int SERVER_STATUS_AUTOCOMMIT = 2;
+const int TYPE_VAR_STRING = 0xfd;
+const int CHARSET_UTF8 = 33;
+
+/* 预处理语句: 只区分插入和查询 */
+enum STMT_KIND { STMT_INSERT, STMT_SELECT };
+
+struct stmt {
+    STMT_KIND kind;
+    int params;
+    std::vector<int> types;  // 上次执行绑定的参数类型, 之后的执行可以不再发送
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::string> g_users;
+static std::atomic<bool> g_stalled(false);
+static std::atomic<int> g_conn_id(0);
+static int g_latency_ms = 0;
+
+static void on_usr1(int) {
+    g_stalled = !g_stalled;
+}
+
+/* 卡住时一直等到恢复; 连接被对端关闭时返回 false */
+static bool wait_unstalled(int fd) {
+    while (g_stalled) {
+        struct pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, 50) > 0) {
+            char c;
+            if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+                return false;
+            usleep(50000);  // 对端又发来了数据, 不能让 poll 空转
+        }
+    }
+    return true;
+}
+
+static bool read_full(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* 一条连接: 负责分包和包序号 */
+class session {
+public:
+    explicit session(int fd) : m_fd(fd), m_seq(0), m_next_stmt(1) {}
+
+    void run();
+
+private:
+    bool read_packet(std::string &payload);
+    bool send_packet(const std::string &payload);
+    bool send_ok(unsigned long long affected = 0);
+    bool send_err(int code, const char *state, const char *msg);
+    bool send_eof();
+    bool send_column(const char *name);
+
+    bool handshake();
+    bool prepare(const std::string &sql);
+    bool execute(const std::string &pkt);
+
+private:
+    int m_fd;
+    unsigned char m_seq;
+    unsigned int m_next_stmt;
+    std::map<unsigned int, stmt> m_stmts;
+};
+
+static void put_int(std::string &s, unsigned long long v, int bytes) {
+    for (int i = 0; i < bytes; ++i)
+        s += (char)((v >> (8 * i)) & 0xff);
+}
+
+static void put_lenenc(std::string &s, unsigned long long v) {
+    if (v < 251) {
+        put_int(s, v, 1);
+    }
+    else if (v < (1 << 16)) {
+        s += (char)0xfc;
+        put_int(s, v, 2);
+    }
+    else if (v < (1 << 24)) {
+        s += (char)0xfd;
+        put_int(s, v, 3);
+    }
+    else {
+        s += (char)0xfe;
+        put_int(s, v, 8);
+    }
+}
+
+static void put_lenenc_str(std::string &s, const std::string &v) {
+    put_lenenc(s, v.size());
+    s += v;
+}
+
+/* 从 pos 读一个长度编码整数, 越界返回 false */
+static bool get_lenenc(const std::string &s, size_t &pos, unsigned long long &v) {
+    if (pos >= s.size())
+        return false;
+    unsigned char c = s[pos++];
+    int bytes = 0;
+    if (c < 251) {
+        v = c;
+        return true;
+    }
+    if (c == 0xfc)
+        bytes = 2;
+    else if (c == 0xfd)
+        bytes = 3;
+    else if (c == 0xfe)
+        bytes = 8;
+    else
+        return false;
+    if (pos + bytes > s.size())
+        return false;
+    v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v |= (unsigned long long)(unsigned char)s[pos + i] << (8 * i);
+    pos += bytes;
+    return true;
+}
+
+static unsigned long long get_int(const std::string &s, size_t pos, int bytes) {
+    unsigned long long v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v |= (unsigned long long)(unsigned char)s[pos + i] << (8 * i);
+    return v;
+}
+
+bool session::read_packet(std::string &payload) {
+    unsigned char head[4];
+    if (!read_full(m_fd, head, 4))
+        return false;
+    size_t len = head[0] | head[1] << 8 | head[2] << 16;
+    m_seq = head[3] + 1;
+    payload.resize(len);
+    return len == 0 || read_full(m_fd, &payload[0], len);
+}
+
+bool session::send_packet(const std::string &payload) {
+    std::string out;
+    put_int(out, payload.size(), 3);
+    out += (char)m_seq++;
+    out += payload;
+    size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = send(m_fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool session::send_ok(unsigned long long affected) {
+    std::string p(1, '\0');
+    put_lenenc(p, affected);
+    put_lenenc(p, 0);  // last insert id
+    put_int(p, SERVER_STATUS_AUTOCOMMIT, 2);
+    put_int(p, 0, 2);  // warnings
+    return send_packet(p);
+}
+
+bool session::send_err(int code, const char *state, const char *msg) {
+    std::string p(1, (char)0xff);
+    put_int(p, code, 2);
+    p += '#';
+    p += state;
+    p += msg;
+    return send_packet(p);
+}
+
+bool session::send_eof() {
+    std::string p(1, (char)0xfe);
+    put_int(p, 0, 2);
+    put_int(p, SERVER_STATUS_AUTOCOMMIT, 2);
+    return send_packet(p);
+}
+
+bool session::send_column(const char *name) {
+    std::string p;
+    put_lenenc_str(p, "def");
+    put_lenenc_str(p, "qgydb");
+    put_lenenc_str(p, "user");
+    put_lenenc_str(p, "user");
+    put_lenenc_str(p, name);
+    put_lenenc_str(p, name);
+    put_lenenc(p, 0x0c);
+    put_int(p, CHARSET_UTF8, 2);
+    put_int(p, 150, 4);  // 列长度
+    put_int(p, TYPE_VAR_STRING, 1);
+    put_int(p, 0, 2);    // flags
+    put_int(p, 0, 1);    // decimals
+    put_int(p, 0, 2);
+    return send_packet(p);
+}
+
+bool session::handshake() {
+    unsigned int caps = CLIENT_LONG_PASSWORD | CLIENT_LONG_FLAG | CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41 |
+                        CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_MULTI_RESULTS |
+                        CLIENT_PS_MULTI_RESULTS | CLIENT_PLUGIN_AUTH;
+    std::string p(1, (char)10);  // 协议版本
+    p += "5.7.0-mock";
+    p += '\0';
+    put_int(p, ++g_conn_id, 4);
+    p += "01234567";  // 挑战值前 8 字节, 不校验密码, 固定即可
+    p += '\0';
+    put_int(p, caps & 0xffff, 2);
+    put_int(p, CHARSET_UTF8, 1);
+    put_int(p, SERVER_STATUS_AUTOCOMMIT, 2);
+    put_int(p, caps >> 16, 2);
+    put_int(p, 21, 1);  // 挑战值总长度
+    p.append(10, '\0');
+    p += "89abcdefghij";
+    p += '\0';
+    p += "mysql_native_password";
+    p += '\0';
+    m_seq = 0;
+    if (!send_packet(p))
+        return false;
+
+    std::string resp;
+    if (!read_packet(resp))
+        return false;
+    return send_ok();
+}
+
+bool session::prepare(const std::string &sql) {
+    stmt s;
+    if (sql.compare(0, 6, "INSERT") == 0 && sql.find("INTO user") != std::string::npos) {
+        s.kind = STMT_INSERT;
+        s.params = 2;
+    }
+    else if (sql.compare(0, 6, "SELECT") == 0 && sql.find("FROM user") != std::string::npos) {
+        s.kind = STMT_SELECT;
+        s.params = 1;
+    }
+    else {
+        return send_err(1064, "42000", "mock_mysqld: unsupported statement");
+    }
+    unsigned int id = m_next_stmt++;
+    m_stmts[id] = s;
+    int columns = s.kind == STMT_SELECT ? 1 : 0;
+
+    std::string p(1, '\0');
+    put_int(p, id, 4);
+    put_int(p, columns, 2);
+    put_int(p, s.params, 2);
+    p += '\0';
+    put_int(p, 0, 2);
+    if (!send_packet(p))
+        return false;
+
+    for (int i = 0; i < s.params; ++i) {
+        if (!send_column("?"))
+            return false;
+    }
+    if (s.params > 0 && !send_eof())
+        return false;
+    if (columns > 0 && (!send_column("passwd") || !send_eof()))
+        return false;
+    return true;
+}
+
+bool session::execute(const std::string &pkt) {
+    if (pkt.size() < 10)
+        return send_err(1835, "HY000", "mock_mysqld: malformed packet");
+    unsigned int id = get_int(pkt, 1, 4);
+    std::map<unsigned int, stmt>::iterator it = m_stmts.find(id);
+    if (it == m_stmts.end())
+        return send_err(1243, "HY000", "mock_mysqld: unknown statement");
+    stmt &s = it->second;
+
+    // 1 字节命令, 4 字节语句号, 1 字节 flags, 4 字节迭代次数, 然后是 NULL 位图
+    size_t pos = 10;
+    size_t bitmap = pos;
+    pos += (s.params + 7) / 8;
+    if (pos >= pkt.size())
+        return send_err(1835, "HY000", "mock_mysqld: malformed packet");
+    if (pkt[pos++]) {
+        s.types.clear();
+        for (int i = 0; i < s.params && pos + 2 <= pkt.size(); ++i, pos += 2)
+            s.types.push_back(get_int(pkt, pos, 2) & 0xff);
+    }
+    if ((int)s.types.size() != s.params)
+        return send_err(1835, "HY000", "mock_mysqld: parameter types not sent");
+
+    std::vector<std::string> values(s.params);
+    for (int i = 0; i < s.params; ++i) {
+        if (pkt[bitmap + i / 8] & (1 << (i % 8)))
+            continue;
+        int fixed = 0;
+        switch (s.types[i]) {
+            case 1: fixed = 1; break;   // TINY
+            case 2: fixed = 2; break;   // SHORT
+            case 3: fixed = 4; break;   // LONG
+            case 8: fixed = 8; break;   // LONGLONG
+        }
+        if (fixed) {
+            if (pos + fixed > pkt.size())
+                return send_err(1835, "HY000", "mock_mysqld: malformed packet");
+            values[i] = std::to_string(get_int(pkt, pos, fixed));
+            pos += fixed;
+            continue;
+        }
+        unsigned long long len;
+        if (!get_lenenc(pkt, pos, len) || pos + len > pkt.size())
+            return send_err(1835, "HY000", "mock_mysqld: malformed packet");
+        values[i] = pkt.substr(pos, len);
+        pos += len;
+    }
+
+    if (g_latency_ms > 0)
+        usleep(g_latency_ms * 1000);
+
+    if (s.kind == STMT_INSERT) {
+        pthread_mutex_lock(&g_lock);
+        bool added = g_users.insert(std::make_pair(values[0], values[1])).second;
+        pthread_mutex_unlock(&g_lock);
+        if (!added)
+            return send_err(1062, "23000", "Duplicate entry for key 'PRIMARY'");
+        return send_ok(1);
+    }
+
+    pthread_mutex_lock(&g_lock);
+    std::map<std::string, std::string>::iterator user = g_users.find(values[0]);
+    bool found = user != g_users.end();
+    std::string password = found ? user->second : "";
+    pthread_mutex_unlock(&g_lock);
+
+    std::string count;
+    put_lenenc(count, 1);
+    if (!send_packet(count) || !send_column("passwd") || !send_eof())
+        return false;
+    if (found) {
+        // 二进制结果行: 0x00, NULL 位图(列数 + 7 + 2) / 8 字节, 各列的值
+        std::string row(1, '\0');
+        row += '\0';
+        put_lenenc_str(row, password);
+        if (!send_packet(row))
+            return false;
+    }
+    return send_eof();
+}
+
+void session::run() {
+    if (!handshake())
+        return;
+
+    std::string pkt;
+    while (read_packet(pkt)) {
+        if (pkt.empty())
+            break;
+        bool ok = true;
+        switch ((unsigned char)pkt[0]) {
+            case COM_QUIT:
+                return;
+            case COM_PING:
+            case COM_INIT_DB:
+                ok = send_ok();
+                break;
+            case COM_QUERY:
+                ok = wait_unstalled(m_fd) && send_ok();
+                break;
+            case COM_STMT_PREPARE:
+                ok = wait_unstalled(m_fd) && prepare(pkt.substr(1));
+                break;
+            case COM_STMT_EXECUTE:
+                ok = wait_unstalled(m_fd) && execute(pkt);
+                break;
+            case COM_STMT_CLOSE:
+                if (pkt.size() >= 5)
+                    m_stmts.erase(get_int(pkt, 1, 4));
+                break;
+            case COM_STMT_RESET:
+                ok = send_ok();
+                break;
+            default:
+                ok = send_err(1047, "08S01", "mock_mysqld: unknown command");
+                break;
+        }
+        if (!ok)
+            return;
+    }
+}
+
+static void *serve(void *arg) {
+    int fd = (int)(long)arg;
+    session s(fd);
+    s.run();
+    close(fd);
+    return NULL;
+}
+
+static void *accept_loop(void *arg) {
+    int lfd = (int)(long)arg;
+    while (true) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            return NULL;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, serve, (void *)(long)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+static int listen_unix(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        perror(path);
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        perror("tcp");
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    int port = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:p:l:")) != -1) {
+        switch (opt) {
+            case 'u': path = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'l': g_latency_ms = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-u socket] [-p port] [-l ms] [user:password]...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (!path && !port) {
+        fprintf(stderr, "%s: need -u or -p\n", argv[0]);
+        return 1;
+    }
+    for (int i = optind; i < argc; ++i) {
+        const char *colon = strchr(argv[i], ':');
+        if (colon)
+            g_users[std::string(argv[i], colon - argv[i])] = colon + 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_usr1;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    int ufd = path ? listen_unix(path) : -1;
+    int tfd = port ? listen_tcp(port) : -1;
+    if ((path && ufd < 0) || (port && tfd < 0))
+        return 1;
+
+    pthread_t tid;
+    if (ufd >= 0 && tfd >= 0)
+        pthread_create(&tid, NULL, accept_loop, (void *)(long)tfd);
+    accept_loop((void *)(long)(ufd >= 0 ? ufd : tfd));
+    return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/bash
+# 回归检查: 依次运行 tests/check_*.sh, 每个脚本自己启动需要的 server, 返回非0表示失败
+# 在仓库根目录运行, 一般通过 make check
+
+failed=0
+for t in tests/check_*.sh; do
+    if $t; then
+        echo "PASS $t"
+    else
+        echo "FAIL $t"
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,32 @@
+/*
+    测试用的 LD_PRELOAD 库: 套接字上的每次 writev 最多写 SHORT_WRITE 字节(默认 13),
+    模拟发送缓冲区快满时的短写, 让响应头和文件都分很多次才发完
+    g++ -shared -fPIC -o tests/short_write.so tests/short_write.cpp -ldl
+ */
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+typedef ssize_t (*writev_fn)(int, const struct iovec *, int);
+
+extern "C" ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    static writev_fn real = (writev_fn)dlsym(RTLD_NEXT, "writev");
+    static size_t limit = getenv("SHORT_WRITE") ? atol(getenv("SHORT_WRITE")) : 13;
+
+    struct stat st;
+    if (limit == 0 || fstat(fd, &st) < 0 || !S_ISSOCK(st.st_mode))
+        return real(fd, iov, iovcnt);
+
+    // 截掉超过 limit 的部分, 只交给内核前 limit 字节
+    struct iovec cut[16];
+    int n = 0;
+    size_t left = limit;
+    for (int i = 0; i < iovcnt && i < 16 && left > 0; ++i) {
+        cut[n].iov_base = iov[i].iov_base;
+        cut[n].iov_len = iov[i].iov_len < left ? iov[i].iov_len : left;
+        left -= cut[n].iov_len;
+        ++n;
+    }
+    return real(fd, cut, n);
+}
@@ -0,0 +1,131 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+#include <exception>
+#include "lf_queue.h"
+#include "metrics.h"
+#include "trace.h"
+
+/*************************************************************
+ * 线程池
+ *
+ * 主线程把就绪的连接放入请求队列, 工作线程取出后处理:
+ *   - reactor(actor_model 为1): 工作线程负责读写套接字, 再处理请求
+ *   - proactor: 主线程已经读完数据, 工作线程只处理请求
+ * 请求队列是无锁的 mpmc_queue, 入队不加锁, 队列为空时工作线程睡在 futex 上.
+ * 入队时在请求上记下时间, 取出时记录排队耗时(metrics::PHASE_QUEUE), 开启追踪时同时记一段 queue.
+ * 数据库连接由存储后端在用到时自己从连接池取, 这里不再为每个请求占一个连接.
+ **************************************************************/
+template <typename T>
+class threadpool {
+public:
+    /* thread_number 是线程池中线程的数量, max_requests 是请求队列中最多允许的、等待处理的请求的数量 */
+    threadpool(int actor_model, int thread_number = 8, int max_requests = 10000);
+    ~threadpool();
+
+    /* reactor: state 为0表示读事件, 1表示写事件 */
+    bool append(T *request, int state);
+    /* proactor */
+    bool append_p(T *request);
+
+    /* 等待处理的请求数, 近似值 */
+    size_t queue_size() const { return m_workqueue.size(); }
+
+private:
+    /* 工作线程运行的函数, 它不断从工作队列中取出任务并执行之 */
+    static void *worker(void *arg);
+    void run();
+
+private:
+    int m_thread_number;          // 线程池中的线程数
+    pthread_t *m_threads;         // 描述线程池的数组, 其大小为 m_thread_number
+    mpmc_queue<T *> m_workqueue;  // 请求队列
+    int m_actor_model;            // 模型切换
+};
+
+template <typename T>
+threadpool<T>::threadpool(int actor_model, int thread_number, int max_requests)
+    : m_thread_number(thread_number), m_threads(NULL), m_workqueue(max_requests), m_actor_model(actor_model) {
+    if (thread_number <= 0 || max_requests <= 0)
+        throw std::exception();
+    m_threads = new pthread_t[m_thread_number];
+    for (int i = 0; i < thread_number; ++i) {
+        if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
+            m_workqueue.close();
+            for (int j = 0; j < i; ++j)
+                pthread_join(m_threads[j], NULL);
+            delete[] m_threads;
+            throw std::exception();
+        }
+    }
+}
+
+template <typename T>
+threadpool<T>::~threadpool() {
+    /* 关闭队列, 工作线程处理完剩余请求后退出 */
+    m_workqueue.close();
+    for (int i = 0; i < m_thread_number; ++i)
+        pthread_join(m_threads[i], NULL);
+    delete[] m_threads;
+}
+
+template <typename T>
+bool threadpool<T>::append(T *request, int state) {
+    request->m_state = state;
+    request->m_enqueue_usec = metrics::now_usec();
+    if (tracer::on())
+        request->m_enqueue_tsc = tracer::ticks();
+    return m_workqueue.try_push(std::move(request));
+}
+
+template <typename T>
+bool threadpool<T>::append_p(T *request) {
+    request->m_enqueue_usec = metrics::now_usec();
+    if (tracer::on())
+        request->m_enqueue_tsc = tracer::ticks();
+    return m_workqueue.try_push(std::move(request));
+}
+
+template <typename T>
+void *threadpool<T>::worker(void *arg) {
+    threadpool *pool = (threadpool *)arg;
+    pool->run();
+    return pool;
+}
+
+template <typename T>
+void threadpool<T>::run() {
+    T *request;
+    tracer::thread_name("worker");
+    while (m_workqueue.pop(request)) {
+        if (!request)
+            continue;
+        metrics::record(metrics::PHASE_QUEUE, metrics::now_usec() - request->m_enqueue_usec);
+        if (tracer::on())
+            tracer::async_span(tracer::SPAN_QUEUE, request->get_sockfd(), request->trace_id(), request->m_enqueue_tsc,
+                               tracer::ticks());
+        if (1 == m_actor_model) {
+            if (0 == request->m_state) {
+                if (request->read_once()) {
+                    request->improv = 1;
+                    request->process();
+                } else {
+                    request->improv = 1;
+                    request->timer_flag = 1;
+                }
+            } else {
+                if (request->write()) {
+                    request->improv = 1;
+                } else {
+                    request->improv = 1;
+                    request->timer_flag = 1;
+                }
+            }
+        } else {
+            request->process();
+        }
+    }
+}
+
+#endif  // THREADPOOL_H
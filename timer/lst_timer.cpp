@@ -169,13 +169,16 @@ void timer_heap::tick()  {
     while(size) {
         if(array[1]->expire > cur) break;
         array[1]->cb_func(array[1]->user_data);
+        metrics::add(metrics::TIMER_EXPIRED);
         pop_timer();
         --size;
     }
 }
 /* 定时处理任务 */
 void Utils::timer_handler() {
+    long long start = metrics::now_usec();
     heap.tick();
+    metrics::record(metrics::PHASE_TIMER_TICK, metrics::now_usec() - start);
     int nextClock = heap.top()->expire - time(NULL);
     alarm(nextClock);
 }
@@ -1,5 +1,69 @@
 #include "webserver.h"
 
+/* /metrics 抓取时读取的数值 */
+static long long active_conns(void *)
+{
+    return http_conn::m_user_count.load(std::memory_order_relaxed);
+}
+
+static long long log_dropped(void *)
+{
+    return Log::get_instance()->dropped();
+}
+
+static long long access_dropped(void *)
+{
+    return access_log::get_instance()->dropped();
+}
+
+static long long resident_bytes(void *)
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return (long long)resident * sysconf(_SC_PAGESIZE);
+}
+
+static long long queue_depth(void *ctx)
+{
+    return ((threadpool<http_conn> *)ctx)->queue_size();
+}
+
+static long long db_used(void *ctx)
+{
+    return ((connection_pool *)ctx)->GetUsedConn();
+}
+
+static long long db_free(void *ctx)
+{
+    return ((connection_pool *)ctx)->GetFreeConn();
+}
+
+static long long db_max(void *ctx)
+{
+    return ((connection_pool *)ctx)->GetMaxConn();
+}
+
+static long long mock_used(void *ctx)
+{
+    return ((mock_backend *)ctx)->used();
+}
+
+static long long mock_free(void *ctx)
+{
+    mock_backend *backend = (mock_backend *)ctx;
+    return backend->max_conn() - backend->used();
+}
+
+static long long mock_max(void *ctx)
+{
+    return ((mock_backend *)ctx)->max_conn();
+}
+
 WebServer::WebServer()
 {
     //http_conn类对象
@@ -23,13 +87,22 @@ WebServer::~WebServer()
     close(m_listenfd);
     close(m_pipefd[1]);
     close(m_pipefd[0]);
+    //缓存中的用户作为热点, 下次启动时预热
+    if (!m_user_hot_file.empty())
+        user_store::get_instance()->save(m_user_hot_file.c_str());
+    delete user_backend::get_instance();
+    user_backend::set_instance(NULL);
     delete[] users;
     delete[] users_timer;
     delete m_pool;
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model,
+                     int tls, string tls_cert, string tls_key,
+                     int user_cache, string user_hot_file, int storage, string storage_file,
+                     int log_level, int log_compress, int access_sample, string mock_db,
+                     string trace_file)
 {
     m_port = port;
     m_user = user;
@@ -42,6 +115,19 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+    m_tls = tls;
+    m_tls_cert = tls_cert;
+    m_tls_key = tls_key;
+    m_user_cache = user_cache;
+    m_user_hot_file = user_hot_file;
+    m_storage = storage;
+    m_storage_file = storage_file;
+    m_log_level = log_level;
+    m_log_debug = false;
+    m_log_compress = log_compress;
+    m_access_sample = access_sample;
+    m_mock_db = mock_db;
+    m_trace_file = trace_file;
 }
 
 void WebServer::trig_mode()
@@ -74,30 +160,101 @@ void WebServer::trig_mode()
 
 void WebServer::log_write()
 {
+    Log::set_level(m_log_level);
     if (0 == m_close_log)
     {
         //初始化日志
-        if (1 == m_log_write)
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800);
+        bool compress = 1 == m_log_compress;
+        if (2 == m_log_write)
+            Log::get_instance()->init("./ServerLog.bin", m_close_log, 2000, 800000, 800, true, compress);
+        else if (1 == m_log_write)
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 800, false, compress);
         else
-            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0);
+            Log::get_instance()->init("./ServerLog", m_close_log, 2000, 800000, 0, false, compress);
+    }
+
+    //访问日志, 写二进制运行日志时也写二进制
+    if (2 == m_log_write)
+        access_log::get_instance()->init("./AccessLog.bin", m_access_sample, true);
+    else
+        access_log::get_instance()->init("./AccessLog", m_access_sample, false);
+
+    metrics *m = metrics::get_instance();
+    m->add_sampler("tws_active_connections", "Open client connections.", "gauge", active_conns, NULL);
+    m->add_sampler("tws_log_dropped_total{log=\"server\"}", "Log records dropped because a ring was full.", "counter",
+                   log_dropped, NULL);
+    m->add_sampler("tws_log_dropped_total{log=\"access\"}", NULL, "counter", access_dropped, NULL);
+    m->add_sampler("process_resident_memory_bytes", "Resident memory size in bytes.", "gauge", resident_bytes, NULL);
+
+    //逐请求追踪, 在创建线程池之前开启; SIGUSR1 时导出
+    if (!m_trace_file.empty())
+    {
+        tracer::get_instance()->init(m_trace_file);
+        LOG_INFO("tracing on, SIGUSR1 writes %s_<time>.json", m_trace_file.c_str());
     }
 }
 
 void WebServer::sql_pool()
 {
-    //初始化数据库连接池
-    m_connPool = connection_pool::GetInstance();
-    m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    if (1 == m_storage)
+    {
+        //本地文件存储, 不连接数据库
+        m_connPool = NULL;
+        file_backend *backend = new file_backend;
+        if (!backend->open(m_storage_file.c_str()))
+        {
+            //存储打不开时不启动, 否则所有登录和注册都会失败; exit 时日志线程会写完剩余日志
+            LOG_ERROR("open user storage %s failed", m_storage_file.c_str());
+            exit(1);
+        }
+        LOG_INFO("user storage %s loaded %d users", m_storage_file.c_str(), (int)backend->size());
+        user_backend::set_instance(backend);
+    }
+    else if (2 == m_storage)
+    {
+        //模拟数据库, 连接数同样由 -s 指定
+        m_connPool = NULL;
+        mock_backend *backend = new mock_backend(m_sql_num);
+        if (!backend->init(m_mock_db.c_str()))
+        {
+            //拼错的参数不能变成别的延迟模型, 压测结果会误导
+            LOG_ERROR("bad mock db spec %s", m_mock_db.c_str());
+            exit(1);
+        }
+        LOG_INFO("mock db %s, %d connections", m_mock_db.c_str(), m_sql_num);
+        user_backend::set_instance(backend);
 
-    //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+        metrics *m = metrics::get_instance();
+        m->add_sampler("tws_db_connections{state=\"used\"}", "Database pool connections.", "gauge", mock_used, backend);
+        m->add_sampler("tws_db_connections{state=\"free\"}", NULL, "gauge", mock_free, backend);
+        m->add_sampler("tws_db_connections_max", "Database pool size limit.", "gauge", mock_max, backend);
+    }
+    else
+    {
+        //初始化数据库连接池
+        m_connPool = connection_pool::GetInstance();
+        m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+        user_backend::set_instance(new mysql_backend(m_connPool));
+
+        metrics *m = metrics::get_instance();
+        m->add_sampler("tws_db_connections{state=\"used\"}", "Database pool connections.", "gauge", db_used, m_connPool);
+        m->add_sampler("tws_db_connections{state=\"free\"}", NULL, "gauge", db_free, m_connPool);
+        m->add_sampler("tws_db_connections_max", "Database pool size limit.", "gauge", db_max, m_connPool);
+
+        //注册等请求使用的非阻塞查询连接, 在事件循环中连接
+        sql_async::get_instance()->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
+    }
+
+    //初始化用户缓存, 用户在第一次登录或注册时按需查询
+    users->init_user_cache((size_t)m_user_cache << 20, m_user_hot_file, m_close_log);
 }
 
 void WebServer::thread_pool()
 {
     //线程池
-    m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
+    m_pool = new threadpool<http_conn>(m_actormodel, m_thread_num);
+    metrics::get_instance()->add_sampler("tws_queue_depth", "Requests waiting for a worker thread.", "gauge",
+                                         queue_depth, m_pool);
 }
 
 void WebServer::eventListen()
@@ -118,6 +275,14 @@ void WebServer::eventListen()
         setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
+    //连接数多时默认的1024个文件描述符不够, 调到系统允许的上限
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
     int ret = 0;
     struct sockaddr_in address;
     bzero(&address, sizeof(address));
@@ -132,6 +297,15 @@ void WebServer::eventListen()
     ret = listen(m_listenfd, 5);
     assert(ret >= 0);
 
+    //TLS,证书加载失败时不能退回明文监听
+    if (1 == m_tls)
+    {
+        bool ok = tls_context::get_instance()->init(m_tls_cert.c_str(), m_tls_key.c_str());
+        if (!ok)
+            LOG_ERROR("load tls cert %s / key %s failed", m_tls_cert.c_str(), m_tls_key.c_str());
+        assert(ok);
+    }
+
     utils.init(TIMESLOT);
 
     //epoll创建内核事件表
@@ -147,9 +321,15 @@ void WebServer::eventListen()
     utils.setnonblocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false, 0);
 
+    //非阻塞查询的数据库连接也由epoll监听
+    if (0 == m_storage && !sql_async::get_instance()->start(m_epollfd))
+        LOG_ERROR("%s", "async sql start failure");
+
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGUSR2, utils.sig_handler, false);
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
 
     alarm(TIMESLOT);
 
@@ -183,7 +363,7 @@ void WebServer::adjust_timer(util_timer *timer)
     timer->expire = cur + 3 * TIMESLOT;
     utils.m_timer_lst.adjust_timer(timer);
 
-    LOG_INFO("%s", "adjust timer once");
+    LOG_DEBUG("%s", "adjust timer once");
 }
 
 void WebServer::deal_timer(util_timer *timer, int sockfd)
@@ -194,7 +374,7 @@ void WebServer::deal_timer(util_timer *timer, int sockfd)
         utils.m_timer_lst.del_timer(timer);
     }
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    LOG_DEBUG("close fd %d", users_timer[sockfd].sockfd);
 }
 
 bool WebServer::dealclinetdata()
@@ -203,38 +383,48 @@ bool WebServer::dealclinetdata()
     socklen_t client_addrlength = sizeof(client_address);
     if (0 == m_LISTENTrigmode)
     {
+        uint64_t begin = tracer::on() ? tracer::ticks() : 0;
         int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
         if (connfd < 0)
         {
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD)
+        if (connfd >= MAX_FD || http_conn::m_user_count >= MAX_FD)
         {
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
+            metrics::add(metrics::REJECTS);
             return false;
         }
+        metrics::add(metrics::ACCEPTS);
         timer(connfd, client_address);
+        if (begin)
+            tracer::span(tracer::SPAN_ACCEPT, connfd, 0, begin, tracer::ticks());
     }
 
     else
     {
         while (1)
         {
+            uint64_t begin = tracer::on() ? tracer::ticks() : 0;
             int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
             if (connfd < 0)
             {
                 LOG_ERROR("%s:errno is:%d", "accept error", errno);
                 break;
             }
-            if (http_conn::m_user_count >= MAX_FD)
+            if (connfd >= MAX_FD || http_conn::m_user_count >= MAX_FD)
             {
                 utils.show_error(connfd, "Internal server busy");
                 LOG_ERROR("%s", "Internal server busy");
+                metrics::add(metrics::REJECTS);
                 break;
             }
+            metrics::add(metrics::ACCEPTS);
             timer(connfd, client_address);
+            if (begin)
+                tracer::span(tracer::SPAN_ACCEPT, connfd, 0, begin, tracer::ticks());
         }
         return false;
     }
@@ -271,6 +461,43 @@ bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
                 stop_server = true;
                 break;
             }
+            case SIGUSR2:
+            {
+                //在 debug 和配置的级别之间切换, 排查问题时临时打开逐请求的日志
+                m_log_debug = !m_log_debug;
+                Log::set_level(m_log_debug ? 0 : m_log_level);
+                //切换提示不受级别过滤, 配置为 error 时也能看到
+                if (0 == m_close_log)
+                {
+                    Log::get_instance()->write_log(1, "log level switched to %d", Log::level());
+                    Log::get_instance()->flush();
+                }
+                break;
+            }
+            case SIGUSR1:
+            {
+                //各阶段耗时的分位数写入日志, 和 /metrics 中的相同
+                std::vector<std::string> lines;
+                metrics::get_instance()->latency_report(lines);
+                for (size_t j = 0; j < lines.size(); ++j)
+                    LOG_WARN("%s", lines[j].c_str());
+
+                //开启追踪时导出各线程最近的记录, 写文件期间事件循环停顿
+                if (tracer::on())
+                {
+                    std::string file;
+                    int spans = tracer::get_instance()->dump(file);
+                    if (spans < 0)
+                    {
+                        LOG_ERROR("write trace %s failed", file.c_str());
+                    }
+                    else
+                    {
+                        LOG_WARN("trace: %d spans written to %s", spans, file.c_str());
+                    }
+                }
+                break;
+            }
             }
         }
     }
@@ -311,7 +538,8 @@ void WebServer::dealwithread(int sockfd)
         //proactor
         if (users[sockfd].read_once())
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            char ip[INET_ADDRSTRLEN];
+            LOG_DEBUG("deal with the client(%s)", inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, ip, sizeof(ip)));
 
             //若监测到读事件，将该事件放入请求队列
             m_pool->append_p(users + sockfd);
@@ -360,7 +588,8 @@ void WebServer::dealwithwrite(int sockfd)
         //proactor
         if (users[sockfd].write())
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            char ip[INET_ADDRSTRLEN];
+            LOG_DEBUG("send data to the client(%s)", inet_ntop(AF_INET, &users[sockfd].get_address()->sin_addr, ip, sizeof(ip)));
 
             if (timer)
             {
@@ -378,6 +607,7 @@ void WebServer::eventLoop()
 {
     bool timeout = false;
     bool stop_server = false;
+    tracer::thread_name("main");
 
     while (!stop_server)
     {
@@ -399,6 +629,11 @@ void WebServer::eventLoop()
                 if (false == flag)
                     continue;
             }
+            //数据库连接上的事件,推进异步查询
+            else if (sql_async::get_instance()->owns(sockfd))
+            {
+                sql_async::get_instance()->on_event(sockfd, events[i].events);
+            }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
                 //服务器端关闭连接，移除对应的定时器
@@ -425,8 +660,9 @@ void WebServer::eventLoop()
         if (timeout)
         {
             utils.timer_handler();
+            sql_async::get_instance()->on_tick();
 
-            LOG_INFO("%s", "timer tick");
+            LOG_DEBUG("%s", "timer tick");
 
             timeout = false;
         }
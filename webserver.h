@@ -11,11 +11,19 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/resource.h>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./storage/mysql_backend.h"
+#include "./storage/file_backend.h"
+#include "./storage/mock_backend.h"
 
-const int MAX_FD = 65536;           //最大文件描述符
+//最大文件描述符, 每个都预先分配一个 http_conn; 压测更多连接时在编译时调大: make MAX_FD=262144
+#ifndef MAX_FD_LIMIT
+#define MAX_FD_LIMIT 65536
+#endif
+const int MAX_FD = MAX_FD_LIMIT;
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
 const int TIMESLOT = 5;             //最小超时单位
 
@@ -27,7 +35,11 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model,
+              int tls, string tls_cert, string tls_key,
+              int user_cache, string user_hot_file, int storage, string storage_file,
+              int log_level, int log_compress, int access_sample, string mock_db,
+              string trace_file);
 
     void thread_pool();
     void sql_pool();
@@ -48,9 +60,30 @@ public:
     int m_port;
     char *m_root;
     int m_log_write;
+    int m_log_level;      // 配置的运行时日志级别
+    bool m_log_debug;     // SIGUSR2 临时切换到了 debug 级别
+    int m_log_compress;   // 压缩切分下来的日志文件
+    int m_access_sample;  // 访问日志每 N 个请求记录一个, 0 关闭
     int m_close_log;
     int m_actormodel;
 
+    //TLS相关
+    int m_tls;
+    string m_tls_cert;
+    string m_tls_key;
+
+    //用户缓存
+    int m_user_cache;
+    string m_user_hot_file;
+
+    //用户存储
+    int m_storage;
+    string m_storage_file;
+    string m_mock_db;     // 模拟数据库的参数, 见 mock_backend::init
+
+    //追踪导出文件的前缀, 空表示不开启追踪
+    string m_trace_file;
+
     int m_pipefd[2];
     int m_epollfd;
     http_conn *users;